@@ -182,4 +182,5 @@ BOARD_SEPOLICY_UNION := \
 	file_contexts \
 	file.te \
 	macloader.te \
+	mediaserver.te \
 	ueventd.te
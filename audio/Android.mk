@@ -21,16 +21,166 @@ LOCAL_MODULE := audio.primary.$(TARGET_BOOTLOADER_BOARD_NAME)
 LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
 LOCAL_MODULE_TAGS := optional
 
-LOCAL_SRC_FILES := audio_hw.c ril_interface.c
+LOCAL_SRC_FILES := audio_hw.c ril_interface.c route_engine.c rate_converter.c \
+	lock_stats.c
 
 LOCAL_C_INCLUDES += \
 	external/tinyalsa/include \
 	$(call include-path-for, audio-effects) \
 	$(call include-path-for, audio-utils) \
-	$(call include-path-for, audio-route) \
+	external/expat/lib \
 	hardware/samsung/ril/libsecril-client
 
 LOCAL_SHARED_LIBRARIES := liblog libcutils libtinyalsa libaudioutils libdl \
-	libaudioroute libsecril-client
+	libexpat libsecril-client
+
+# lock wait and hold times in dumpsys media.audio_flinger
+ifeq ($(AUDIO_HAL_LOCK_STATS),true)
+LOCAL_CFLAGS += -DLOCK_STATS
+endif
+
+include $(BUILD_SHARED_LIBRARY)
+
+# Route table checker, run on the build host:
+#   route_check $(LOCAL_PATH)/../configs/audio/mixer_paths.xml
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := route_check
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_SRC_FILES := tools/route_check.c
+
+LOCAL_C_INCLUDES += \
+	$(LOCAL_PATH) \
+	external/expat/lib
+
+LOCAL_STATIC_LIBRARIES := libexpat
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# Stand-in for libsecril-client talking to fake_rild over a Unix socket.
+# Installed out of the library path, picked up by the HAL with
+#   LD_LIBRARY_PATH=/system/lib/fake-ril
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := libsecril-client-fake
+LOCAL_MODULE_STEM := libsecril-client
+LOCAL_MODULE_RELATIVE_PATH := fake-ril
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_SRC_FILES := tools/fake_secril/secril_client_fake.c
+
+LOCAL_C_INCLUDES += hardware/samsung/ril/libsecril-client
+
+LOCAL_SHARED_LIBRARIES := liblog
 
 include $(BUILD_SHARED_LIBRARY)
+
+# Modem stand-in with configurable latency and failures
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := fake_rild
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_SRC_FILES := tools/fake_secril/fake_rild.c
+
+LOCAL_C_INCLUDES += hardware/samsung/ril/libsecril-client
+
+include $(BUILD_EXECUTABLE)
+
+# Call setup and in-call routing latency through the HAL
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := ril_bench
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_SRC_FILES := tools/ril_bench.c
+
+LOCAL_SHARED_LIBRARIES := libhardware libdl
+
+include $(BUILD_EXECUTABLE)
+
+# The HAL built for the host against a tinyalsa with a simulated DMA clock
+# and the fake secril-client, loaded by hal_replay. Start fake_rild with
+#   FAKE_RILD_SOCKET=/tmp/fake-rild
+# in the environment of both before replaying calls.
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := audio.primary.host
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_SRC_FILES := audio_hw.c ril_interface.c route_engine.c rate_converter.c \
+	lock_stats.c \
+	tools/host/tinyalsa_stub.c \
+	tools/host/resampler_stub.c \
+	tools/fake_secril/secril_client_fake.c
+
+LOCAL_C_INCLUDES += \
+	$(LOCAL_PATH) \
+	external/tinyalsa/include \
+	$(call include-path-for, audio-effects) \
+	$(call include-path-for, audio-utils) \
+	external/expat/lib \
+	hardware/samsung/ril/libsecril-client
+
+LOCAL_CFLAGS += \
+	-D__unused='__attribute__((unused))' \
+	-DMIXER_XML_PATH='"$(LOCAL_PATH)/../configs/audio/mixer_paths.xml"' \
+	-DGAIN_CONF_PATH='"$(LOCAL_PATH)/../configs/audio/default_gain.conf"' \
+	-DROUTE_DB_PATH='"/tmp/mixer_paths.bin"' \
+	-DLOCK_STATS
+
+LOCAL_STATIC_LIBRARIES := libexpat libcutils liblog
+LOCAL_LDLIBS := -ldl -lpthread -lrt
+
+include $(BUILD_HOST_SHARED_LIBRARY)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := fake_rild
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_SRC_FILES := tools/fake_secril/fake_rild.c
+
+LOCAL_C_INCLUDES += hardware/samsung/ril/libsecril-client
+
+LOCAL_LDLIBS := -lpthread
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# RIL command queue checks, run against fake_rild:
+#   fake_rild -l clock=200 &
+#   ril_queue_test
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := ril_queue_test
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_SRC_FILES := tools/ril_queue_test.c ril_interface.c \
+	tools/fake_secril/secril_client_fake.c
+
+LOCAL_C_INCLUDES += \
+	$(LOCAL_PATH) \
+	hardware/samsung/ril/libsecril-client
+
+LOCAL_CFLAGS += -D__unused='__attribute__((unused))'
+
+LOCAL_STATIC_LIBRARIES := libcutils liblog
+LOCAL_LDLIBS := -lpthread
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# Replays AudioFlinger call sequences, see tools/traces:
+#   hal_replay $(LOCAL_PATH)/tools/traces/voice_call.trace
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := hal_replay
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_SRC_FILES := tools/hal_replay.c
+
+LOCAL_C_INCLUDES += hardware/samsung/ril/libsecril-client
+
+LOCAL_LDLIBS := -ldl -lpthread -lrt
+
+include $(BUILD_HOST_EXECUTABLE)
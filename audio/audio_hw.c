@@ -23,9 +23,11 @@
 
 #include <errno.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <time.h>
 #include <dlfcn.h>
 
 #include <cutils/log.h>
@@ -40,12 +42,15 @@
 #include <tinyalsa/asoundlib.h>
 
 #include <audio_utils/resampler.h>
-#include <audio_route/audio_route.h>
 
 #include "routing.h"
+#include "route_engine.h"
+#include "rate_converter.h"
 
 #include "ril_interface.h"
 
+#include "lock_stats.h"
+
 #define PCM_CARD 0
 #define PCM_CARD_SPDIF 1
 #define PCM_TOTAL 2
@@ -60,10 +65,41 @@
 
 #define CAPTURE_START_RAMP_MS 100
 
+/* time budget of the output gain ramps around a path switch */
+#define ROUTE_RAMP_TIME_US 10000
+
+/*
+ * Routing requests from set_parameters() are held back until no new one
+ * came for ROUTE_DEBOUNCE_MS, but never longer than ROUTE_DEBOUNCE_MAX_MS
+ */
+#define ROUTE_DEBOUNCE_MS 30
+#define ROUTE_DEBOUNCE_MAX_MS 100
+
+/* audible gap allowed when a call switches between narrow and wide band */
+#define VOICE_RATE_SWITCH_TARGET_MS 20
+
 #define MAX_SUPPORTED_CHANNEL_MASKS 1
 
+/*
+ * In-call capture reads the modem PCM directly. The voice DAI carries the
+ * uplink (near end) in the left slot and the downlink (far end) in the right.
+ */
+#define VOICE_TAP_UPLINK_SLOT 0
+#define VOICE_TAP_DNLINK_SLOT 1
+
+/*
+ * A voice tap reads a period in this many pieces, each under voice_tx_lock,
+ * and stops once the call wants to close the PCM, so the call waits for one
+ * piece at most instead of a whole period
+ */
+#define VOICE_TAP_READS 8
+
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof((a[0])))
 
+#ifndef AUDIO_PARAMETER_KEY_BT_SCO_WB
+#define AUDIO_PARAMETER_KEY_BT_SCO_WB "bt_wbs"
+#endif
+
 struct pcm_config pcm_config = {
     .channels = 2,
     .rate = 48000,
@@ -104,6 +140,15 @@ struct pcm_config pcm_config_sco = {
     .format = PCM_FORMAT_S16_LE,
 };
 
+/* mSBC wide band speech, see the bt_wbs parameter */
+struct pcm_config pcm_config_sco_wide = {
+    .channels = 1,
+    .rate = 16000,
+    .period_size = 256,
+    .period_count = 2,
+    .format = PCM_FORMAT_S16_LE,
+};
+
 struct pcm_config pcm_config_voice = {
     .channels = 2,
     .rate = 8000,
@@ -120,30 +165,164 @@ struct pcm_config pcm_config_voice_wide = {
     .format = PCM_FORMAT_S16_LE,
 };
 
+struct capture_profile {
+    audio_source_t source;
+    audio_devices_t devices; /* without AUDIO_DEVICE_BIT_IN, NONE matches any */
+    struct pcm_config config;
+};
+
+/*
+ * Native capture configurations per input source and device, first match
+ * wins. A profile is only used if its rate is at least the requested one,
+ * anything else falls back to pcm_config_in and the resampler.
+ */
+struct capture_profile capture_profiles[] = {
+    {
+        AUDIO_SOURCE_VOICE_COMMUNICATION,
+        AUDIO_DEVICE_IN_BLUETOOTH_SCO_HEADSET & ~AUDIO_DEVICE_BIT_IN,
+        { .channels = 1, .rate = 8000, .period_size = 160,
+          .period_count = 4, .format = PCM_FORMAT_S16_LE },
+    },
+    {
+        AUDIO_SOURCE_VOICE_COMMUNICATION,
+        AUDIO_DEVICE_NONE,
+        { .channels = 1, .rate = 16000, .period_size = 320,
+          .period_count = 4, .format = PCM_FORMAT_S16_LE },
+    },
+    {
+        AUDIO_SOURCE_VOICE_RECOGNITION,
+        AUDIO_DEVICE_NONE,
+        { .channels = 1, .rate = 16000, .period_size = 320,
+          .period_count = 4, .format = PCM_FORMAT_S16_LE },
+    },
+    {
+        AUDIO_SOURCE_MIC,
+        AUDIO_DEVICE_IN_BLUETOOTH_SCO_HEADSET & ~AUDIO_DEVICE_BIT_IN,
+        { .channels = 1, .rate = 8000, .period_size = 160,
+          .period_count = 4, .format = PCM_FORMAT_S16_LE },
+    },
+};
+
 enum output_type {
     OUTPUT_DEEP_BUF,
     OUTPUT_LOW_LATENCY,
     OUTPUT_TOTAL
 };
 
+/* Classes of the lock contention statistics, see lock_stats.h */
+enum lock_class {
+    LOCK_CLASS_OUTPUTS,                         /* adev->lock_outputs */
+    LOCK_CLASS_OUT,                             /* out->lock, per output type */
+    LOCK_CLASS_ADEV = LOCK_CLASS_OUT + OUTPUT_TOTAL,
+    LOCK_CLASS_IN,
+    LOCK_CLASS_CNT
+};
+
+#ifdef LOCK_STATS
+static const char * const lock_class_names[LOCK_CLASS_CNT] = {
+    [LOCK_CLASS_OUTPUTS] = "adev->lock_outputs",
+    [LOCK_CLASS_OUT + OUTPUT_DEEP_BUF] = "out->lock (deep buffer)",
+    [LOCK_CLASS_OUT + OUTPUT_LOW_LATENCY] = "out->lock (low latency)",
+    [LOCK_CLASS_ADEV] = "adev->lock",
+    [LOCK_CLASS_IN] = "in->lock",
+};
+#endif
+
+/*
+ * Output devices which can be combined freely, sets of them without an
+ * entry in route_configs[][] are composed from the route of each device.
+ */
+#define OUT_DEVICE_SINGLE_CNT (OUT_DEVICE_BT_SCO_CARKIT + 1)
+#define OUT_DEVICE_MASK_BITS 16 /* room for the mask in route IDs */
+#define ROUTE_ID_BT_WBS (1 << 30)
+#define OUT_DEVICE_MASK_CNT (1 << OUT_DEVICE_SINGLE_CNT)
+
+/*
+ * The single output devices are the low bits of audio_devices_t, so any
+ * output device set indexes a table of what select_devices() needs from
+ * it without searching, built once at open.
+ */
+#define DEVICE_SET_BITS (AUDIO_DEVICE_OUT_EARPIECE | \
+                         AUDIO_DEVICE_OUT_SPEAKER | \
+                         AUDIO_DEVICE_OUT_WIRED_HEADSET | \
+                         AUDIO_DEVICE_OUT_WIRED_HEADPHONE | \
+                         AUDIO_DEVICE_OUT_BLUETOOTH_SCO | \
+                         AUDIO_DEVICE_OUT_BLUETOOTH_SCO_HEADSET | \
+                         AUDIO_DEVICE_OUT_BLUETOOTH_SCO_CARKIT)
+#define DEVICE_SET_CNT (DEVICE_SET_BITS + 1)
+
+struct device_set {
+    int8_t device_id;           /* route_configs[][] column or OUT_DEVICE_NONE */
+    uint8_t mask;               /* single devices, by OUT_DEVICE_* bit */
+    uint8_t call_audio_path[2]; /* enum _AudioPath, without and with NREC */
+};
+
+struct composed_route {
+    int primary;        /* device whose input route and gains are used */
+    struct route_vector *route;
+    struct route_vector *output_gains[GAIN_MODE_CNT];
+};
+
+/* Durations of the steps of a call bring-up, in microseconds */
+struct call_timing {
+    uint64_t pcm_open_us;       /* modem PCMs opened, routing runs meanwhile */
+    uint64_t route_wait_us;     /* routing still running after the above */
+    uint64_t pcm_start_us;      /* modem and SCO PCMs started */
+    uint64_t clock_sync_us;     /* RIL clock sync */
+    uint64_t volume_us;         /* RIL call volume, once the call is up */
+    uint64_t total_us;
+};
+
+/* Routing state applied by the routing thread, outside of adev->lock */
+struct route_cmd {
+    const struct route_vector *route;
+    const struct route_vector *sco_route;   /* SCO link rate, on top of route */
+    const struct route_vector *output_gain;
+    const struct route_vector *input_gain;
+    bool two_mic_control;
+    enum _AudioPath call_audio_path;
+    bool ramp;          /* an output is playing, avoid pops */
+    bool debounce;      /* more requests are likely to follow */
+};
+
 struct audio_device {
     struct audio_hw_device hw_device;
 
-    pthread_mutex_t lock; /* see note below on mutex acquisition order */
+    struct stats_mutex lock; /* see note below on mutex acquisition order */
     audio_devices_t out_device;
     audio_devices_t in_device;
     bool mic_mute;
-    struct audio_route *ar;
+    struct route_engine *re;
     audio_source_t input_source;
     int cur_route_id;     /* current route ID: combination of input source
                            * and output device IDs */
     audio_mode_t mode;
 
+    /* Precomputed mixer state of every route select_devices() can pick */
+    struct route_vector *routes[IN_SOURCE_TAB_SIZE][OUT_DEVICE_TAB_SIZE];
+    struct route_vector *input_routes[IN_SOURCE_TAB_SIZE][OUT_DEVICE_TAB_SIZE];
+    struct route_vector *output_routes[OUT_DEVICE_TAB_SIZE];
+    struct route_vector *bt_wbs_route;
+    struct route_vector *output_gains[GAIN_MODE_CNT][OUT_DEVICE_TAB_SIZE];
+    struct route_vector *input_gains[IN_SOURCE_TAB_SIZE][OUT_DEVICE_TAB_SIZE];
+    /* built on first use, indexed by input source (IN_SOURCE_TAB_SIZE when
+     * there is none) and mask of single output devices */
+    struct composed_route *composed_routes[IN_SOURCE_TAB_SIZE + 1]
+                                          [OUT_DEVICE_MASK_CNT];
+    struct device_set device_sets[DEVICE_SET_CNT];
+
     audio_channel_mask_t in_channel_mask;
 
     /* Call audio */
     struct pcm *pcm_voice_rx;
     struct pcm *pcm_voice_tx;
+    /*
+     * Held around every use of pcm_voice_tx by a capturing stream and when
+     * the call stops or closes it, taken after adev->lock and in->lock.
+     */
+    pthread_mutex_t voice_tx_lock;
+    atomic_uint voice_tx_closers;   /* waiting for it to close pcm_voice_tx */
+    struct stream_in *voice_tap_in; /* input stream reading pcm_voice_tx */
 
     /* SCO audio */
     struct pcm *pcm_sco_rx;
@@ -153,25 +332,74 @@ struct audio_device {
     bool in_call;
     bool tty_mode;
     bool bluetooth_nrec;
+    bool bt_wbs;          /* the SCO link carries 16 kHz mSBC speech */
     bool wb_amr;
     bool two_mic_control;
 
+    /* AMR rate switches of running calls */
+    unsigned int rate_switches;
+    unsigned int rate_switches_over_target;
+    unsigned int rate_switch_failures;  /* restarted the call, not timed */
+    uint64_t rate_switch_last_us;
+    uint64_t rate_switch_max_us;
+
+    /* phases of the last call bring-up */
+    struct call_timing call_timing;
+    unsigned int call_setups;
+    unsigned int call_setup_failures;   /* no modem PCMs, not timed */
+    uint64_t call_setup_max_us;
+
     /* RIL */
     struct ril_handle ril;
 
     struct stream_out *outputs[OUTPUT_TOTAL];
-    pthread_mutex_t lock_outputs; /* see note below on mutex acquisition order */
+    struct stats_mutex lock_outputs; /* see note below on mutex acquisition order */
+
+    /* Routing thread */
+    pthread_t route_thread;
+    pthread_mutex_t route_lock; /* protects the fields below, always taken last */
+    pthread_cond_t route_cond;  /* a new request is pending or exit */
+    pthread_cond_t route_done_cond; /* route_done_seq advanced */
+    struct route_cmd route_cmd; /* latest requested state */
+    bool route_pending;         /* route_cmd not yet picked up */
+    bool route_exit;
+    unsigned int route_seq;     /* sequence number of the latest request */
+    unsigned int route_done_seq; /* sequence number of the last applied one */
+    unsigned int route_coalesced; /* requests superseded before being applied */
+    unsigned int route_debounced; /* debounce windows which absorbed requests */
+    unsigned int route_waiters; /* threads in wait_for_routing() */
+    uint64_t route_first_post_ns; /* when route_cmd became pending */
+    uint64_t route_last_post_ns;
+    struct route_stats route_stats; /* copied from the engine after each apply */
+
+#ifdef LOCK_STATS
+    struct lock_stats lock_stats[LOCK_CLASS_CNT];
+#endif
+};
+
+/*
+ * Life cycle of an output. Only the stream mutex is held to open and close
+ * the PCMs; the hw device mutex is taken for the switch to OUT_ACTIVE and
+ * OUT_STANDBY, together with the update of adev->out_device. Other outputs
+ * read the state and device of an output under the hw device mutex only,
+ * so they see it as playing exactly while its device is in out_device.
+ */
+enum out_state {
+    OUT_STANDBY,        /* no PCM open */
+    OUT_STARTING,       /* opening the PCMs */
+    OUT_ACTIVE,         /* playing, device is part of adev->out_device */
+    OUT_STOPPING,       /* closing the PCMs */
 };
 
 struct stream_out {
     struct audio_stream_out stream;
 
-    pthread_mutex_t lock; /* see note below on mutex acquisition order */
+    struct stats_mutex lock; /* see note below on mutex acquisition order */
     struct pcm *pcm[PCM_TOTAL];
     struct pcm_config config;
     unsigned int pcm_device;
-    bool standby; /* true if all PCMs are inactive */
-    audio_devices_t device;
+    atomic_int state; /* enum out_state */
+    audio_devices_t device; /* written with both stream and hw device mutex */
 
     audio_channel_mask_t channel_mask;
     /* Array of supported channel mask configurations. +1 so that the last entry is always 0 */
@@ -184,7 +412,7 @@ struct stream_out {
 struct stream_in {
     struct audio_stream_in stream;
 
-    pthread_mutex_t lock;       /* see note below on mutex acquisition order */
+    struct stats_mutex lock;    /* see note below on mutex acquisition order */
     struct pcm *pcm;
     bool standby;
 
@@ -206,6 +434,16 @@ struct stream_in {
     audio_channel_mask_t channel_mask;
     audio_input_flags_t flags;
     struct pcm_config *config;
+    struct pcm_config *profile_config; /* capture profile chosen at open */
+    unsigned int resampler_rate; /* source rate of the current resampler */
+    bool rate_converter; /* the resampler is a rate_converter */
+
+    /*
+     * Capturing from the modem PCM instead of a mic: pcm is the call's
+     * pcm_voice_tx, the call sets it to NULL under voice_tx_lock when it
+     * closes the PCM.
+     */
+    bool voice_tap;
 
     struct audio_device *dev;
 };
@@ -231,6 +469,29 @@ static void force_wideband(struct audio_device *adev)
 
 /* Routing functions */
 
+static int get_single_output_device_id(audio_devices_t device)
+{
+    switch (device) {
+    case AUDIO_DEVICE_OUT_SPEAKER:
+        return OUT_DEVICE_SPEAKER;
+    case AUDIO_DEVICE_OUT_EARPIECE:
+        return OUT_DEVICE_EARPIECE;
+    case AUDIO_DEVICE_OUT_WIRED_HEADSET:
+        return OUT_DEVICE_HEADSET;
+    case AUDIO_DEVICE_OUT_WIRED_HEADPHONE:
+        return OUT_DEVICE_HEADPHONES;
+    case AUDIO_DEVICE_OUT_BLUETOOTH_SCO:
+        return OUT_DEVICE_BT_SCO;
+    case AUDIO_DEVICE_OUT_BLUETOOTH_SCO_HEADSET:
+        return OUT_DEVICE_BT_SCO_HEADSET_OUT;
+    case AUDIO_DEVICE_OUT_BLUETOOTH_SCO_CARKIT:
+        return OUT_DEVICE_BT_SCO_CARKIT;
+    default:
+        return OUT_DEVICE_NONE;
+    }
+}
+
+/* Returns the route_configs[][] column of a device set, if it has one */
 static int get_output_device_id(audio_devices_t device)
 {
     if (device == AUDIO_DEVICE_NONE)
@@ -252,26 +513,42 @@ static int get_output_device_id(audio_devices_t device)
     if (popcount(device) != 1)
         return OUT_DEVICE_NONE;
 
-    switch (device) {
-    case AUDIO_DEVICE_OUT_SPEAKER:
-        return OUT_DEVICE_SPEAKER;
-    case AUDIO_DEVICE_OUT_EARPIECE:
-        return OUT_DEVICE_EARPIECE;
-    case AUDIO_DEVICE_OUT_WIRED_HEADSET:
-        return OUT_DEVICE_HEADSET;
-    case AUDIO_DEVICE_OUT_WIRED_HEADPHONE:
-        return OUT_DEVICE_HEADPHONES;
-    case AUDIO_DEVICE_OUT_BLUETOOTH_SCO:
-        return OUT_DEVICE_BT_SCO;
-    case AUDIO_DEVICE_OUT_BLUETOOTH_SCO_HEADSET:
-        return OUT_DEVICE_BT_SCO_HEADSET_OUT;
-    case AUDIO_DEVICE_OUT_BLUETOOTH_SCO_CARKIT:
-        return OUT_DEVICE_BT_SCO_CARKIT;
-    default:
-        return OUT_DEVICE_NONE;
+    return get_single_output_device_id(device);
+}
+
+/* Returns the mask of single output devices of a device set */
+static unsigned int get_output_device_mask(audio_devices_t device)
+{
+    unsigned int mask = 0;
+    audio_devices_t bit;
+    int id;
+
+    while (device) {
+        bit = device & ~(device - 1);
+        device &= ~bit;
+
+        id = get_single_output_device_id(bit);
+        if (id != OUT_DEVICE_NONE)
+            mask |= 1 << id;
     }
+
+    return mask;
 }
 
+/*
+ * Composed routes give the device found first here the last word on
+ * shared controls, it also provides the input route.
+ */
+static const int output_device_priority[OUT_DEVICE_SINGLE_CNT] = {
+    OUT_DEVICE_BT_SCO_CARKIT,
+    OUT_DEVICE_BT_SCO_HEADSET_OUT,
+    OUT_DEVICE_BT_SCO,
+    OUT_DEVICE_HEADSET,
+    OUT_DEVICE_HEADPHONES,
+    OUT_DEVICE_EARPIECE,
+    OUT_DEVICE_SPEAKER
+};
+
 static int get_input_source_id(audio_source_t source, bool wb_amr)
 {
     switch (source) {
@@ -295,36 +572,550 @@ static int get_input_source_id(audio_source_t source, bool wb_amr)
     }
 }
 
-static void adev_set_call_audio_path(struct audio_device *adev);
+static enum _AudioPath get_call_audio_path(audio_devices_t device, bool nrec)
+{
+    enum _AudioPath device_type;
+
+    switch(device) {
+        case AUDIO_DEVICE_OUT_SPEAKER:
+            device_type = SOUND_AUDIO_PATH_SPEAKER;
+            break;
+        case AUDIO_DEVICE_OUT_EARPIECE:
+            device_type = SOUND_AUDIO_PATH_HANDSET;
+            break;
+        case AUDIO_DEVICE_OUT_WIRED_HEADSET:
+            device_type = SOUND_AUDIO_PATH_HEADSET;
+            break;
+        case AUDIO_DEVICE_OUT_WIRED_HEADPHONE:
+            device_type = SOUND_AUDIO_PATH_HEADPHONE;
+            break;
+        case AUDIO_DEVICE_OUT_BLUETOOTH_SCO:
+        case AUDIO_DEVICE_OUT_BLUETOOTH_SCO_HEADSET:
+        case AUDIO_DEVICE_OUT_BLUETOOTH_SCO_CARKIT:
+            if (nrec) {
+                device_type = SOUND_AUDIO_PATH_BLUETOOTH;
+            } else {
+                device_type = SOUND_AUDIO_PATH_BLUETOOTH_NO_NR;
+            }
+            break;
+        default:
+            /* if output device isn't supported, use handset by default */
+            device_type = SOUND_AUDIO_PATH_HANDSET;
+            break;
+    }
+
+    return device_type;
+}
+
+/* Fills the device set table, see struct device_set */
+static void init_device_sets(struct audio_device *adev)
+{
+    struct device_set *set;
+    audio_devices_t device;
+
+    for (device = 0; device < DEVICE_SET_CNT; device++) {
+        set = &adev->device_sets[device];
+        set->device_id = get_output_device_id(device);
+        set->mask = get_output_device_mask(device);
+        set->call_audio_path[0] = get_call_audio_path(device, false);
+        set->call_audio_path[1] = get_call_audio_path(device, true);
+    }
+}
+
+/* Looks up what select_devices() needs from a device set */
+static struct device_set get_device_set(struct audio_device *adev,
+                                        audio_devices_t device)
+{
+    struct device_set set = adev->device_sets[device & DEVICE_SET_BITS];
+
+    /* a device without a route of its own takes the set off the table */
+    if (device & ~DEVICE_SET_BITS) {
+        set.device_id = OUT_DEVICE_NONE;
+        set.call_audio_path[0] = SOUND_AUDIO_PATH_HANDSET;
+        set.call_audio_path[1] = SOUND_AUDIO_PATH_HANDSET;
+    }
+
+    return set;
+}
+
+/* Returns the name of a gain modifier path, NULL if it does not exist */
+static const char *get_gain_path(struct audio_device *adev, char *name,
+                                 size_t size, const char *mode,
+                                 const char *device, const char *output)
+{
+    if (device == NULL)
+        return NULL;
+
+    if (output) {
+        snprintf(name, size, "%s/%s/%s", mode, device, output);
+        if (route_engine_has_path(adev->re, name))
+            return name;
+    }
+
+    snprintf(name, size, "%s/%s", mode, device);
+
+    return route_engine_has_path(adev->re, name) ? name : NULL;
+}
+
+/* gain device of the microphone an input route uses */
+static const char *get_gain_input_device(const char *input_route)
+{
+    if (strstr(input_route, "bt-sco"))
+        return "SCO Headset In";
+    if (strstr(input_route, "headset-mic"))
+        return "Headset In";
+    if (strstr(input_route, "second-mic"))
+        return "Back Mic";
+
+    return "Builtin Mic";
+}
+
+static int init_gains(struct audio_device *adev)
+{
+    char names[2][128];
+    const char *paths[2];
+    int i, j, k;
+
+    for (i = 0; i < GAIN_MODE_CNT; i++) {
+        for (j = 0; j < OUT_DEVICE_TAB_SIZE; j++) {
+            for (k = 0; k < 2; k++)
+                paths[k] = get_gain_path(adev, names[k], sizeof(names[k]),
+                                         output_gain_modifiers[i],
+                                         gain_output_devices[j][k], NULL);
+
+            adev->output_gains[i][j] = route_engine_build(adev->re, paths, 2);
+            if (adev->output_gains[i][j] == NULL)
+                return -ENOMEM;
+        }
+    }
+
+    for (i = 0; i < IN_SOURCE_TAB_SIZE; i++) {
+        for (j = 0; j < OUT_DEVICE_TAB_SIZE; j++) {
+            const char *device =
+                    get_gain_input_device(route_configs[i][j]->input_route);
+
+            paths[0] = get_gain_path(adev, names[0], sizeof(names[0]),
+                                     input_gain_modifiers[i], device,
+                                     gain_output_devices[j][0]);
+
+            adev->input_gains[i][j] = route_engine_build(adev->re, paths, 1);
+            if (adev->input_gains[i][j] == NULL)
+                return -ENOMEM;
+        }
+    }
+
+    return 0;
+}
+
+static void free_composed_route(struct composed_route *cr)
+{
+    int i;
+
+    if (cr == NULL)
+        return;
+
+    free(cr->route);
+    for (i = 0; i < GAIN_MODE_CNT; i++)
+        free(cr->output_gains[i]);
+    free(cr);
+}
+
+/*
+ * Returns the route of an output device set without an entry in
+ * route_configs[][]: the union of the output routes of its devices, plus
+ * the input route of the primary device. Built once per input source and
+ * device mask, must be called with hw device mutex locked.
+ */
+static const struct composed_route *get_composed_route(struct audio_device *adev,
+                                                       int input_source_id,
+                                                       unsigned int mask)
+{
+    int source = input_source_id == IN_SOURCE_NONE ?
+                     IN_SOURCE_TAB_SIZE : input_source_id;
+    int config_source = input_source_id == IN_SOURCE_NONE ?
+                            IN_SOURCE_MIC : input_source_id;
+    struct composed_route *cr = adev->composed_routes[source][mask];
+    const struct route_config *config;
+    const char *paths[OUT_DEVICE_SINGLE_CNT + 1];
+    char names[OUT_DEVICE_SINGLE_CNT][128];
+    unsigned int num_paths = 0;
+    int i, j, id;
+
+    if (cr)
+        return cr;
+
+    cr = calloc(1, sizeof(struct composed_route));
+    if (cr == NULL)
+        return NULL;
+
+    /* lowest priority first, devices without a route for the source are
+     * left out */
+    cr->primary = OUT_DEVICE_NONE;
+    for (i = OUT_DEVICE_SINGLE_CNT - 1; i >= 0; i--) {
+        id = output_device_priority[i];
+        config = route_configs[config_source][id];
+        if (!(mask & (1 << id)) || config == &none)
+            continue;
+
+        paths[num_paths++] = config->output_route;
+        cr->primary = id;
+    }
+
+    if (cr->primary == OUT_DEVICE_NONE) {
+        free(cr);
+        return NULL;
+    }
+
+    if (input_source_id != IN_SOURCE_NONE) {
+        config = route_configs[config_source][cr->primary];
+        paths[num_paths++] = config->input_route;
+    }
+
+    cr->route = route_engine_build(adev->re, paths, num_paths);
+    if (cr->route == NULL)
+        goto error;
+
+    for (i = 0; i < GAIN_MODE_CNT; i++) {
+        num_paths = 0;
+        for (j = OUT_DEVICE_SINGLE_CNT - 1; j >= 0; j--) {
+            id = output_device_priority[j];
+            if (!(mask & (1 << id)))
+                continue;
+
+            paths[num_paths] = get_gain_path(adev, names[num_paths],
+                                             sizeof(names[num_paths]),
+                                             output_gain_modifiers[i],
+                                             gain_output_devices[id][0], NULL);
+            num_paths++;
+        }
+
+        cr->output_gains[i] = route_engine_build(adev->re, paths, num_paths);
+        if (cr->output_gains[i] == NULL)
+            goto error;
+    }
+
+    adev->composed_routes[source][mask] = cr;
+
+    return cr;
+
+error:
+    free_composed_route(cr);
+    return NULL;
+}
+
+static int init_routes(struct audio_device *adev)
+{
+    const struct route_config *config;
+    const char *paths[2];
+    int i, j;
+
+    for (i = 0; i < IN_SOURCE_TAB_SIZE; i++) {
+        for (j = 0; j < OUT_DEVICE_TAB_SIZE; j++) {
+            config = route_configs[i][j];
+
+            paths[0] = config->output_route;
+            paths[1] = config->input_route;
+            adev->routes[i][j] = route_engine_build(adev->re, paths, 2);
+            adev->input_routes[i][j] =
+                    route_engine_build(adev->re, &config->input_route, 1);
+
+            if (adev->routes[i][j] == NULL || adev->input_routes[i][j] == NULL)
+                return -ENOMEM;
+        }
+    }
+
+    for (j = 0; j < OUT_DEVICE_TAB_SIZE; j++) {
+        config = route_configs[IN_SOURCE_MIC][j];
+        adev->output_routes[j] =
+                route_engine_build(adev->re, &config->output_route, 1);
+        if (adev->output_routes[j] == NULL)
+            return -ENOMEM;
+    }
+
+    adev->bt_wbs_route = route_engine_build(adev->re, &bt_wbs_path, 1);
+    if (adev->bt_wbs_route == NULL)
+        return -ENOMEM;
+
+    init_device_sets(adev);
+
+    return init_gains(adev);
+}
+
+static void free_routes(struct audio_device *adev)
+{
+    int i, j;
+
+    for (i = 0; i < IN_SOURCE_TAB_SIZE; i++) {
+        for (j = 0; j < OUT_DEVICE_TAB_SIZE; j++) {
+            free(adev->routes[i][j]);
+            free(adev->input_routes[i][j]);
+        }
+    }
+
+    for (j = 0; j < OUT_DEVICE_TAB_SIZE; j++)
+        free(adev->output_routes[j]);
+    free(adev->bt_wbs_route);
+
+    for (i = 0; i < GAIN_MODE_CNT; i++) {
+        for (j = 0; j < OUT_DEVICE_TAB_SIZE; j++)
+            free(adev->output_gains[i][j]);
+    }
+
+    for (i = 0; i < IN_SOURCE_TAB_SIZE; i++) {
+        for (j = 0; j < OUT_DEVICE_TAB_SIZE; j++)
+            free(adev->input_gains[i][j]);
+    }
+
+    for (i = 0; i <= IN_SOURCE_TAB_SIZE; i++) {
+        for (j = 0; j < OUT_DEVICE_MASK_CNT; j++)
+            free_composed_route(adev->composed_routes[i][j]);
+    }
+}
+
+/*
+ * NOTE: when multiple mutexes have to be acquired, take them in the order
+ * outputs list, stream_out or stream_in, audio_device. No output holds
+ * the mutex of another: outputs only share adev->out_device and the
+ * routing, which are updated under the audio_device mutex, see
+ * enum out_state. The outputs list mutex only serializes opening and
+ * closing outputs, adev->outputs[] is written with the audio_device
+ * mutex held as well.
+ * The routing thread mutex is taken last and is never held across
+ * mixer or RIL calls.
+ * RIL calls only queue the command, the modem is called from the RIL
+ * command thread, so no audio lock is ever held across a modem IPC.
+ * With LOCK_STATS the stream and device locks record their wait and hold
+ * times per caller, take them with stats_mutex_lock() only.
+ */
+
+/* Routing thread functions */
+
+static uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
 /*
- * NOTE: when multiple mutexes have to be acquired, always take the
- * audio_device mutex first, followed by the stream_in and/or
- * stream_out mutexes.
+ * Holds a debounced request back while more are coming. Returns early when
+ * somebody waits for the routing. Called with the routing mutex locked.
  */
+static void debounce_route(struct audio_device *adev)
+{
+    unsigned int seq = adev->route_seq;
+    struct timespec ts;
+    uint64_t deadline;
+
+    while (adev->route_pending && adev->route_cmd.debounce &&
+           !adev->route_waiters && !adev->route_exit) {
+        deadline = adev->route_last_post_ns + ROUTE_DEBOUNCE_MS * 1000000ULL;
+        if (deadline > adev->route_first_post_ns + ROUTE_DEBOUNCE_MAX_MS * 1000000ULL)
+            deadline = adev->route_first_post_ns + ROUTE_DEBOUNCE_MAX_MS * 1000000ULL;
+        if (get_time_ns() >= deadline)
+            break;
+
+        ts.tv_sec = deadline / 1000000000;
+        ts.tv_nsec = deadline % 1000000000;
+        pthread_cond_timedwait(&adev->route_cond, &adev->route_lock, &ts);
+    }
+
+    if (adev->route_seq != seq)
+        adev->route_debounced++;
+}
+
+static void *route_thread_loop(void *context)
+{
+    struct audio_device *adev = (struct audio_device *)context;
+    const struct route_vector *rvs[4];
+    struct route_cmd cmd;
+    unsigned int seq;
+    int ioctls;
+
+    pthread_mutex_lock(&adev->route_lock);
+    for (;;) {
+        while (!adev->route_pending && !adev->route_exit)
+            pthread_cond_wait(&adev->route_cond, &adev->route_lock);
+        debounce_route(adev);
+        if (adev->route_exit)
+            break;
+
+        cmd = adev->route_cmd;
+        seq = adev->route_seq;
+        adev->route_pending = false;
+        pthread_mutex_unlock(&adev->route_lock);
+
+        /* only the controls which differ from the current state are written */
+        rvs[0] = cmd.route;
+        rvs[1] = cmd.sco_route;
+        rvs[2] = cmd.output_gain;
+        rvs[3] = cmd.input_gain;
+        ioctls = route_engine_apply(adev->re, rvs, 4, cmd.ramp);
+        ALOGV("%s: route applied with %d mixer ioctls", __func__, ioctls);
+
+        if (cmd.two_mic_control) {
+            ALOGV("%s: enabling two mic control", __func__);
+            ril_set_two_mic_control(&adev->ril, AUDIENCE, TWO_MIC_SOLUTION_ON);
+        } else {
+            ALOGV("%s: disabling two mic control", __func__);
+            ril_set_two_mic_control(&adev->ril, AUDIENCE, TWO_MIC_SOLUTION_OFF);
+        }
+
+        ALOGV("%s: ril_set_call_audio_path(%d)", __func__, cmd.call_audio_path);
+        ril_set_call_audio_path(&adev->ril, cmd.call_audio_path);
+
+        pthread_mutex_lock(&adev->route_lock);
+        route_engine_get_stats(adev->re, &adev->route_stats);
+        adev->route_done_seq = seq;
+        pthread_cond_broadcast(&adev->route_done_cond);
+    }
+    pthread_mutex_unlock(&adev->route_lock);
+
+    return NULL;
+}
+
+/* queue a routing state, replacing any request not yet picked up */
+static void post_route(struct audio_device *adev, const struct route_cmd *cmd)
+{
+    uint64_t now = get_time_ns();
+
+    pthread_mutex_lock(&adev->route_lock);
+    if (adev->route_pending)
+        adev->route_coalesced++;
+    else
+        adev->route_first_post_ns = now;
+    adev->route_last_post_ns = now;
+    adev->route_cmd = *cmd;
+    adev->route_pending = true;
+    adev->route_seq++;
+    pthread_cond_signal(&adev->route_cond);
+    pthread_mutex_unlock(&adev->route_lock);
+}
+
+/*
+ * Wait until every routing request posted so far has been applied. Must be
+ * called before starting a PCM whose data depends on the new route.
+ * OK to hold any other mutex.
+ */
+static void wait_for_routing(struct audio_device *adev)
+{
+    unsigned int seq;
+
+    pthread_mutex_lock(&adev->route_lock);
+    seq = adev->route_seq;
+    if ((int)(adev->route_done_seq - seq) < 0) {
+        /* end any debounce window */
+        adev->route_waiters++;
+        pthread_cond_signal(&adev->route_cond);
+        while ((int)(adev->route_done_seq - seq) < 0)
+            pthread_cond_wait(&adev->route_done_cond, &adev->route_lock);
+        adev->route_waiters--;
+    }
+    pthread_mutex_unlock(&adev->route_lock);
+}
+
+static int start_route_thread(struct audio_device *adev)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+    pthread_mutex_init(&adev->route_lock, NULL);
+    pthread_cond_init(&adev->route_cond, &attr);
+    pthread_cond_init(&adev->route_done_cond, NULL);
+    pthread_condattr_destroy(&attr);
+
+    return -pthread_create(&adev->route_thread, NULL, route_thread_loop, adev);
+}
+
+static void stop_route_thread(struct audio_device *adev)
+{
+    pthread_mutex_lock(&adev->route_lock);
+    adev->route_exit = true;
+    pthread_cond_signal(&adev->route_cond);
+    pthread_mutex_unlock(&adev->route_lock);
+
+    pthread_join(adev->route_thread, NULL);
+
+    pthread_cond_destroy(&adev->route_done_cond);
+    pthread_cond_destroy(&adev->route_cond);
+    pthread_mutex_destroy(&adev->route_lock);
+}
 
 /* must be called with hw device mutex locked */
-static void select_devices(struct audio_device *adev)
+static int get_gain_mode(struct audio_device *adev)
+{
+    switch (adev->mode) {
+    case AUDIO_MODE_RINGTONE:
+        return GAIN_MODE_RINGTONE;
+    case AUDIO_MODE_IN_CALL:
+        return adev->wb_amr ? GAIN_MODE_INCALL_WB : GAIN_MODE_INCALL_NB;
+    case AUDIO_MODE_IN_COMMUNICATION:
+        return GAIN_MODE_COMMUNICATION;
+    default:
+        return GAIN_MODE_NORMAL;
+    }
+}
+
+/*
+ * must be called with hw device mutex locked
+ * The mixer and RIL updates are done asynchronously by the routing thread,
+ * use wait_for_routing() where ordering matters. A debounced selection is
+ * applied once no other one followed for a short while.
+ */
+static void do_select_devices(struct audio_device *adev, bool debounce)
 {
-    int output_device_id = get_output_device_id(adev->out_device);
+    struct device_set set = get_device_set(adev, adev->out_device);
+    int output_device_id = set.device_id;
+    unsigned int output_mask = set.mask;
     int input_source_id = get_input_source_id(adev->input_source, adev->wb_amr);
+    const struct composed_route *composed = NULL;
     const char *output_route = NULL;
     const char *input_route = NULL;
+    int gain_mode = get_gain_mode(adev);
+    struct route_cmd cmd = { NULL, NULL, NULL, NULL, false,
+                             SOUND_AUDIO_PATH_HANDSET, false, debounce };
+    bool bt_wbs = adev->bt_wbs &&
+                  ((adev->out_device & AUDIO_DEVICE_OUT_ALL_SCO) ||
+                   (adev->in_device & AUDIO_DEVICE_IN_BLUETOOTH_SCO_HEADSET &
+                    ~AUDIO_DEVICE_BIT_IN));
     int new_route_id;
+    int i;
 
-    audio_route_reset(adev->ar);
-
-    new_route_id = (1 << (input_source_id + OUT_DEVICE_CNT)) + (1 << output_device_id);
+    new_route_id = (gain_mode << (IN_SOURCE_CNT + OUT_DEVICE_MASK_BITS)) +
+                   (1 << (input_source_id + OUT_DEVICE_MASK_BITS)) + output_mask;
+    if (bt_wbs)
+        new_route_id |= ROUTE_ID_BT_WBS;
     if (new_route_id == adev->cur_route_id)
         return;
     adev->cur_route_id = new_route_id;
 
+    if (output_device_id == OUT_DEVICE_NONE && output_mask != 0) {
+        composed = get_composed_route(adev, input_source_id, output_mask);
+        if (composed == NULL)
+            ALOGE("%s: no route for devices %#x", __func__, adev->out_device);
+    }
+
     if (input_source_id != IN_SOURCE_NONE) {
-        if (output_device_id != OUT_DEVICE_NONE) {
+        if (composed) {
+            output_device_id = composed->primary;
+            input_route =
+                route_configs[input_source_id][output_device_id]->input_route;
+            output_route = "composed";
+            cmd.route = composed->route;
+            cmd.output_gain = composed->output_gains[gain_mode];
+            cmd.input_gain = adev->input_gains[input_source_id][output_device_id];
+        } else if (output_device_id != OUT_DEVICE_NONE) {
             input_route =
                 route_configs[input_source_id][output_device_id]->input_route;
             output_route =
                 route_configs[input_source_id][output_device_id]->output_route;
+            cmd.route = adev->routes[input_source_id][output_device_id];
+            cmd.output_gain = adev->output_gains[gain_mode][output_device_id];
+            cmd.input_gain = adev->input_gains[input_source_id][output_device_id];
         } else {
             switch(adev->in_device) {
             case AUDIO_DEVICE_IN_WIRED_HEADSET & ~AUDIO_DEVICE_BIT_IN:
@@ -339,11 +1130,19 @@ static void select_devices(struct audio_device *adev)
             }
             input_route =
                 route_configs[input_source_id][output_device_id]->input_route;
+            cmd.route = adev->input_routes[input_source_id][output_device_id];
+            cmd.input_gain = adev->input_gains[input_source_id][output_device_id];
         }
     } else {
-        if (output_device_id != OUT_DEVICE_NONE) {
+        if (composed) {
+            output_route = "composed";
+            cmd.route = composed->route;
+            cmd.output_gain = composed->output_gains[gain_mode];
+        } else if (output_device_id != OUT_DEVICE_NONE) {
             output_route =
                 route_configs[IN_SOURCE_MIC][output_device_id]->output_route;
+            cmd.route = adev->output_routes[output_device_id];
+            cmd.output_gain = adev->output_gains[gain_mode][output_device_id];
         }
     }
     ALOGV("select_devices() devices %#x input src %d output route %s input route %s",
@@ -351,13 +1150,6 @@ static void select_devices(struct audio_device *adev)
           output_route ? output_route : "none",
           input_route ? input_route : "none");
 
-    if (output_route)
-        audio_route_apply_path(adev->ar, output_route);
-    if (input_route)
-        audio_route_apply_path(adev->ar, input_route);
-
-    audio_route_update_mixer(adev->ar);
-
     /* FIXME: Turn on two mic control for earpiece and speaker */
     if (input_source_id != IN_SOURCE_NONE) {
         switch (output_device_id) {
@@ -371,15 +1163,32 @@ static void select_devices(struct audio_device *adev)
         }
     }
 
-    if (adev->two_mic_control) {
-        ALOGV("%s: enabling two mic control", __func__);
-        ril_set_two_mic_control(&adev->ril, AUDIENCE, TWO_MIC_SOLUTION_ON);
-    } else {
-        ALOGV("%s: disabling two mic control", __func__);
-        ril_set_two_mic_control(&adev->ril, AUDIENCE, TWO_MIC_SOLUTION_OFF);
+    if (bt_wbs)
+        cmd.sco_route = adev->bt_wbs_route;
+
+    cmd.two_mic_control = adev->two_mic_control;
+    cmd.call_audio_path = set.call_audio_path[adev->bluetooth_nrec];
+
+    /* switch paths under a gain ramp instead of forcing output standby */
+    for (i = 0; i < OUTPUT_TOTAL; i++) {
+        if (adev->outputs[i] &&
+                atomic_load(&adev->outputs[i]->state) != OUT_STANDBY)
+            cmd.ramp = true;
     }
 
-    adev_set_call_audio_path(adev);
+    post_route(adev, &cmd);
+}
+
+/* must be called with hw device mutex locked */
+static void select_devices(struct audio_device *adev)
+{
+    do_select_devices(adev, false);
+}
+
+/* must be called with hw device mutex locked */
+static void select_devices_debounced(struct audio_device *adev)
+{
+    do_select_devices(adev, true);
 }
 
 /* BT SCO functions */
@@ -387,6 +1196,8 @@ static void select_devices(struct audio_device *adev)
 /* must be called with hw device mutex locked, OK to hold other mutexes */
 static void start_bt_sco(struct audio_device *adev)
 {
+    struct pcm_config *sco_config;
+
     if (adev->pcm_sco_rx || adev->pcm_sco_tx) {
         ALOGW("%s: SCO PCMs already open!\n", __func__);
         return;
@@ -394,8 +1205,13 @@ static void start_bt_sco(struct audio_device *adev)
 
     ALOGV("%s: Opening SCO PCMs", __func__);
 
+    if (adev->bt_wbs)
+        sco_config = &pcm_config_sco_wide;
+    else
+        sco_config = &pcm_config_sco;
+
     adev->pcm_sco_rx = pcm_open(PCM_CARD, PCM_DEVICE_SCO, PCM_OUT | PCM_MONOTONIC,
-            &pcm_config_sco);
+            sco_config);
     if (adev->pcm_sco_rx && !pcm_is_ready(adev->pcm_sco_rx)) {
         ALOGE("%s: cannot open PCM SCO RX stream: %s",
               __func__, pcm_get_error(adev->pcm_sco_rx));
@@ -403,7 +1219,7 @@ static void start_bt_sco(struct audio_device *adev)
     }
 
     adev->pcm_sco_tx = pcm_open(PCM_CARD, PCM_DEVICE_SCO, PCM_IN,
-            &pcm_config_sco);
+            sco_config);
     if (adev->pcm_sco_tx && !pcm_is_ready(adev->pcm_sco_tx)) {
         ALOGE("%s: cannot open PCM SCO TX stream: %s",
               __func__, pcm_get_error(adev->pcm_sco_tx));
@@ -444,15 +1260,10 @@ static void end_bt_sco(struct audio_device *adev)
 /* Samsung RIL functions */
 
 /* must be called with hw device mutex locked, OK to hold other mutexes */
-static int start_voice_call(struct audio_device *adev)
+static int open_voice_pcms(struct audio_device *adev)
 {
     struct pcm_config *voice_config;
 
-    if (adev->pcm_voice_rx || adev->pcm_voice_tx) {
-        ALOGW("%s: Voice PCMs already open!\n", __func__);
-        return 0;
-    }
-
     ALOGV("%s: Opening voice PCMs", __func__);
 
     if (adev->wb_amr)
@@ -477,13 +1288,6 @@ static int start_voice_call(struct audio_device *adev)
         goto err_voice_tx;
     }
 
-    pcm_start(adev->pcm_voice_rx);
-    pcm_start(adev->pcm_voice_tx);
-
-    /* start SCO stream if needed */
-    if (adev->out_device & AUDIO_DEVICE_OUT_ALL_SCO)
-        start_bt_sco(adev);
-
     return 0;
 
 err_voice_tx:
@@ -497,11 +1301,18 @@ err_voice_rx:
 }
 
 /* must be called with hw device mutex locked, OK to hold other mutexes */
-static void stop_voice_call(struct audio_device *adev)
+static void start_voice_pcms(struct audio_device *adev)
 {
-    int status = 0;
+    if (adev->pcm_voice_rx)
+        pcm_start(adev->pcm_voice_rx);
+    if (adev->pcm_voice_tx)
+        pcm_start(adev->pcm_voice_tx);
+}
 
-    ALOGV("%s: Closing active PCMs", __func__);
+/* must be called with hw device mutex locked, OK to hold other mutexes */
+static int close_voice_pcms(struct audio_device *adev)
+{
+    int status = 0;
 
     if (adev->pcm_voice_rx) {
         pcm_stop(adev->pcm_voice_rx);
@@ -511,79 +1322,229 @@ static void stop_voice_call(struct audio_device *adev)
     }
 
     if (adev->pcm_voice_tx) {
+        /* a capturing stream might be in pcm_read() on it */
+        atomic_fetch_add(&adev->voice_tx_closers, 1);
+        pthread_mutex_lock(&adev->voice_tx_lock);
+        atomic_fetch_sub(&adev->voice_tx_closers, 1);
         pcm_stop(adev->pcm_voice_tx);
         pcm_close(adev->pcm_voice_tx);
         adev->pcm_voice_tx = NULL;
+        if (adev->voice_tap_in) {
+            /* the stream restarts from the next read on */
+            adev->voice_tap_in->pcm = NULL;
+            adev->voice_tap_in = NULL;
+        }
+        pthread_mutex_unlock(&adev->voice_tx_lock);
         status++;
     }
 
-    /* end SCO stream if needed */
-    if (adev->out_device & AUDIO_DEVICE_OUT_ALL_SCO)
-        end_bt_sco(adev);
-
-    ALOGV("%s: Successfully closed %d active PCMs", __func__, status);
+    return status;
 }
 
-static void adev_set_wb_amr_callback(void *data, int enable)
+/* returns the microseconds since *t and moves *t to now */
+static uint64_t lap_us(uint64_t *t)
 {
-    struct audio_device *adev = (struct audio_device *)data;
-
-    pthread_mutex_lock(&adev->lock);
-    if (adev->wb_amr != enable) {
-        adev->wb_amr = enable;
+    uint64_t now = get_time_ns();
+    uint64_t elapsed = (now - *t) / 1000;
 
-        /* reopen the modem PCMs at the new rate */
-        if (adev->in_call) {
-            ALOGV("%s: %s Incall Wide Band support",
-                  __func__,
-                  enable ? "Turn on" : "Turn off");
+    *t = now;
 
-            stop_voice_call(adev);
-            select_devices(adev);
-            start_voice_call(adev);
-        }
-    }
-    pthread_mutex_unlock(&adev->lock);
+    return elapsed;
 }
 
-static void adev_set_call_audio_path(struct audio_device *adev)
+/*
+ * The RIL maps the volume through the curve of the sound type and skips
+ * the modem write when the step does not change.
+ * must be called with hw device mutex locked, OK to hold other mutexes
+ */
+static void set_voice_volume(struct audio_device *adev, float volume)
 {
-    enum _AudioPath device_type;
+    enum _SoundType sound_type;
+
+    adev->voice_volume = volume;
 
-    switch(adev->out_device) {
+    if (adev->mode != AUDIO_MODE_IN_CALL)
+        return;
+
+    switch (adev->out_device) {
         case AUDIO_DEVICE_OUT_SPEAKER:
-            device_type = SOUND_AUDIO_PATH_SPEAKER;
-            break;
-        case AUDIO_DEVICE_OUT_EARPIECE:
-            device_type = SOUND_AUDIO_PATH_HANDSET;
+            sound_type = SOUND_TYPE_SPEAKER;
             break;
         case AUDIO_DEVICE_OUT_WIRED_HEADSET:
-            device_type = SOUND_AUDIO_PATH_HEADSET;
-            break;
         case AUDIO_DEVICE_OUT_WIRED_HEADPHONE:
-            device_type = SOUND_AUDIO_PATH_HEADPHONE;
+            sound_type = SOUND_TYPE_HEADSET;
             break;
         case AUDIO_DEVICE_OUT_BLUETOOTH_SCO:
         case AUDIO_DEVICE_OUT_BLUETOOTH_SCO_HEADSET:
         case AUDIO_DEVICE_OUT_BLUETOOTH_SCO_CARKIT:
-            if (adev->bluetooth_nrec) {
-                device_type = SOUND_AUDIO_PATH_BLUETOOTH;
-            } else {
-                device_type = SOUND_AUDIO_PATH_BLUETOOTH_NO_NR;
-            }
+        case AUDIO_DEVICE_OUT_ALL_SCO:
+            sound_type = SOUND_TYPE_BTVOICE;
             break;
         default:
-            /* if output device isn't supported, use handset by default */
-            device_type = SOUND_AUDIO_PATH_HANDSET;
-            break;
+            sound_type = SOUND_TYPE_VOICE;
+    }
+
+    ril_set_call_volume(&adev->ril, sound_type, volume);
+}
+
+/*
+ * Brings a call up. The routing thread applies the mixer and the RIL audio
+ * path while the modem PCMs are opened, the PCMs are only started once the
+ * route is in place. The call volume follows the clock sync, the modem
+ * drops it with the call.
+ * must be called with hw device mutex locked, OK to hold other mutexes
+ */
+static int start_voice_call(struct audio_device *adev)
+{
+    struct call_timing timing;
+    uint64_t start = get_time_ns();
+    uint64_t t = start;
+    int ret;
+
+    if (adev->pcm_voice_rx || adev->pcm_voice_tx) {
+        ALOGW("%s: Voice PCMs already open!\n", __func__);
+        return 0;
+    }
+
+    select_devices(adev);
+
+    ret = open_voice_pcms(adev);
+    timing.pcm_open_us = lap_us(&t);
+
+    /* the modem still gets the call state, like before the PCMs failed */
+    if (ret < 0) {
+        ALOGE("%s: no voice PCMs, the call has no audio", __func__);
+        ril_set_call_clock_sync(&adev->ril, SOUND_CLOCK_START);
+        set_voice_volume(adev, adev->voice_volume);
+        adev->call_setup_failures++;
+        return ret;
+    }
+
+    wait_for_routing(adev);
+    timing.route_wait_us = lap_us(&t);
+
+    start_voice_pcms(adev);
+    /* start SCO stream if needed */
+    if (adev->out_device & AUDIO_DEVICE_OUT_ALL_SCO)
+        start_bt_sco(adev);
+    timing.pcm_start_us = lap_us(&t);
+
+    ril_set_call_clock_sync(&adev->ril, SOUND_CLOCK_START);
+    timing.clock_sync_us = lap_us(&t);
+
+    /* the modem takes the call volume once the call clock runs */
+    set_voice_volume(adev, adev->voice_volume);
+    timing.volume_us = lap_us(&t);
+
+    timing.total_us = (t - start) / 1000;
+    adev->call_timing = timing;
+    adev->call_setups++;
+    if (timing.total_us > adev->call_setup_max_us)
+        adev->call_setup_max_us = timing.total_us;
+
+    return 0;
+}
+
+/* must be called with hw device mutex locked, OK to hold other mutexes */
+static void stop_voice_call(struct audio_device *adev)
+{
+    int status;
+
+    ALOGV("%s: Closing active PCMs", __func__);
+
+    status = close_voice_pcms(adev);
+
+    /* end SCO stream if needed */
+    if (adev->out_device & AUDIO_DEVICE_OUT_ALL_SCO)
+        end_bt_sco(adev);
+
+    ALOGV("%s: Successfully closed %d active PCMs", __func__, status);
+}
+
+/*
+ * Moves a running call to the current AMR rate. Only the modem PCMs depend
+ * on it: they are reopened at the new rate while the routing thread applies
+ * the difference between the narrow and wide band voice routes, and started
+ * once it is done. SCO and the RIL call state are left alone. If the PCMs
+ * do not reopen, the call is stopped and started again instead. A stream
+ * capturing the call loses its PCM with the close and reattaches at the
+ * new rate on its next read.
+ * must be called with hw device mutex locked
+ */
+static void switch_voice_call_rate(struct audio_device *adev)
+{
+    uint64_t start = get_time_ns();
+    uint64_t elapsed_us;
+
+    select_devices(adev);
+    close_voice_pcms(adev);
+    if (open_voice_pcms(adev) < 0) {
+        ALOGE("%s: cannot reopen the voice PCMs for %s band, restarting the call",
+              __func__, adev->wb_amr ? "wide" : "narrow");
+        adev->rate_switch_failures++;
+        stop_voice_call(adev);
+        start_voice_call(adev);
+        return;
+    }
+    wait_for_routing(adev);
+    start_voice_pcms(adev);
+
+    elapsed_us = (get_time_ns() - start) / 1000;
+
+    adev->rate_switches++;
+    adev->rate_switch_last_us = elapsed_us;
+    if (elapsed_us > adev->rate_switch_max_us)
+        adev->rate_switch_max_us = elapsed_us;
+    if (elapsed_us > VOICE_RATE_SWITCH_TARGET_MS * 1000) {
+        adev->rate_switches_over_target++;
+        ALOGW("%s: switch to %s band took %llu us", __func__,
+              adev->wb_amr ? "wide" : "narrow", (unsigned long long)elapsed_us);
+    }
+}
+
+/* called from the RIL event thread */
+static void adev_set_wb_amr_callback(void *data, enum ril_event event,
+                                     int enable)
+{
+    struct audio_device *adev = (struct audio_device *)data;
+
+    stats_mutex_lock(&adev->lock);
+    if (adev->wb_amr != enable) {
+        adev->wb_amr = enable;
+
+        /* move the modem PCMs to the new rate */
+        if (adev->in_call) {
+            ALOGV("%s: %s Incall Wide Band support",
+                  __func__,
+                  enable ? "Turn on" : "Turn off");
+
+            switch_voice_call_rate(adev);
+        }
     }
+    stats_mutex_unlock(&adev->lock);
+}
+
+/* called from the RIL command thread, must not take audio locks */
+static void adev_ril_complete_callback(void *data, enum ril_cmd_type type,
+                                       int arg, int rc)
+{
+    if (rc != 0)
+        ALOGE("%s: RIL command %d (%d) failed: %d", __func__, type, arg, rc);
+}
 
-    ALOGV("%s: ril_set_call_audio_path(%d)", __func__, device_type);
+static void close_output_pcms(struct stream_out *out)
+{
+    int i;
 
-    ril_set_call_audio_path(&adev->ril, device_type);
+    for (i = 0; i < PCM_TOTAL; i++) {
+        if (out->pcm[i]) {
+            pcm_close(out->pcm[i]);
+            out->pcm[i] = NULL;
+        }
+    }
 }
 
-/* must be called with hw device outputs list, output stream, and hw device mutexes locked */
+/* must be called with the output stream mutex locked, takes the hw device mutex */
 static int start_output_stream(struct stream_out *out)
 {
     struct audio_device *adev = out->dev;
@@ -601,7 +1562,7 @@ static int start_output_stream(struct stream_out *out)
         if (out->pcm[PCM_CARD] && !pcm_is_ready(out->pcm[PCM_CARD])) {
             ALOGE("pcm_open(PCM_CARD) failed: %s",
                   pcm_get_error(out->pcm[PCM_CARD]));
-            pcm_close(out->pcm[PCM_CARD]);
+            close_output_pcms(out);
             return -ENOMEM;
         }
     }
@@ -614,39 +1575,239 @@ static int start_output_stream(struct stream_out *out)
                 !pcm_is_ready(out->pcm[PCM_CARD_SPDIF])) {
             ALOGE("pcm_open(PCM_CARD_SPDIF) failed: %s",
                   pcm_get_error(out->pcm[PCM_CARD_SPDIF]));
-            pcm_close(out->pcm[PCM_CARD_SPDIF]);
+            close_output_pcms(out);
             return -ENOMEM;
         }
     }
 
+    stats_mutex_lock(&adev->lock);
+
     /* in call routing must go through set_parameters */
     if (!adev->in_call) {
         adev->out_device |= out->device;
         select_devices(adev);
     }
+    atomic_store(&out->state, OUT_ACTIVE);
 
     ALOGV("%s: stream out device: %d, actual: %d",
           __func__, out->device, adev->out_device);
 
+    stats_mutex_unlock(&adev->lock);
+
+    return 0;
+}
+
+static bool is_voice_tap_source(audio_source_t source)
+{
+    return source == AUDIO_SOURCE_VOICE_UPLINK ||
+           source == AUDIO_SOURCE_VOICE_DOWNLINK ||
+           source == AUDIO_SOURCE_VOICE_CALL;
+}
+
+static struct pcm_config *get_input_config(audio_input_flags_t flags)
+{
+    return flags & AUDIO_INPUT_FLAG_FAST ?
+            &pcm_config_in_low_latency : &pcm_config_in;
+}
+
+static struct pcm_config *get_capture_profile(audio_source_t source,
+                                              audio_devices_t devices,
+                                              unsigned int rate,
+                                              audio_input_flags_t flags)
+{
+    size_t i;
+
+    /* fast capture has to run at the native mixer rate */
+    if (flags & AUDIO_INPUT_FLAG_FAST)
+        return &pcm_config_in_low_latency;
+
+    devices &= ~AUDIO_DEVICE_BIT_IN;
+
+    for (i = 0; i < ARRAY_SIZE(capture_profiles); i++) {
+        struct capture_profile *profile = &capture_profiles[i];
+
+        if (profile->source != source)
+            continue;
+        if (profile->devices != AUDIO_DEVICE_NONE &&
+                !(profile->devices & devices))
+            continue;
+        if (profile->config.rate < rate)
+            continue;
+
+        return &profile->config;
+    }
+
+    return &pcm_config_in;
+}
+
+/* largest period any capture configuration of a stream can read */
+static size_t get_max_capture_period(void)
+{
+    size_t frames = pcm_config_in.period_size;
+    size_t i;
+
+    if (frames < pcm_config_in_low_latency.period_size)
+        frames = pcm_config_in_low_latency.period_size;
+    if (frames < pcm_config_voice.period_size)
+        frames = pcm_config_voice.period_size;
+    if (frames < pcm_config_voice_wide.period_size)
+        frames = pcm_config_voice_wide.period_size;
+
+    for (i = 0; i < ARRAY_SIZE(capture_profiles); i++) {
+        if (frames < capture_profiles[i].config.period_size)
+            frames = capture_profiles[i].config.period_size;
+    }
+
+    return frames;
+}
+
+static int get_next_buffer(struct resampler_buffer_provider *buffer_provider,
+                           struct resampler_buffer* buffer);
+static void release_buffer(struct resampler_buffer_provider *buffer_provider,
+                           struct resampler_buffer* buffer);
+
+static void release_input_resampler(struct stream_in *in)
+{
+    if (in->resampler == NULL)
+        return;
+
+    if (in->rate_converter)
+        release_rate_converter(in->resampler);
+    else
+        release_resampler(in->resampler);
+    in->resampler = NULL;
+}
+
+/* (re)creates the resampler if the capture rate does not match the requested one */
+static int update_input_resampler(struct stream_in *in)
+{
+    unsigned int rate = in->config->rate;
+    unsigned int channels = audio_channel_count_from_in_mask(in->channel_mask);
+    int ret;
+
+    if (in->resampler && in->resampler_rate == rate) {
+        in->resampler->reset(in->resampler);
+        return 0;
+    }
+
+    release_input_resampler(in);
+
+    if (in->requested_rate == rate)
+        return 0;
+
+    in->buf_provider.get_next_buffer = get_next_buffer;
+    in->buf_provider.release_buffer = release_buffer;
+
+    /*
+     * Narrow and wide band speech, e.g. call audio or SCO captured at the
+     * other rate, go through the half band converter. Otherwise call audio
+     * is band limited and a cheap resampler is good enough.
+     */
+    in->rate_converter = rate_converter_supported(rate, in->requested_rate,
+                                                  channels);
+    if (in->rate_converter)
+        ret = create_rate_converter(rate, in->requested_rate, channels,
+                                    &in->buf_provider, &in->resampler);
+    else
+        ret = create_resampler(rate,
+                               in->requested_rate,
+                               channels,
+                               in->voice_tap ? RESAMPLER_QUALITY_VOIP :
+                                               RESAMPLER_QUALITY_DEFAULT,
+                               &in->buf_provider,
+                               &in->resampler);
+    if (ret != 0) {
+        in->resampler = NULL;
+        return -EINVAL;
+    }
+    in->resampler_rate = rate;
+
+    ALOGV("%s: Created resampler converting %d -> %d\n",
+          __func__, rate, in->requested_rate);
+
+    return 0;
+}
+
+/* must be called with input stream and hw device mutexes locked */
+static int start_voice_tap(struct stream_in *in)
+{
+    struct audio_device *adev = in->dev;
+
+    if (adev->pcm_voice_tx == NULL || adev->voice_tap_in != NULL) {
+        ALOGE("%s: voice PCM not available for capture", __func__);
+        return -ENODEV;
+    }
+
+    ALOGV("%s: capturing call audio from the modem PCM", __func__);
+
+    pthread_mutex_lock(&adev->voice_tx_lock);
+    in->pcm = adev->pcm_voice_tx;
+    adev->voice_tap_in = in;
+    pthread_mutex_unlock(&adev->voice_tx_lock);
+    in->config = adev->wb_amr ? &pcm_config_voice_wide : &pcm_config_voice;
+    in->voice_tap = true;
+
     return 0;
 }
 
+/* must be called with input stream and hw device mutexes locked */
+static void stop_voice_tap(struct stream_in *in)
+{
+    struct audio_device *adev = in->dev;
+
+    /* the PCM stays with the call */
+    pthread_mutex_lock(&adev->voice_tx_lock);
+    if (adev->voice_tap_in == in)
+        adev->voice_tap_in = NULL;
+    in->pcm = NULL;
+    pthread_mutex_unlock(&adev->voice_tx_lock);
+
+    in->voice_tap = false;
+    in->config = in->profile_config;
+}
+
 /* must be called with input stream and hw device mutexes locked */
 static int start_input_stream(struct stream_in *in)
 {
     struct audio_device *adev = in->dev;
+    int ret;
 
-    in->pcm = pcm_open(PCM_CARD, PCM_DEVICE, PCM_IN, in->config);
+    if (adev->in_call && is_voice_tap_source(in->input_source)) {
+        ret = start_voice_tap(in);
+        if (ret < 0)
+            return ret;
+    } else {
+        in->config = in->profile_config;
+        in->pcm = pcm_open(PCM_CARD, PCM_DEVICE, PCM_IN, in->config);
+
+        /* not every native rate is supported on every route */
+        if (in->pcm && !pcm_is_ready(in->pcm) &&
+                in->config != get_input_config(in->flags)) {
+            ALOGW("%s: capture profile %u Hz/%u ch failed: %s, using default",
+                  __func__, in->config->rate, in->config->channels,
+                  pcm_get_error(in->pcm));
+            pcm_close(in->pcm);
+            in->config = get_input_config(in->flags);
+            in->pcm = pcm_open(PCM_CARD, PCM_DEVICE, PCM_IN, in->config);
+        }
 
-    if (in->pcm && !pcm_is_ready(in->pcm)) {
-        ALOGE("pcm_open() failed: %s", pcm_get_error(in->pcm));
-        pcm_close(in->pcm);
-        return -ENOMEM;
+        if (in->pcm && !pcm_is_ready(in->pcm)) {
+            ALOGE("pcm_open() failed: %s", pcm_get_error(in->pcm));
+            pcm_close(in->pcm);
+            return -ENOMEM;
+        }
     }
 
     /* if no supported sample rate is available, use the resampler */
-    if (in->resampler)
-        in->resampler->reset(in->resampler);
+    ret = update_input_resampler(in);
+    if (ret < 0) {
+        if (in->voice_tap)
+            stop_voice_tap(in);
+        else
+            pcm_close(in->pcm);
+        in->pcm = NULL;
+        return ret;
+    }
 
     in->frames_in = 0;
     /* in call routing must go through set_parameters */
@@ -666,13 +1827,11 @@ static int start_input_stream(struct stream_in *in)
     return 0;
 }
 
-static size_t get_input_buffer_size(unsigned int sample_rate,
+static size_t get_input_buffer_size(const struct pcm_config *config,
+                                    unsigned int sample_rate,
                                     audio_format_t format,
-                                    unsigned int channel_count,
-                                    bool is_low_latency)
+                                    unsigned int channel_count)
 {
-    const struct pcm_config *config = is_low_latency ?
-            &pcm_config_in_low_latency : &pcm_config_in;
     size_t size;
 
     /*
@@ -686,10 +1845,104 @@ static size_t get_input_buffer_size(unsigned int sample_rate,
     return size * channel_count * audio_bytes_per_sample(format);
 }
 
+/*
+ * Extracts the call direction(s) selected by the input source from the
+ * stereo modem frames, in place. A stereo AUDIO_SOURCE_VOICE_CALL capture
+ * keeps uplink and downlink separated, a mono one mixes them.
+ */
+static void voice_tap_convert(struct stream_in *in)
+{
+    unsigned int channels = audio_channel_count_from_in_mask(in->channel_mask);
+    int16_t *buf = in->buffer;
+    size_t i;
+
+    /* uplink is already on the left and downlink on the right */
+    if (in->input_source == AUDIO_SOURCE_VOICE_CALL && channels == 2)
+        return;
+
+    for (i = 0; i < in->frames_in; i++) {
+        int32_t uplink = buf[2 * i + VOICE_TAP_UPLINK_SLOT];
+        int32_t dnlink = buf[2 * i + VOICE_TAP_DNLINK_SLOT];
+        int16_t sample;
+
+        switch (in->input_source) {
+        case AUDIO_SOURCE_VOICE_UPLINK:
+            sample = uplink;
+            break;
+        case AUDIO_SOURCE_VOICE_DOWNLINK:
+            sample = dnlink;
+            break;
+        default:
+            sample = (int16_t)((uplink + dnlink) >> 1);
+            break;
+        }
+
+        if (channels == 1) {
+            buf[i] = sample;
+        } else {
+            buf[2 * i] = sample;
+            buf[2 * i + 1] = sample;
+        }
+    }
+}
+
+/*
+ * Reads a period, -ENODEV without a PCM, e.g. once the call closed the one
+ * of a voice tap.
+ * must be called with input stream mutex locked
+ */
+static int read_input_pcm(struct stream_in *in)
+{
+    pthread_mutex_t *voice_tx_lock = &in->dev->voice_tx_lock;
+    size_t frames = in->config->period_size / VOICE_TAP_READS;
+    size_t offset = 0;
+    char *buf = (char *)in->buffer;
+    int ret = 0;
+
+    if (!in->voice_tap)
+        return in->pcm == NULL ? -ENODEV :
+                pcm_read(in->pcm, buf,
+                         pcm_frames_to_bytes(in->pcm, in->config->period_size));
+
+    while (ret == 0 && offset < in->config->period_size) {
+        if (frames > in->config->period_size - offset)
+            frames = in->config->period_size - offset;
+
+        /* the call is about to close the PCM, the period is lost anyway */
+        if (atomic_load(&in->dev->voice_tx_closers) > 0)
+            return -ENODEV;
+
+        pthread_mutex_lock(voice_tx_lock);
+        if (in->pcm != NULL)
+            ret = pcm_read(in->pcm, buf + pcm_frames_to_bytes(in->pcm, offset),
+                           pcm_frames_to_bytes(in->pcm, frames));
+        else
+            ret = -ENODEV;
+        pthread_mutex_unlock(voice_tx_lock);
+
+        offset += frames;
+    }
+
+    return ret;
+}
+
+/* must be called with input stream mutex locked */
+static bool voice_tap_lost(struct stream_in *in)
+{
+    bool lost;
+
+    pthread_mutex_lock(&in->dev->voice_tx_lock);
+    lost = in->pcm == NULL;
+    pthread_mutex_unlock(&in->dev->voice_tx_lock);
+
+    return lost;
+}
+
 static int get_next_buffer(struct resampler_buffer_provider *buffer_provider,
                                    struct resampler_buffer* buffer)
 {
     struct stream_in *in;
+    unsigned int channels;
     size_t i;
 
     if (buffer_provider == NULL || buffer == NULL)
@@ -697,20 +1950,13 @@ static int get_next_buffer(struct resampler_buffer_provider *buffer_provider,
 
     in = (struct stream_in *)((char *)buffer_provider -
                                    offsetof(struct stream_in, buf_provider));
-
-    if (in->pcm == NULL) {
-        buffer->raw = NULL;
-        buffer->frame_count = 0;
-        in->read_status = -ENODEV;
-        return -ENODEV;
-    }
+    channels = audio_channel_count_from_in_mask(in->channel_mask);
 
     if (in->frames_in == 0) {
-        in->read_status = pcm_read(in->pcm,
-                                   (void*)in->buffer,
-                                   pcm_frames_to_bytes(in->pcm, in->config->period_size));
+        in->read_status = read_input_pcm(in);
         if (in->read_status != 0) {
-            ALOGE("get_next_buffer() pcm_read error %d", in->read_status);
+            if (in->read_status != -ENODEV)
+                ALOGE("get_next_buffer() pcm_read error %d", in->read_status);
             buffer->raw = NULL;
             buffer->frame_count = 0;
             return in->read_status;
@@ -718,17 +1964,25 @@ static int get_next_buffer(struct resampler_buffer_provider *buffer_provider,
 
         in->frames_in = in->config->period_size;
 
-        /* Do stereo to mono conversion in place by discarding right channel */
-        if (in->channel_mask == AUDIO_CHANNEL_IN_MONO)
+        if (in->voice_tap) {
+            voice_tap_convert(in);
+        } else if (channels == 1 && in->config->channels == 2) {
+            /* Do stereo to mono conversion in place by discarding right channel */
             for (i = 1; i < in->frames_in; i++)
                 in->buffer[i] = in->buffer[i * 2];
+        } else if (channels == 2 && in->config->channels == 1) {
+            /* Mono to stereo in place, backwards to not overwrite input */
+            for (i = in->frames_in; i-- > 0;) {
+                in->buffer[i * 2 + 1] = in->buffer[i];
+                in->buffer[i * 2] = in->buffer[i];
+            }
+        }
     }
 
     buffer->frame_count = (buffer->frame_count > in->frames_in) ?
                                 in->frames_in : buffer->frame_count;
     buffer->i16 = in->buffer +
-            (in->config->period_size - in->frames_in) *
-                audio_channel_count_from_in_mask(in->channel_mask);
+            (in->config->period_size - in->frames_in) * channels;
 
     return in->read_status;
 
@@ -837,90 +2091,74 @@ static audio_devices_t output_devices(struct stream_out *out)
 
     for (type = 0; type < OUTPUT_TOTAL; ++type) {
         struct stream_out *other = dev->outputs[type];
-        if (other && (other != out) && !other->standby) {
-            // TODO no longer accurate
-            /* safe to access other stream without a mutex,
-             * because we hold the dev lock,
-             * which prevents the other stream from being closed
-             */
+        /* safe to access other stream without its mutex: with the dev
+         * lock held it can neither be closed nor change device or go
+         * from or to OUT_ACTIVE
+         */
+        if (other && (other != out) &&
+                atomic_load(&other->state) == OUT_ACTIVE)
             devices |= other->device;
-        }
     }
 
     return devices;
 }
 
-/* must be called with hw device outputs list, all out streams, and hw device mutex locked */
+/* must be called with the output stream mutex locked, takes the hw device mutex */
 static void do_out_standby(struct stream_out *out)
 {
     struct audio_device *adev = out->dev;
-    int i;
 
-    ALOGV("%s: output standby: %d", __func__, out->standby);
+    ALOGV("%s: output state: %d", __func__, atomic_load(&out->state));
 
-    if (!out->standby) {
-        for (i = 0; i < PCM_TOTAL; i++) {
-            if (out->pcm[i]) {
-                pcm_close(out->pcm[i]);
-                out->pcm[i] = NULL;
-            }
-        }
-        out->standby = true;
+    if (atomic_load(&out->state) != OUT_ACTIVE)
+        return;
+
+    atomic_store(&out->state, OUT_STOPPING);
+    close_output_pcms(out);
 
 #if 0
-        if (out == adev->outputs[OUTPUT_HDMI]) {
-            /* force standby on low latency output stream so that it can reuse HDMI driver if
-             * necessary when restarted */
-            force_non_hdmi_out_standby(adev);
-        }
+    if (out == adev->outputs[OUTPUT_HDMI]) {
+        /* force standby on low latency output stream so that it can reuse HDMI driver if
+         * necessary when restarted */
+        force_non_hdmi_out_standby(adev);
+    }
 #endif
 
-        /* re-calculate the set of active devices from other streams */
-        adev->out_device = output_devices(out);
+    stats_mutex_lock(&adev->lock);
+    atomic_store(&out->state, OUT_STANDBY);
 
-        /* Skip resetting the mixer if no output device is active */
-        if (adev->out_device)
-            select_devices(adev);
-    }
-}
+    /* re-calculate the set of active devices from other streams */
+    adev->out_device = output_devices(out);
 
-/* lock outputs list, all output streams, and device */
-static void lock_all_outputs(struct audio_device *adev)
-{
-    enum output_type type;
-    pthread_mutex_lock(&adev->lock_outputs);
-    for (type = 0; type < OUTPUT_TOTAL; ++type) {
-        struct stream_out *out = adev->outputs[type];
-        if (out)
-            pthread_mutex_lock(&out->lock);
-    }
-    pthread_mutex_lock(&adev->lock);
+    /* Skip resetting the mixer if no output device is active */
+    if (adev->out_device)
+        select_devices(adev);
+    stats_mutex_unlock(&adev->lock);
 }
 
-/* unlock device, all output streams (except specified stream), and outputs list */
-static void unlock_all_outputs(struct audio_device *adev, struct stream_out *except)
+static void init_locks(struct audio_device *adev)
 {
-    /* unlock order is irrelevant, but for cleanliness we unlock in reverse order */
-    pthread_mutex_unlock(&adev->lock);
-    enum output_type type = OUTPUT_TOTAL;
-    do {
-        struct stream_out *out = adev->outputs[--type];
-        if (out && out != except)
-            pthread_mutex_unlock(&out->lock);
-    } while (type != (enum output_type) 0);
-    pthread_mutex_unlock(&adev->lock_outputs);
+#ifdef LOCK_STATS
+    unsigned int i;
+
+    for (i = 0; i < LOCK_CLASS_CNT; i++)
+        lock_stats_init(&adev->lock_stats[i], lock_class_names[i]);
+#endif
+
+    stats_mutex_init(&adev->lock, &adev->lock_stats[LOCK_CLASS_ADEV]);
+    stats_mutex_init(&adev->lock_outputs,
+                     &adev->lock_stats[LOCK_CLASS_OUTPUTS]);
+    pthread_mutex_init(&adev->voice_tx_lock, NULL);
+    atomic_init(&adev->voice_tx_closers, 0);
 }
 
 static int out_standby(struct audio_stream *stream)
 {
     struct stream_out *out = (struct stream_out *)stream;
-    struct audio_device *adev = out->dev;
-
-    lock_all_outputs(adev);
 
+    stats_mutex_lock(&out->lock);
     do_out_standby(out);
-
-    unlock_all_outputs(adev, NULL);
+    stats_mutex_unlock(&out->lock);
 
     return 0;
 }
@@ -938,6 +2176,7 @@ static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
     char value[32];
     int ret;
     unsigned int val;
+    bool force_standby;
 
     ALOGV("%s: key value pairs: %s", __func__, kvpairs);
 
@@ -945,31 +2184,35 @@ static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
 
     ret = str_parms_get_str(parms, AUDIO_PARAMETER_STREAM_ROUTING,
                             value, sizeof(value));
-    lock_all_outputs(adev);
+    stats_mutex_lock(&out->lock);
     if (ret >= 0) {
         val = atoi(value);
         if ((out->device != val) && (val != 0)) {
+            stats_mutex_lock(&adev->lock);
             /* Force standby if moving to/from SPDIF or if the output
              * device changes when in SPDIF mode */
-            if (((val & AUDIO_DEVICE_OUT_DGTL_DOCK_HEADSET) ^
+            force_standby =
+                ((val & AUDIO_DEVICE_OUT_DGTL_DOCK_HEADSET) ^
                  (adev->out_device & AUDIO_DEVICE_OUT_DGTL_DOCK_HEADSET)) ||
-                (adev->out_device & AUDIO_DEVICE_OUT_DGTL_DOCK_HEADSET)) {
-                do_out_standby(out);
-            }
+                (adev->out_device & AUDIO_DEVICE_OUT_DGTL_DOCK_HEADSET);
+            stats_mutex_unlock(&adev->lock);
 
             /* force output standby to start or stop SCO pcm stream if needed */
             if ((val & AUDIO_DEVICE_OUT_ALL_SCO) ^
-                (out->device & AUDIO_DEVICE_OUT_ALL_SCO)) {
+                (out->device & AUDIO_DEVICE_OUT_ALL_SCO))
+                force_standby = true;
+
+            if (force_standby)
                 do_out_standby(out);
-            }
 
+            stats_mutex_lock(&adev->lock);
             out->device = val;
             adev->out_device = output_devices(out) | val;
-            select_devices(adev);
-
+            select_devices_debounced(adev);
+            stats_mutex_unlock(&adev->lock);
         }
     }
-    unlock_all_outputs(adev, NULL);
+    stats_mutex_unlock(&out->lock);
 
     str_parms_destroy(parms);
     return ret;
@@ -1036,29 +2279,21 @@ static ssize_t out_write(struct audio_stream_out *stream, const void* buffer,
     struct audio_device *adev = out->dev;
     int i;
 
-    /* FIXME This comment is no longer correct
-     * acquiring hw device mutex systematically is useful if a low
-     * priority thread is waiting on the output stream mutex - e.g.
-     * executing out_set_parameters() while holding the hw device
-     * mutex
+    /* other outputs are not locked, only a cold start takes the hw
+     * device mutex to update the routing
      */
-    pthread_mutex_lock(&out->lock);
-    if (out->standby) {
-        pthread_mutex_unlock(&out->lock);
-        lock_all_outputs(adev);
-        if (!out->standby) {
-            unlock_all_outputs(adev, out);
-            goto false_alarm;
-        }
+    stats_mutex_lock(&out->lock);
+    if (atomic_load(&out->state) == OUT_STANDBY) {
+        atomic_store(&out->state, OUT_STARTING);
         ret = start_output_stream(out);
         if (ret < 0) {
-            unlock_all_outputs(adev, NULL);
-            goto final_exit;
+            atomic_store(&out->state, OUT_STANDBY);
+            goto exit;
         }
-        out->standby = false;
-        unlock_all_outputs(adev, out);
+
+        /* do not play the first buffers on the previous route */
+        wait_for_routing(adev);
     }
-false_alarm:
 
     /* Write to all active PCMs */
     for (i = 0; i < PCM_TOTAL; i++)
@@ -1071,8 +2306,7 @@ false_alarm:
         out->written += bytes / (out->config.channels * sizeof(short));
 
 exit:
-    pthread_mutex_unlock(&out->lock);
-final_exit:
+    stats_mutex_unlock(&out->lock);
 
     if (ret != 0) {
         usleep(bytes * 1000000 / audio_stream_out_frame_size(stream) /
@@ -1110,7 +2344,7 @@ static int out_get_presentation_position(const struct audio_stream_out *stream,
     struct stream_out *out = (struct stream_out *)stream;
     int ret = -1;
 
-    pthread_mutex_lock(&out->lock);
+    stats_mutex_lock(&out->lock);
 
     int i;
     // There is a question how to implement this correctly when there is more than one PCM stream.
@@ -1119,7 +2353,7 @@ static int out_get_presentation_position(const struct audio_stream_out *stream,
     // cases where both cards are active are marginal.
     for (i = 0; i < PCM_TOTAL; i++)
         if (out->pcm[i]) {
-            size_t avail;
+            unsigned int avail;
             if (pcm_get_htimestamp(out->pcm[i], &avail, timestamp) == 0) {
                 size_t kernel_buffer_size = out->config.period_size * out->config.period_count;
                 // FIXME This calculation is incorrect if there is buffering after app processor
@@ -1133,7 +2367,7 @@ static int out_get_presentation_position(const struct audio_stream_out *stream,
             }
         }
 
-    pthread_mutex_unlock(&out->lock);
+    stats_mutex_unlock(&out->lock);
 
     return ret;
 }
@@ -1162,10 +2396,10 @@ static size_t in_get_buffer_size(const struct audio_stream *stream)
 {
     struct stream_in *in = (struct stream_in *)stream;
 
-    return get_input_buffer_size(in->requested_rate,
+    return get_input_buffer_size(in->profile_config,
+                                 in->requested_rate,
                                  AUDIO_FORMAT_PCM_16_BIT,
-                                 audio_channel_count_from_in_mask(in_get_channels(stream)),
-                                 (in->flags & AUDIO_INPUT_FLAG_FAST) != 0);
+                                 audio_channel_count_from_in_mask(in_get_channels(stream)));
 }
 
 static audio_format_t in_get_format(const struct audio_stream *stream)
@@ -1184,8 +2418,12 @@ static void do_in_standby(struct stream_in *in)
     struct audio_device *adev = in->dev;
 
     if (!in->standby) {
-        pcm_close(in->pcm);
-        in->pcm = NULL;
+        if (in->voice_tap) {
+            stop_voice_tap(in);
+        } else {
+            pcm_close(in->pcm);
+            in->pcm = NULL;
+        }
 
         if (adev->mode != AUDIO_MODE_IN_CALL) {
             in->dev->input_source = AUDIO_SOURCE_DEFAULT;
@@ -1201,13 +2439,13 @@ static int in_standby(struct audio_stream *stream)
 {
     struct stream_in *in = (struct stream_in *)stream;
 
-    pthread_mutex_lock(&in->lock);
-    pthread_mutex_lock(&in->dev->lock);
+    stats_mutex_lock(&in->lock);
+    stats_mutex_lock(&in->dev->lock);
 
     do_in_standby(in);
 
-    pthread_mutex_unlock(&in->dev->lock);
-    pthread_mutex_unlock(&in->lock);
+    stats_mutex_unlock(&in->dev->lock);
+    stats_mutex_unlock(&in->lock);
 
     return 0;
 }
@@ -1229,14 +2467,18 @@ static int in_set_parameters(struct audio_stream *stream, const char *kvpairs)
 
     parms = str_parms_create_str(kvpairs);
 
-    pthread_mutex_lock(&in->lock);
-    pthread_mutex_lock(&adev->lock);
+    stats_mutex_lock(&in->lock);
+    stats_mutex_lock(&adev->lock);
     ret = str_parms_get_str(parms, AUDIO_PARAMETER_STREAM_INPUT_SOURCE,
                             value, sizeof(value));
     if (ret >= 0) {
         val = atoi(value);
         /* no audio source uses val == 0 */
         if ((in->input_source != val) && (val != 0)) {
+            /* reopen from the right PCM when entering or leaving call capture */
+            if ((in->voice_tap || adev->in_call) &&
+                    in->voice_tap != is_voice_tap_source(val))
+                do_in_standby(in);
             in->input_source = val;
             apply_now = !in->standby;
         }
@@ -1259,14 +2501,15 @@ static int in_set_parameters(struct audio_stream *stream, const char *kvpairs)
         }
     }
 
-    if (apply_now) {
+    /* call capture never changes the call routing */
+    if (apply_now && !in->voice_tap) {
         adev->input_source = in->input_source;
         adev->in_device = in->device;
-        select_devices(adev);
+        select_devices_debounced(adev);
     }
 
-    pthread_mutex_unlock(&adev->lock);
-    pthread_mutex_unlock(&in->lock);
+    stats_mutex_unlock(&adev->lock);
+    stats_mutex_unlock(&in->lock);
 
     str_parms_destroy(parms);
     return ret;
@@ -1322,14 +2565,22 @@ static ssize_t in_read(struct audio_stream_in *stream, void* buffer,
      * executing in_set_parameters() while holding the hw device
      * mutex
      */
-    pthread_mutex_lock(&in->lock);
+    stats_mutex_lock(&in->lock);
+    if (in->voice_tap && voice_tap_lost(in)) {
+        /* the call closed its PCM, restart from whatever capture is left */
+        stats_mutex_lock(&adev->lock);
+        do_in_standby(in);
+        stats_mutex_unlock(&adev->lock);
+    }
     if (in->standby) {
-        pthread_mutex_lock(&adev->lock);
+        stats_mutex_lock(&adev->lock);
         ret = start_input_stream(in);
-        pthread_mutex_unlock(&adev->lock);
+        stats_mutex_unlock(&adev->lock);
         if (ret < 0)
             goto exit;
         in->standby = false;
+
+        wait_for_routing(adev);
     }
 
     /*if (in->num_preprocessors != 0)
@@ -1345,9 +2596,10 @@ static ssize_t in_read(struct audio_stream_in *stream, void* buffer,
 
     /*
      * Instead of writing zeroes here, we could trust the hardware
-     * to always provide zeroes when muted.
+     * to always provide zeroes when muted. In call the modem mutes the
+     * uplink itself, the downlink must stay audible.
      */
-    if (ret == 0 && adev->mic_mute)
+    if (ret == 0 && adev->mic_mute && !in->voice_tap)
         memset(buffer, 0, bytes);
 
 exit:
@@ -1355,7 +2607,7 @@ exit:
         usleep(bytes * 1000000 / audio_stream_in_frame_size(stream) /
                in_get_sample_rate(&stream->common));
 
-    pthread_mutex_unlock(&in->lock);
+    stats_mutex_unlock(&in->lock);
     return bytes;
 }
 
@@ -1417,23 +2669,26 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
     out->stream.get_presentation_position = out_get_presentation_position;
 
     out->dev = adev;
+    stats_mutex_init(&out->lock, &adev->lock_stats[LOCK_CLASS_OUT + type]);
 
     config->format = out_get_format(&out->stream.common);
     config->channel_mask = out_get_channels(&out->stream.common);
     config->sample_rate = out_get_sample_rate(&out->stream.common);
 
-    out->standby = true;
+    atomic_init(&out->state, OUT_STANDBY);
     /* out->muted = false; by calloc() */
     /* out->written = 0; by calloc() */
 
-    pthread_mutex_lock(&adev->lock_outputs);
+    stats_mutex_lock(&adev->lock_outputs);
     if (adev->outputs[type]) {
-        pthread_mutex_unlock(&adev->lock_outputs);
+        stats_mutex_unlock(&adev->lock_outputs);
         ret = -EBUSY;
         goto err_open;
     }
+    stats_mutex_lock(&adev->lock);
     adev->outputs[type] = out;
-    pthread_mutex_unlock(&adev->lock_outputs);
+    stats_mutex_unlock(&adev->lock);
+    stats_mutex_unlock(&adev->lock_outputs);
 
     *stream_out = &out->stream;
 
@@ -1453,14 +2708,16 @@ static void adev_close_output_stream(struct audio_hw_device *dev,
 
     out_standby(&stream->common);
     adev = (struct audio_device *)dev;
-    pthread_mutex_lock(&adev->lock_outputs);
+    stats_mutex_lock(&adev->lock_outputs);
+    stats_mutex_lock(&adev->lock);
     for (type = 0; type < OUTPUT_TOTAL; type++) {
         if (adev->outputs[type] == (struct stream_out *) stream) {
             adev->outputs[type] = NULL;
             break;
         }
     }
-    pthread_mutex_unlock(&adev->lock_outputs);
+    stats_mutex_unlock(&adev->lock);
+    stats_mutex_unlock(&adev->lock_outputs);
     free(stream);
 }
 
@@ -1482,6 +2739,27 @@ static int adev_set_parameters(struct audio_hw_device *dev, const char *kvpairs)
             adev->bluetooth_nrec = false;
     }
 
+    ret = str_parms_get_str(parms, AUDIO_PARAMETER_KEY_BT_SCO_WB, value, sizeof(value));
+    if (ret >= 0) {
+        bool bt_wbs = strcmp(value, AUDIO_PARAMETER_VALUE_ON) == 0;
+
+        stats_mutex_lock(&adev->lock);
+        if (adev->bt_wbs != bt_wbs) {
+            ALOGV("%s: %s wide band speech on SCO", __func__,
+                  bt_wbs ? "enabling" : "disabling");
+            adev->bt_wbs = bt_wbs;
+            select_devices(adev);
+
+            /* an open SCO link has to move to the new rate */
+            if (adev->pcm_sco_rx || adev->pcm_sco_tx) {
+                end_bt_sco(adev);
+                wait_for_routing(adev);
+                start_bt_sco(adev);
+            }
+        }
+        stats_mutex_unlock(&adev->lock);
+    }
+
     /* FIXME: This does not work with LL, see workaround in this HAL */
     ret = str_parms_get_str(parms, "noise_suppression", value, sizeof(value));
     if (ret >= 0) {
@@ -1514,31 +2792,9 @@ static int adev_set_voice_volume(struct audio_hw_device *dev, float volume)
 {
     struct audio_device *adev = (struct audio_device *)dev;
 
-    adev->voice_volume = volume;
-
-    if (adev->mode == AUDIO_MODE_IN_CALL) {
-        enum _SoundType sound_type;
-
-        switch (adev->out_device) {
-            case AUDIO_DEVICE_OUT_SPEAKER:
-                sound_type = SOUND_TYPE_SPEAKER;
-                break;
-            case AUDIO_DEVICE_OUT_WIRED_HEADSET:
-            case AUDIO_DEVICE_OUT_WIRED_HEADPHONE:
-                sound_type = SOUND_TYPE_HEADSET;
-                break;
-            case AUDIO_DEVICE_OUT_BLUETOOTH_SCO:
-            case AUDIO_DEVICE_OUT_BLUETOOTH_SCO_HEADSET:
-            case AUDIO_DEVICE_OUT_BLUETOOTH_SCO_CARKIT:
-            case AUDIO_DEVICE_OUT_ALL_SCO:
-                sound_type = SOUND_TYPE_BTVOICE;
-                break;
-            default:
-                sound_type = SOUND_TYPE_VOICE;
-        }
-
-        ril_set_call_volume(&adev->ril, sound_type, volume);
-    }
+    stats_mutex_lock(&adev->lock);
+    set_voice_volume(adev, volume);
+    stats_mutex_unlock(&adev->lock);
 
     return 0;
 }
@@ -1555,7 +2811,7 @@ static int adev_set_mode(struct audio_hw_device *dev, audio_mode_t mode)
     if (adev->mode == mode)
         return 0;
 
-    pthread_mutex_lock(&adev->lock);
+    stats_mutex_lock(&adev->lock);
     adev->mode = mode;
 
     if (adev->mode == AUDIO_MODE_IN_CALL) {
@@ -1566,10 +2822,7 @@ static int adev_set_mode(struct audio_hw_device *dev, audio_mode_t mode)
                 adev->out_device = AUDIO_DEVICE_OUT_EARPIECE;
             }
             adev->input_source = AUDIO_SOURCE_VOICE_CALL;
-            select_devices(adev);
             start_voice_call(adev);
-            ril_set_call_clock_sync(&adev->ril, SOUND_CLOCK_START);
-            adev_set_voice_volume(&adev->hw_device, adev->voice_volume);
             adev->in_call = true;
         }
     } else {
@@ -1582,7 +2835,10 @@ static int adev_set_mode(struct audio_hw_device *dev, audio_mode_t mode)
             select_devices(adev);
         }
     }
-    pthread_mutex_unlock(&adev->lock);
+
+    /* the gain modifiers depend on the mode */
+    select_devices(adev);
+    stats_mutex_unlock(&adev->lock);
 
     return 0;
 }
@@ -1615,9 +2871,10 @@ static int adev_get_mic_mute(const struct audio_hw_device *dev, bool *state)
 static size_t adev_get_input_buffer_size(const struct audio_hw_device *dev,
                                          const struct audio_config *config)
 {
-    return get_input_buffer_size(config->sample_rate, config->format,
-                                 audio_channel_count_from_in_mask(config->channel_mask),
-                                 false /* is_low_latency: since we don't know, be conservative */);
+    /* since we don't know the source, be conservative */
+    return get_input_buffer_size(&pcm_config_in,
+                                 config->sample_rate, config->format,
+                                 audio_channel_count_from_in_mask(config->channel_mask));
 }
 
 static int adev_open_input_stream(struct audio_hw_device *dev,
@@ -1627,16 +2884,25 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
                                   struct audio_stream_in **stream_in,
                                   audio_input_flags_t flags,
                                   const char *address __unused,
-                                  audio_source_t source __unused)
+                                  audio_source_t source)
 {
     struct audio_device *adev = (struct audio_device *)dev;
     struct stream_in *in;
+    struct pcm_config *profile_config;
     int ret;
 
     *stream_in = NULL;
 
-    /* Respond with a request for stereo if a different format is given. */
-    if (config->channel_mask != AUDIO_CHANNEL_IN_STEREO) {
+    profile_config = get_capture_profile(source, devices,
+                                         config->sample_rate, flags);
+
+    /*
+     * Respond with a request for stereo if a different format is given.
+     * Mono is fine for call capture and for sources with a mono profile.
+     */
+    if (config->channel_mask != AUDIO_CHANNEL_IN_STEREO &&
+            !(config->channel_mask == AUDIO_CHANNEL_IN_MONO &&
+              (is_voice_tap_source(source) || profile_config->channels == 1))) {
         config->channel_mask = AUDIO_CHANNEL_IN_STEREO;
         return -EINVAL;
     }
@@ -1660,47 +2926,37 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
     in->stream.get_input_frames_lost = in_get_input_frames_lost;
 
     in->dev = adev;
+    stats_mutex_init(&in->lock, &adev->lock_stats[LOCK_CLASS_IN]);
     in->standby = true;
     in->requested_rate = config->sample_rate;
-    in->input_source = AUDIO_SOURCE_DEFAULT;
+    in->input_source = source;
     /* strip AUDIO_DEVICE_BIT_IN to allow bitwise comparisons */
     in->device = devices & ~AUDIO_DEVICE_BIT_IN;
     in->io_handle = handle;
     in->channel_mask = config->channel_mask;
     in->flags = flags;
-    struct pcm_config *pcm_config = flags & AUDIO_INPUT_FLAG_FAST ?
-            &pcm_config_in_low_latency : &pcm_config_in;
-    in->config = pcm_config;
+    in->profile_config = profile_config;
+    in->config = profile_config;
 
-    in->buffer = malloc(pcm_config->period_size * pcm_config->channels
-                                               * audio_stream_in_frame_size(&in->stream));
+    /*
+     * The buffer has to hold a period of any configuration the stream can
+     * fall back to (including the modem PCM), in stereo
+     */
+    in->buffer = malloc(get_max_capture_period() * 2 * sizeof(int16_t));
 
     if (!in->buffer) {
         ret = -ENOMEM;
         goto err_malloc;
     }
 
-    if (in->requested_rate != pcm_config->rate) {
-        in->buf_provider.get_next_buffer = get_next_buffer;
-        in->buf_provider.release_buffer = release_buffer;
-
-        ret = create_resampler(pcm_config->rate,
-                               in->requested_rate,
-                               audio_channel_count_from_in_mask(in->channel_mask),
-                               RESAMPLER_QUALITY_DEFAULT,
-                               &in->buf_provider,
-                               &in->resampler);
-        if (ret != 0) {
-            ret = -EINVAL;
-            goto err_resampler;
-        }
-
-        ALOGV("%s: Created resampler converting %d -> %d\n",
-              __func__, pcm_config_in.rate, in->requested_rate);
-    }
+    ret = update_input_resampler(in);
+    if (ret != 0)
+        goto err_resampler;
 
-    ALOGV("%s: Requesting input stream with rate: %d, channels: 0x%x\n",
-          __func__, config->sample_rate, config->channel_mask);
+    ALOGV("%s: Requesting input stream with rate: %d, channels: 0x%x, "
+          "capturing at %d Hz, %d channels\n",
+          __func__, config->sample_rate, config->channel_mask,
+          profile_config->rate, profile_config->channels);
 
     *stream_in = &in->stream;
     return 0;
@@ -1718,16 +2974,102 @@ static void adev_close_input_stream(struct audio_hw_device *dev,
     struct stream_in *in = (struct stream_in *)stream;
 
     in_standby(&stream->common);
-    if (in->resampler) {
-        release_resampler(in->resampler);
-        in->resampler = NULL;
-    }
+    release_input_resampler(in);
     free(in->buffer);
     free(stream);
 }
 
 static int adev_dump(const audio_hw_device_t *device, int fd)
 {
+    struct audio_device *adev = (struct audio_device *)device;
+    struct route_stats stats;
+    unsigned int requests, applied, coalesced, debounced;
+    unsigned int rate_switches, over_target, rate_switch_failures;
+    uint64_t rate_switch_last_us, rate_switch_max_us;
+    struct call_timing timing;
+    unsigned int call_setups, call_setup_failures;
+    uint64_t call_setup_max_us;
+    struct ril_stats ril_stats;
+#ifdef LOCK_STATS
+    unsigned int i;
+#endif
+
+    stats_mutex_lock(&adev->lock);
+    timing = adev->call_timing;
+    call_setups = adev->call_setups;
+    call_setup_failures = adev->call_setup_failures;
+    call_setup_max_us = adev->call_setup_max_us;
+    rate_switches = adev->rate_switches;
+    over_target = adev->rate_switches_over_target;
+    rate_switch_failures = adev->rate_switch_failures;
+    rate_switch_last_us = adev->rate_switch_last_us;
+    rate_switch_max_us = adev->rate_switch_max_us;
+    stats_mutex_unlock(&adev->lock);
+
+    pthread_mutex_lock(&adev->route_lock);
+    stats = adev->route_stats;
+    requests = adev->route_seq;
+    applied = adev->route_done_seq;
+    coalesced = adev->route_coalesced;
+    debounced = adev->route_debounced;
+    pthread_mutex_unlock(&adev->route_lock);
+
+    dprintf(fd, "\nRoute engine:\n"
+                "  requests: %u, applied: %u, absorbed: %u "
+                "(in %u debounce windows)\n"
+                "  transitions: %u, ramped: %u\n"
+                "  mixer ioctls: last %u, max %u, total %llu\n"
+                "  transition time: last %llu us, max %llu us\n",
+            requests, applied, coalesced, debounced,
+            stats.transitions, stats.ramps,
+            stats.last_ioctls, stats.max_ioctls,
+            (unsigned long long)stats.total_ioctls,
+            (unsigned long long)stats.last_time_us,
+            (unsigned long long)stats.max_time_us);
+
+    dprintf(fd, "\nVoice call:\n"
+                "  bring-ups: %u, failed: %u, max %llu us\n"
+                "  last bring-up: %llu us: pcm open %llu, route wait %llu, "
+                "pcm start %llu, clock sync %llu, volume %llu\n"
+                "  AMR rate switches: %u, over %d ms target: %u, failed: %u\n"
+                "  switch time: last %llu us, max %llu us\n",
+            call_setups, call_setup_failures,
+            (unsigned long long)call_setup_max_us,
+            (unsigned long long)timing.total_us,
+            (unsigned long long)timing.pcm_open_us,
+            (unsigned long long)timing.route_wait_us,
+            (unsigned long long)timing.pcm_start_us,
+            (unsigned long long)timing.clock_sync_us,
+            (unsigned long long)timing.volume_us,
+            rate_switches, VOICE_RATE_SWITCH_TARGET_MS, over_target,
+            rate_switch_failures,
+            (unsigned long long)rate_switch_last_us,
+            (unsigned long long)rate_switch_max_us);
+
+    ril_get_stats(&adev->ril, &ril_stats);
+    dprintf(fd, "\nRIL commands:\n"
+                "  rild: %s, backoff %u ms, connects: %u, failed: %u\n"
+                "  posted: %u, coalesced: %u, pending: %u, dropped: %u\n"
+                "  sent: %u, failed: %u, replayed: %u\n"
+                "  state cache: %u hits, %u misses\n"
+                "  unsolicited events: %u, dropped: %u\n",
+            ril_conn_state_name(ril_stats.conn_state), ril_stats.backoff_ms,
+            ril_stats.connects, ril_stats.connect_failures,
+            ril_stats.posted, ril_stats.coalesced, ril_stats.pending,
+            ril_stats.dropped,
+            ril_stats.sent, ril_stats.failed, ril_stats.replayed,
+            ril_stats.cache_hits, ril_stats.cache_misses,
+            ril_stats.events, ril_stats.events_dropped);
+
+#ifdef LOCK_STATS
+    dprintf(fd, "\nLocks:\n"
+                "  held now: adev->lock_outputs by %s, adev->lock by %s\n",
+            stats_mutex_owner(&adev->lock_outputs),
+            stats_mutex_owner(&adev->lock));
+    for (i = 0; i < LOCK_CLASS_CNT; i++)
+        lock_stats_dump(&adev->lock_stats[i], fd);
+#endif
+
     return 0;
 }
 
@@ -1735,11 +3077,14 @@ static int adev_close(hw_device_t *device)
 {
     struct audio_device *adev = (struct audio_device *)device;
 
-    audio_route_free(adev->ar);
+    stop_route_thread(adev);
+    free_routes(adev);
+    route_engine_free(adev->re);
 
     /* RIL */
     ril_close(&adev->ril);
 
+    pthread_mutex_destroy(&adev->voice_tx_lock);
     free(device);
     return 0;
 }
@@ -1777,7 +3122,25 @@ static int adev_open(const hw_module_t* module, const char* name,
     adev->hw_device.close_input_stream = adev_close_input_stream;
     adev->hw_device.dump = adev_dump;
 
-    adev->ar = audio_route_init(MIXER_CARD, NULL);
+    init_locks(adev);
+
+    adev->re = route_engine_init(MIXER_CARD, NULL, GAIN_CONF_PATH,
+                                 ROUTE_DB_PATH);
+    if (adev->re == NULL) {
+        free(adev);
+        return -EINVAL;
+    }
+
+    route_engine_set_ramp(adev->re, ramp_controls, ARRAY_SIZE(ramp_controls),
+                          ROUTE_RAMP_TIME_US);
+
+    if (init_routes(adev) < 0 || start_route_thread(adev) < 0) {
+        free_routes(adev);
+        route_engine_free(adev->re);
+        free(adev);
+        return -ENOMEM;
+    }
+
     adev->input_source = AUDIO_SOURCE_DEFAULT;
     /* adev->cur_route_id initial value is 0 and such that first device
      * selection is always applied by select_devices() */
@@ -1792,7 +3155,10 @@ static int adev_open(const hw_module_t* module, const char* name,
     if (property_get_bool("audio_hal.force_wideband", false))
         force_wideband(adev);
     else
-        ril_register_set_wb_amr_callback(adev_set_wb_amr_callback, (void *)adev);
+        ril_subscribe(&adev->ril, RIL_EVENT_WB_AMR, adev_set_wb_amr_callback,
+                      (void *)adev);
+    ril_register_complete_callback(&adev->ril, adev_ril_complete_callback,
+                                   (void *)adev);
 
     *device = &adev->hw_device.common;
 
@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2015 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "lock_stats.h"
+
+#ifdef LOCK_STATS
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static unsigned int bucket(uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+    unsigned int i;
+
+    if (us == 0)
+        return 0;
+
+    i = 64 - __builtin_clzll(us);   /* 1 us is bucket 1, 2-3 us bucket 2 */
+
+    return i < LOCK_HIST_BUCKETS ? i : LOCK_HIST_BUCKETS - 1;
+}
+
+static void update_max(atomic_ullong *max, uint64_t value)
+{
+    unsigned long long cur = atomic_load_explicit(max, memory_order_relaxed);
+
+    while (value > cur &&
+           !atomic_compare_exchange_weak_explicit(max, &cur, value,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed))
+        ;
+}
+
+/* Finds or claims the slot of a call site, open addressing on the pointer */
+static struct lock_site *get_site(struct lock_stats *stats, const char *name)
+{
+    unsigned int start = ((uintptr_t)name >> 3) % LOCK_SITES_MAX;
+    unsigned int i, n;
+    const char *cur;
+
+    for (n = 0; n < LOCK_SITES_MAX; n++) {
+        i = (start + n) % LOCK_SITES_MAX;
+        cur = atomic_load_explicit(&stats->sites[i].name,
+                                   memory_order_acquire);
+        if (cur == NULL) {
+            if (atomic_compare_exchange_strong(&stats->sites[i].name, &cur,
+                                               name))
+                return &stats->sites[i];
+            /* lost the race, cur is the winner */
+        }
+        if (cur == name)
+            return &stats->sites[i];
+    }
+
+    atomic_fetch_add_explicit(&stats->sites_dropped, 1, memory_order_relaxed);
+
+    return NULL;
+}
+
+void stats_mutex_init(struct stats_mutex *m, struct lock_stats *stats)
+{
+    pthread_mutex_init(&m->mutex, NULL);
+    m->stats = stats;
+    m->site = NULL;
+    m->locked_ns = 0;
+    atomic_init(&m->owner, NULL);
+}
+
+void stats_mutex_lock_at(struct stats_mutex *m, const char *site)
+{
+    struct lock_stats *stats = m->stats;
+    struct lock_site *s;
+    uint64_t start, wait = 0;
+    bool contended;
+
+    contended = pthread_mutex_trylock(&m->mutex) != 0;
+    if (contended) {
+        start = now_ns();
+        pthread_mutex_lock(&m->mutex);
+        m->locked_ns = now_ns();
+        wait = m->locked_ns - start;
+    } else {
+        m->locked_ns = now_ns();
+    }
+
+    atomic_store_explicit(&m->owner, site, memory_order_relaxed);
+    if (stats == NULL)
+        return;
+
+    s = site ? get_site(stats, site) : NULL;
+    m->site = s;
+
+    atomic_fetch_add_explicit(&stats->count, 1, memory_order_relaxed);
+    if (s != NULL)
+        atomic_fetch_add_explicit(&s->count, 1, memory_order_relaxed);
+    if (!contended)
+        return;
+
+    atomic_fetch_add_explicit(&stats->contended, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->wait_hist[bucket(wait)], 1,
+                              memory_order_relaxed);
+    update_max(&stats->max_wait_ns, wait);
+    if (s != NULL) {
+        atomic_fetch_add_explicit(&s->contended, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&s->wait_ns, wait, memory_order_relaxed);
+    }
+}
+
+void stats_mutex_unlock(struct stats_mutex *m)
+{
+    struct lock_stats *stats = m->stats;
+    struct lock_site *s = m->site;
+    uint64_t hold = now_ns() - m->locked_ns;
+
+    atomic_store_explicit(&m->owner, NULL, memory_order_relaxed);
+    pthread_mutex_unlock(&m->mutex);
+
+    if (stats == NULL)
+        return;
+
+    atomic_fetch_add_explicit(&stats->hold_hist[bucket(hold)], 1,
+                              memory_order_relaxed);
+    update_max(&stats->max_hold_ns, hold);
+    if (s != NULL) {
+        atomic_fetch_add_explicit(&s->hold_ns, hold, memory_order_relaxed);
+        update_max(&s->max_hold_ns, hold);
+    }
+}
+
+void lock_stats_init(struct lock_stats *stats, const char *name)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->name = name;
+}
+
+const char *stats_mutex_owner(struct stats_mutex *m)
+{
+    const char *owner = atomic_load_explicit(&m->owner, memory_order_relaxed);
+
+    return owner ? owner : "none";
+}
+
+/* Bucket holding the given share, in percent, of the samples */
+static unsigned int percentile(const unsigned int *hist, unsigned int total,
+                               unsigned int percent)
+{
+    unsigned int sum = 0;
+    unsigned int i;
+
+    for (i = 0; i < LOCK_HIST_BUCKETS - 1; i++) {
+        sum += hist[i];
+        if ((uint64_t)sum * 100 >= (uint64_t)total * percent)
+            break;
+    }
+
+    return i;
+}
+
+static const char *bucket_name(unsigned int i, char *buf, size_t size)
+{
+    if (i == LOCK_HIST_BUCKETS - 1)
+        snprintf(buf, size, ">=%u", 1u << (i - 1));
+    else
+        snprintf(buf, size, "<%u", 1u << i);
+
+    return buf;
+}
+
+static void dump_hist(int fd, const char *what, const unsigned int *hist,
+                      unsigned int total, uint64_t max_ns)
+{
+    char buf[256];
+    char p50[16], p99[16], name[16];
+    size_t len = 0;
+    unsigned int i;
+
+    if (total == 0)
+        return;
+
+    buf[0] = '\0';
+    for (i = 0; i < LOCK_HIST_BUCKETS && len < sizeof(buf); i++) {
+        if (hist[i] == 0)
+            continue;
+        len += snprintf(buf + len, sizeof(buf) - len, " %s:%u",
+                        bucket_name(i, name, sizeof(name)), hist[i]);
+    }
+
+    dprintf(fd, "    %s: p50 %s us, p99 %s us, max %llu us\n"
+                "      us%s\n", what,
+            bucket_name(percentile(hist, total, 50), p50, sizeof(p50)),
+            bucket_name(percentile(hist, total, 99), p99, sizeof(p99)),
+            (unsigned long long)(max_ns / 1000), buf);
+}
+
+void lock_stats_dump(struct lock_stats *stats, int fd)
+{
+    unsigned int wait_hist[LOCK_HIST_BUCKETS];
+    unsigned int hold_hist[LOCK_HIST_BUCKETS];
+    unsigned int count, contended, holds = 0;
+    struct lock_site *s;
+    const char *name;
+    unsigned int i;
+
+    for (i = 0; i < LOCK_HIST_BUCKETS; i++) {
+        wait_hist[i] = atomic_load(&stats->wait_hist[i]);
+        hold_hist[i] = atomic_load(&stats->hold_hist[i]);
+        holds += hold_hist[i];
+    }
+    count = atomic_load(&stats->count);
+    contended = atomic_load(&stats->contended);
+
+    dprintf(fd, "  %s: %u locks, %u contended\n", stats->name, count,
+            contended);
+    if (count == 0)
+        return;
+
+    dump_hist(fd, "wait", wait_hist, contended,
+              atomic_load(&stats->max_wait_ns));
+    dump_hist(fd, "hold", hold_hist, holds,
+              atomic_load(&stats->max_hold_ns));
+
+    for (i = 0; i < LOCK_SITES_MAX; i++) {
+        s = &stats->sites[i];
+        name = atomic_load(&s->name);
+        if (name == NULL)
+            continue;
+        dprintf(fd, "    %s: %u locks, %u contended, wait %llu us, "
+                    "hold %llu us, max hold %llu us\n", name,
+                atomic_load(&s->count), atomic_load(&s->contended),
+                (unsigned long long)(atomic_load(&s->wait_ns) / 1000),
+                (unsigned long long)(atomic_load(&s->hold_ns) / 1000),
+                (unsigned long long)(atomic_load(&s->max_hold_ns) / 1000));
+    }
+
+    i = atomic_load(&stats->sites_dropped);
+    if (i != 0)
+        dprintf(fd, "    other call sites: %u locks\n", i);
+}
+
+#endif
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2015 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LOCK_STATS_H
+#define LOCK_STATS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*
+ * Mutexes which can record how long they are waited for and held, and by
+ * whom. Without LOCK_STATS (AUDIO_HAL_LOCK_STATS := true in BoardConfig.mk,
+ * always set for the host build) they are plain pthread mutexes.
+ *
+ * Mutexes of one class share a struct lock_stats: log2 histograms of the
+ * wait and hold times and the totals of every call site, the function
+ * which took the lock. All of it is updated with atomics only, so taking
+ * a lock never takes another one and a dump never blocks the audio
+ * threads. Call sites past LOCK_SITES_MAX are only counted.
+ */
+
+#define LOCK_HIST_BUCKETS 16    /* < 1 us, < 2 us, ..., >= 16384 us */
+#define LOCK_SITES_MAX    24
+
+struct lock_site {
+    _Atomic(const char *) name;
+    atomic_uint count;
+    atomic_uint contended;
+    atomic_ullong wait_ns;
+    atomic_ullong hold_ns;
+    atomic_ullong max_hold_ns;
+};
+
+struct lock_stats {
+    const char *name;
+    atomic_uint count;
+    atomic_uint contended;
+    atomic_uint wait_hist[LOCK_HIST_BUCKETS];   /* contended locks only */
+    atomic_uint hold_hist[LOCK_HIST_BUCKETS];
+    atomic_ullong max_wait_ns;
+    atomic_ullong max_hold_ns;
+    atomic_uint sites_dropped;
+    struct lock_site sites[LOCK_SITES_MAX];
+};
+
+struct stats_mutex {
+    pthread_mutex_t mutex;
+#ifdef LOCK_STATS
+    struct lock_stats *stats;
+    /* written by the holder only */
+    struct lock_site *site;
+    uint64_t locked_ns;
+    _Atomic(const char *) owner;    /* read by stats_mutex_owner() */
+#endif
+};
+
+#ifdef LOCK_STATS
+
+#define LOCK_SITE __func__
+
+/* Function prototypes */
+void stats_mutex_init(struct stats_mutex *m, struct lock_stats *stats);
+void stats_mutex_lock_at(struct stats_mutex *m, const char *site);
+void stats_mutex_unlock(struct stats_mutex *m);
+/* call site holding the mutex right now, "none" when it is free */
+const char *stats_mutex_owner(struct stats_mutex *m);
+
+void lock_stats_init(struct lock_stats *stats, const char *name);
+void lock_stats_dump(struct lock_stats *stats, int fd);
+
+#else
+
+#define LOCK_SITE NULL
+
+/* stats is not evaluated, it need not exist */
+#define stats_mutex_init(m, stats) pthread_mutex_init(&(m)->mutex, NULL)
+
+static inline void stats_mutex_lock_at(struct stats_mutex *m,
+                                       const char *site)
+{
+    pthread_mutex_lock(&m->mutex);
+}
+
+static inline void stats_mutex_unlock(struct stats_mutex *m)
+{
+    pthread_mutex_unlock(&m->mutex);
+}
+
+#endif
+
+#define stats_mutex_lock(m) stats_mutex_lock_at(m, LOCK_SITE)
+
+#endif
@@ -0,0 +1,336 @@
+/*
+ * Copyright (C) 2015 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_primary"
+/*#define LOG_NDEBUG 0*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include <cutils/log.h>
+
+#include "rate_converter.h"
+
+#define BLOCK_FRAMES 256    /* input frames pulled from the provider at once */
+#define HIST_FRAMES  15     /* input frames kept between blocks, at most */
+#define IN_FRAMES    (HIST_FRAMES + BLOCK_FRAMES)
+#define MAX_CHANNELS 2
+#define MAX_RATE     16000  /* the filter is short, fine for speech only */
+
+/*
+ * Half band low pass, Kaiser window (beta 5), Q14. Every other tap is zero
+ * except the center one, so only the odd taps next to the center are kept.
+ */
+#define HALF_GAIN 8192
+static const int16_t decim_coefs[4] = { 4972, -1131, 282, -27 };
+static const int16_t interp_coefs[4] = { 9944, -2262, 564, -54 };
+
+struct rate_converter {
+    struct resampler_itfe itfe;     /* must stay first */
+    struct resampler_buffer_provider *provider;
+    uint32_t in_rate;
+    uint32_t channels;
+    bool up;                        /* interpolate, decimate otherwise */
+
+    int16_t in[MAX_CHANNELS][IN_FRAMES];    /* per channel, history first */
+    size_t in_frames;
+    int16_t even[IN_FRAMES / 2 + 1];        /* decimation scratch */
+    int16_t odd[IN_FRAMES / 2 + 1];
+    int16_t conv[2 * BLOCK_FRAMES];         /* output of one channel */
+
+    int16_t out[2 * BLOCK_FRAMES * MAX_CHANNELS];   /* interleaved */
+    size_t out_frames;
+    size_t out_pos;
+};
+
+static inline int16_t round_q14(int32_t acc)
+{
+    acc = (acc + (1 << 13)) >> 14;
+    if (acc > INT16_MAX)
+        return INT16_MAX;
+    if (acc < INT16_MIN)
+        return INT16_MIN;
+    return acc;
+}
+
+/*
+ * y[m] is centered on x[2m + 7]. e and o hold the even and odd input
+ * samples, returns the number of outputs done.
+ */
+static size_t decimate(const int16_t *e, const int16_t *o, int16_t *y,
+                       size_t count)
+{
+    size_t m = 0;
+    int32_t acc;
+    int k;
+
+#if defined(__ARM_NEON__)
+    for (; m + 4 <= count; m += 4) {
+        int32x4_t vacc = vmull_n_s16(vld1_s16(o + m + 3), HALF_GAIN);
+
+        for (k = 0; k < 4; k++)
+            vacc = vmlaq_n_s32(vacc, vaddl_s16(vld1_s16(e + m + 3 - k),
+                                               vld1_s16(e + m + 4 + k)),
+                               decim_coefs[k]);
+
+        vst1_s16(y + m, vqrshrn_n_s32(vacc, 14));
+    }
+#endif
+
+    for (; m < count; m++) {
+        acc = HALF_GAIN * o[m + 3];
+        for (k = 0; k < 4; k++)
+            acc += decim_coefs[k] * (e[m + 3 - k] + e[m + 4 + k]);
+        y[m] = round_q14(acc);
+    }
+
+    return m;
+}
+
+/* y[2i] is x[i + 3], y[2i + 1] lies between x[i + 3] and x[i + 4] */
+static size_t interpolate(const int16_t *x, int16_t *y, size_t count)
+{
+    size_t i = 0;
+    int32_t acc;
+    int k;
+
+#if defined(__ARM_NEON__)
+    for (; i + 4 <= count; i += 4) {
+        int32x4_t vacc = vdupq_n_s32(0);
+        int16x4x2_t v;
+
+        for (k = 0; k < 4; k++)
+            vacc = vmlaq_n_s32(vacc, vaddl_s16(vld1_s16(x + i + 3 - k),
+                                               vld1_s16(x + i + 4 + k)),
+                               interp_coefs[k]);
+
+        v.val[0] = vld1_s16(x + i + 3);
+        v.val[1] = vqrshrn_n_s32(vacc, 14);
+        vst2_s16(y + 2 * i, v);
+    }
+#endif
+
+    for (; i < count; i++) {
+        acc = 0;
+        for (k = 0; k < 4; k++)
+            acc += interp_coefs[k] * (x[i + 3 - k] + x[i + 4 + k]);
+        y[2 * i] = x[i + 3];
+        y[2 * i + 1] = round_q14(acc);
+    }
+
+    return i;
+}
+
+/* Converts what the input buffer holds, returns the input frames used */
+static size_t convert(struct rate_converter *rc)
+{
+    size_t n = rc->in_frames;
+    size_t used = 0, count = 0;
+    uint32_t ch;
+    size_t i;
+
+    if (rc->up)
+        count = n >= 8 ? n - 7 : 0;
+    else
+        count = n >= HIST_FRAMES ? (n - 13) / 2 : 0;
+
+    if (count == 0) {
+        rc->out_frames = 0;
+        return 0;
+    }
+
+    for (ch = 0; ch < rc->channels; ch++) {
+        const int16_t *x = rc->in[ch];
+
+        if (rc->up) {
+            interpolate(x, rc->conv, count);
+            used = count;
+            for (i = 0; i < 2 * count; i++)
+                rc->out[i * rc->channels + ch] = rc->conv[i];
+        } else {
+            for (i = 0; i < n / 2; i++) {
+                rc->even[i] = x[2 * i];
+                rc->odd[i] = x[2 * i + 1];
+            }
+            if (n & 1)
+                rc->even[n / 2] = x[n - 1];
+
+            decimate(rc->even, rc->odd, rc->conv, count);
+            used = 2 * count;
+            for (i = 0; i < count; i++)
+                rc->out[i * rc->channels + ch] = rc->conv[i];
+        }
+
+        memmove(rc->in[ch], x + used, (n - used) * sizeof(int16_t));
+    }
+
+    rc->in_frames = n - used;
+    rc->out_frames = rc->up ? 2 * count : count;
+
+    return used;
+}
+
+/* Pulls one block from the provider and converts it */
+static int fill(struct rate_converter *rc)
+{
+    struct resampler_buffer buf;
+    uint32_t ch;
+    size_t i;
+
+    buf.raw = NULL;
+    buf.frame_count = BLOCK_FRAMES;
+    rc->provider->get_next_buffer(rc->provider, &buf);
+    if (buf.raw == NULL)
+        return -ENODATA;
+
+    if (buf.frame_count > IN_FRAMES - rc->in_frames)
+        buf.frame_count = IN_FRAMES - rc->in_frames;
+
+    for (ch = 0; ch < rc->channels; ch++) {
+        int16_t *dst = rc->in[ch] + rc->in_frames;
+
+        for (i = 0; i < buf.frame_count; i++)
+            dst[i] = buf.i16[i * rc->channels + ch];
+    }
+    rc->in_frames += buf.frame_count;
+    rc->provider->release_buffer(rc->provider, &buf);
+
+    convert(rc);
+    rc->out_pos = 0;
+
+    return 0;
+}
+
+static void rc_reset(struct resampler_itfe *resampler)
+{
+    struct rate_converter *rc = (struct rate_converter *)resampler;
+
+    /* silence before the first frame keeps output and input aligned */
+    memset(rc->in, 0, sizeof(rc->in));
+    rc->in_frames = rc->up ? 3 : 7;
+    rc->out_frames = 0;
+    rc->out_pos = 0;
+}
+
+static int rc_resample_from_provider(struct resampler_itfe *resampler,
+                                     int16_t *out, size_t *out_frame_count)
+{
+    struct rate_converter *rc = (struct rate_converter *)resampler;
+    size_t wanted = *out_frame_count;
+    size_t done = 0;
+    size_t n;
+    int ret = 0;
+
+    while (done < wanted) {
+        if (rc->out_pos == rc->out_frames) {
+            ret = fill(rc);
+            if (ret < 0)
+                break;
+            continue;
+        }
+
+        n = rc->out_frames - rc->out_pos;
+        if (n > wanted - done)
+            n = wanted - done;
+
+        memcpy(out + done * rc->channels, rc->out + rc->out_pos * rc->channels,
+               n * rc->channels * sizeof(int16_t));
+        rc->out_pos += n;
+        done += n;
+    }
+
+    *out_frame_count = done;
+
+    return ret;
+}
+
+/* the HAL only pulls through the buffer provider */
+static int rc_resample_from_input(struct resampler_itfe *resampler,
+                                  int16_t *in, size_t *in_frame_count,
+                                  int16_t *out, size_t *out_frame_count)
+{
+    *in_frame_count = 0;
+    *out_frame_count = 0;
+
+    return -ENOSYS;
+}
+
+/* input frames held back, the filter needs them as look ahead */
+static int32_t rc_delay_ns(struct resampler_itfe *resampler)
+{
+    struct rate_converter *rc = (struct rate_converter *)resampler;
+
+    return (int32_t)((int64_t)rc->in_frames * 1000000000LL / rc->in_rate);
+}
+
+bool rate_converter_supported(uint32_t in_rate, uint32_t out_rate,
+                              uint32_t channels)
+{
+    if (channels == 0 || channels > MAX_CHANNELS ||
+            in_rate > MAX_RATE || out_rate > MAX_RATE)
+        return false;
+
+    return in_rate == 2 * out_rate || out_rate == 2 * in_rate;
+}
+
+int create_rate_converter(uint32_t in_rate, uint32_t out_rate,
+                          uint32_t channels,
+                          struct resampler_buffer_provider *provider,
+                          struct resampler_itfe **resampler)
+{
+    struct rate_converter *rc;
+
+    if (resampler == NULL)
+        return -EINVAL;
+
+    *resampler = NULL;
+
+    if (provider == NULL ||
+            !rate_converter_supported(in_rate, out_rate, channels))
+        return -EINVAL;
+
+    rc = calloc(1, sizeof(struct rate_converter));
+    if (rc == NULL)
+        return -ENOMEM;
+
+    rc->itfe.reset = rc_reset;
+    rc->itfe.resample_from_provider = rc_resample_from_provider;
+    rc->itfe.resample_from_input = rc_resample_from_input;
+    rc->itfe.delay_ns = rc_delay_ns;
+
+    rc->provider = provider;
+    rc->in_rate = in_rate;
+    rc->channels = channels;
+    rc->up = out_rate > in_rate;
+    rc_reset(&rc->itfe);
+
+    ALOGV("%s: %u -> %u Hz, %u channels", __func__, in_rate, out_rate,
+          channels);
+
+    *resampler = &rc->itfe;
+
+    return 0;
+}
+
+void release_rate_converter(struct resampler_itfe *resampler)
+{
+    free(resampler);
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2015 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef RATE_CONVERTER_H
+#define RATE_CONVERTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <audio_utils/resampler.h>
+
+/*
+ * Converts 16 bit PCM between narrow and wide band speech rates, a factor
+ * two apart, with a 15 tap half band filter, using NEON when available.
+ * It implements the audio_utils resampler interface and can be used in
+ * place of it, but must be released with release_rate_converter().
+ */
+
+/* Function prototypes */
+bool rate_converter_supported(uint32_t in_rate, uint32_t out_rate,
+                              uint32_t channels);
+
+int create_rate_converter(uint32_t in_rate, uint32_t out_rate,
+                          uint32_t channels,
+                          struct resampler_buffer_provider *provider,
+                          struct resampler_itfe **resampler);
+
+void release_rate_converter(struct resampler_itfe *resampler);
+
+#endif
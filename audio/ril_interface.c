@@ -18,7 +18,10 @@
 /*#define LOG_NDEBUG 0*/
 
 #include <dlfcn.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include <utils/Log.h>
 #include <cutils/properties.h>
@@ -28,14 +31,111 @@
 #define VOLUME_STEPS_DEFAULT  "5"
 #define VOLUME_STEPS_PROPERTY "ro.config.vc_call_vol_steps"
 
-/* Audio WB AMR callback */
-void (*_audio_set_wb_amr_callback)(void *, int);
-void *callback_data = NULL;
+#define CONNECT_BACKOFF_MIN_MS 100
+#define CONNECT_BACKOFF_MAX_MS 5000
 
-void ril_register_set_wb_amr_callback(void *function, void *data)
+/*
+ * In-call volume curves, the share of the modem steps used at a given
+ * volume. Points are linearly interpolated into ril_handle.volume_lut
+ * once the number of modem steps is known.
+ */
+struct volume_point {
+    float volume;
+    float level;
+};
+
+#define VOLUME_CURVE_POINTS 5
+
+static const struct volume_point volume_curves[SOUND_TYPE_CNT][VOLUME_CURVE_POINTS] = {
+    /* earpiece */
+    [SOUND_TYPE_VOICE]   = { {0.0f, 0.0f}, {0.25f, 0.20f}, {0.50f, 0.45f},
+                             {0.75f, 0.72f}, {1.0f, 1.0f} },
+    /* speaker, lifted at the bottom where the room noise masks it */
+    [SOUND_TYPE_SPEAKER] = { {0.0f, 0.0f}, {0.25f, 0.35f}, {0.50f, 0.60f},
+                             {0.75f, 0.82f}, {1.0f, 1.0f} },
+    /* headset, fine steps at the bottom, the capsule sits in the ear */
+    [SOUND_TYPE_HEADSET] = { {0.0f, 0.0f}, {0.25f, 0.12f}, {0.50f, 0.32f},
+                             {0.75f, 0.60f}, {1.0f, 1.0f} },
+    /* bluetooth, the headset applies its own volume on top */
+    [SOUND_TYPE_BTVOICE] = { {0.0f, 0.0f}, {0.25f, 0.25f}, {0.50f, 0.50f},
+                             {0.75f, 0.75f}, {1.0f, 1.0f} },
+};
+
+/* Unsolicited event functions */
+
+/* secril-client handlers get no context, the HAL has a single handle */
+static struct ril_handle *event_ril = NULL;
+
+/*
+ * Bounded multi producer queue, each slot carries a sequence number telling
+ * whether it is free for the position being written or holds the one being
+ * read. Producers never block, a full queue drops the event.
+ */
+static void ril_event_queue_init(struct ril_handle *ril)
+{
+    unsigned int i;
+
+    for (i = 0; i < RIL_EVENT_QUEUE_SIZE; i++)
+        atomic_init(&ril->events[i].seq, i);
+    atomic_init(&ril->event_enqueue_pos, 0);
+    ril->event_dequeue_pos = 0;
+    atomic_init(&ril->events_dropped, 0);
+}
+
+/* Called from secril-client threads, must not block */
+static void ril_event_push(struct ril_handle *ril, enum ril_event event,
+                           int value)
 {
-    _audio_set_wb_amr_callback = function;
-    callback_data = data;
+    struct ril_event_slot *slot;
+    unsigned int pos, seq;
+    int diff;
+
+    pos = atomic_load_explicit(&ril->event_enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        slot = &ril->events[pos % RIL_EVENT_QUEUE_SIZE];
+        seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        diff = (int)(seq - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ril->event_enqueue_pos,
+                                                      &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            atomic_fetch_add_explicit(&ril->events_dropped, 1,
+                                      memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&ril->event_enqueue_pos,
+                                       memory_order_relaxed);
+        }
+    }
+
+    slot->event = event;
+    slot->value = value;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    sem_post(&ril->event_sem);
+}
+
+/* Called from the event thread only */
+static bool ril_event_pop(struct ril_handle *ril, enum ril_event *event,
+                          int *value)
+{
+    unsigned int pos = ril->event_dequeue_pos;
+    struct ril_event_slot *slot = &ril->events[pos % RIL_EVENT_QUEUE_SIZE];
+    unsigned int seq;
+
+    seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    if ((int)(seq - (pos + 1)) < 0)
+        return false;
+
+    *event = slot->event;
+    *value = slot->value;
+    atomic_store_explicit(&slot->seq, pos + RIL_EVENT_QUEUE_SIZE,
+                          memory_order_release);
+    ril->event_dequeue_pos = pos + 1;
+
+    return true;
 }
 
 /* This is the callback function that the RIL uses to
@@ -44,17 +144,107 @@ static int ril_set_wb_amr_callback(void *ril_client __unused,
                                    const void *data,
                                    size_t datalen)
 {
-    int enable = ((int *)data)[0];
+    if (event_ril == NULL || data == NULL || datalen < sizeof(int)) {
+        return -1;
+    }
+
+    ril_event_push(event_ril, RIL_EVENT_WB_AMR, ((int *)data)[0]);
 
-    if (callback_data == NULL || _audio_set_wb_amr_callback == NULL) {
+    return 0;
+}
+
+static int ril_clock_ctrl_callback(void *ril_client __unused,
+                                   const void *data,
+                                   size_t datalen)
+{
+    if (event_ril == NULL || data == NULL || datalen < 1) {
         return -1;
     }
 
-    _audio_set_wb_amr_callback(callback_data, enable);
+    ril_event_push(event_ril, RIL_EVENT_CLOCK_CTRL, ((char *)data)[0]);
 
     return 0;
 }
 
+static int ril_error_callback(void *data, int error)
+{
+    if (event_ril == NULL || event_ril != data) {
+        return -1;
+    }
+
+    ril_event_push(event_ril, RIL_EVENT_ERROR, error);
+
+    return 0;
+}
+
+/*
+ * Hands events to the subscribers, outside of the secril-client threads so
+ * those never wait for audio locks.
+ */
+static void *ril_event_thread_loop(void *context)
+{
+    struct ril_handle *ril = (struct ril_handle *)context;
+    struct ril_subscriber subscribers[RIL_SUBSCRIBERS_MAX];
+    unsigned int count, i;
+    enum ril_event event;
+    int value;
+
+    for (;;) {
+        sem_wait(&ril->event_sem);
+        if (atomic_load(&ril->event_exit))
+            break;
+
+        while (ril_event_pop(ril, &event, &value)) {
+            ALOGV("%s: event %d (%d)", __func__, event, value);
+
+            pthread_mutex_lock(&ril->lock);
+            ril->stats.events++;
+            /* the queue thread reconnects and replays the state */
+            if (event == RIL_EVENT_ERROR) {
+                ril->conn_state = RIL_CONN_DISCONNECTED;
+                ril->retry_ms = 0;
+                pthread_cond_broadcast(&ril->cond);
+            }
+            count = ril->subscriber_count;
+            memcpy(subscribers, ril->subscribers,
+                   count * sizeof(struct ril_subscriber));
+            pthread_mutex_unlock(&ril->lock);
+
+            for (i = 0; i < count; i++) {
+                if (subscribers[i].event == event)
+                    subscribers[i].callback(subscribers[i].data, event, value);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+int ril_subscribe(struct ril_handle *ril, enum ril_event event,
+                  ril_event_callback callback, void *data)
+{
+    int ret = 0;
+
+    if (ril == NULL || callback == NULL || event >= RIL_EVENT_CNT) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&ril->lock);
+    if (ril->subscriber_count < RIL_SUBSCRIBERS_MAX) {
+        ril->subscribers[ril->subscriber_count].event = event;
+        ril->subscribers[ril->subscriber_count].callback = callback;
+        ril->subscribers[ril->subscriber_count].data = data;
+        ril->subscriber_count++;
+    } else {
+        ALOGE("%s: too many subscribers", __func__);
+        ret = -1;
+    }
+    pthread_mutex_unlock(&ril->lock);
+
+    return ret;
+}
+
+/* Called from the queue thread without the queue lock */
 static int ril_connect_if_required(struct ril_handle *ril)
 {
     int ok;
@@ -74,24 +264,502 @@ static int ril_connect_if_required(struct ril_handle *ril)
     return 0;
 }
 
+static void ril_init_volume_curves(struct ril_handle *ril)
+{
+    const struct volume_point *p;
+    float volume, level;
+    int type, i, k;
+
+    for (type = 0; type < SOUND_TYPE_CNT; type++) {
+        p = volume_curves[type];
+        k = 0;
+        for (i = 0; i < VOLUME_LUT_SIZE; i++) {
+            volume = (float)i / (VOLUME_LUT_SIZE - 1);
+            while (k < VOLUME_CURVE_POINTS - 2 && volume > p[k + 1].volume)
+                k++;
+            level = p[k].level + (volume - p[k].volume) *
+                    (p[k + 1].level - p[k].level) /
+                    (p[k + 1].volume - p[k].volume);
+            ril->volume_lut[type][i] =
+                    (unsigned char)(level * ril->volume_steps_max + 0.5f);
+        }
+    }
+}
+
+/* Command queue functions */
+
+/*
+ * Last acknowledged value of each setting. Clock sync is an event rather
+ * than a state and always goes out. Called with the queue lock held.
+ */
+static bool ril_cache_hit(struct ril_handle *ril, const struct ril_cmd *cmd)
+{
+    const struct ril_cmd *last = &ril->last[cmd->type];
+
+    return cmd->type != RIL_CMD_CALL_CLOCK_SYNC &&
+           ril->last_valid[cmd->type] &&
+           last->arg == cmd->arg && last->arg2 == cmd->arg2;
+}
+
+/* Called with the queue lock held */
+static void ril_cache_update(struct ril_handle *ril, const struct ril_cmd *cmd,
+                             int rc)
+{
+    if (rc != 0) {
+        ril->last_valid[cmd->type] = false;
+        return;
+    }
+
+    if (cmd->type == RIL_CMD_CALL_CLOCK_SYNC) {
+        /* the modem drops the call volume and path with the call */
+        if (cmd->arg == SOUND_CLOCK_STOP) {
+            ril->last_valid[RIL_CMD_CALL_VOLUME] = false;
+            ril->last_valid[RIL_CMD_CALL_AUDIO_PATH] = false;
+        }
+        return;
+    }
+
+    ril->last[cmd->type] = *cmd;
+    ril->last_valid[cmd->type] = true;
+}
+
+/* Sends one command, called from the queue thread without the queue lock */
+static int ril_send_cmd(struct ril_handle *ril, const struct ril_cmd *cmd)
+{
+    int rc;
+
+    switch (cmd->type) {
+    case RIL_CMD_CALL_VOLUME:
+        rc = SetCallVolume(ril->client, cmd->arg, cmd->arg2);
+        break;
+    case RIL_CMD_CALL_AUDIO_PATH:
+        rc = SetCallAudioPath(ril->client, cmd->arg);
+        break;
+    case RIL_CMD_CALL_CLOCK_SYNC:
+        rc = SetCallClockSync(ril->client, cmd->arg);
+        break;
+    case RIL_CMD_MUTE:
+        rc = SetMute(ril->client, cmd->arg);
+        break;
+    case RIL_CMD_TWO_MIC_CONTROL:
+        rc = SetTwoMicControl(ril->client, cmd->arg, cmd->arg2);
+        break;
+    default:
+        rc = -1;
+        break;
+    }
+
+    return rc;
+}
+
+/* Connection manager functions */
+
+static uint64_t ril_time_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Puts a command in front of the queue. Called with the queue lock held */
+static void ril_push_front(struct ril_handle *ril, const struct ril_cmd *cmd)
+{
+    ril->queue_head = (ril->queue_head + RIL_QUEUE_SIZE - 1) % RIL_QUEUE_SIZE;
+    ril->queue[ril->queue_head] = *cmd;
+    ril->queue_count++;
+}
+
+/* Called with the queue lock held */
+static bool ril_has_deferred(struct ril_handle *ril)
+{
+    int type;
+
+    for (type = 0; type < RIL_CMD_CNT; type++) {
+        if (ril->deferred[type])
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * Takes the next deferred setting, with the last value posted for it.
+ * Called with the queue lock held.
+ */
+static bool ril_pop_deferred(struct ril_handle *ril, struct ril_cmd *cmd)
+{
+    int type;
+
+    for (type = 0; type < RIL_CMD_CNT; type++) {
+        if (ril->deferred[type]) {
+            ril->deferred[type] = false;
+            *cmd = ril->desired[type];
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Whether a setting was ever posted. Called with the queue lock held */
+static bool ril_has_state(struct ril_handle *ril)
+{
+    int type;
+
+    for (type = 0; type < RIL_CMD_CNT; type++) {
+        if (type != RIL_CMD_CALL_CLOCK_SYNC && ril->desired_valid[type])
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * rild may have restarted, nothing the modem acknowledged before can be
+ * trusted. The last value posted for each setting goes out again first,
+ * unless a newer one is still queued. Clock sync is an event and is not
+ * replayed. Called with the queue lock held.
+ */
+static void ril_replay_state(struct ril_handle *ril)
+{
+    unsigned int i;
+    int type;
+
+    for (type = RIL_CMD_CNT - 1; type >= 0; type--) {
+        ril->last_valid[type] = false;
+        if (type == RIL_CMD_CALL_CLOCK_SYNC || !ril->desired_valid[type] ||
+                ril->deferred[type])
+            continue;
+
+        for (i = 0; i < ril->queue_count; i++) {
+            if (ril->queue[(ril->queue_head + i) % RIL_QUEUE_SIZE].type ==
+                    (enum ril_cmd_type)type)
+                break;
+        }
+        if (i < ril->queue_count)
+            continue;
+
+        if (ril->queue_count == RIL_QUEUE_SIZE) {
+            ril->deferred[type] = true;
+            continue;
+        }
+
+        ril_push_front(ril, &ril->desired[type]);
+        ril->stats.replayed++;
+    }
+}
+
+/*
+ * Connects with exponential backoff while commands are waiting. Returns
+ * true once connected. Called with the queue lock held, which is dropped
+ * around the attempt.
+ */
+static bool ril_wait_connected(struct ril_handle *ril)
+{
+    struct timespec ts;
+    uint64_t now;
+    int rc;
+
+    while (ril->conn_state != RIL_CONN_CONNECTED) {
+        if (ril->exit)
+            return false;
+
+        now = ril_time_ms();
+        if (now < ril->retry_ms) {
+            ts.tv_sec = ril->retry_ms / 1000;
+            ts.tv_nsec = (ril->retry_ms % 1000) * 1000000;
+            pthread_cond_timedwait(&ril->cond, &ril->lock, &ts);
+            continue;
+        }
+
+        pthread_mutex_unlock(&ril->lock);
+        rc = ril_connect_if_required(ril);
+        pthread_mutex_lock(&ril->lock);
+
+        if (rc == 0) {
+            ALOGV("%s: connected to rild", __func__);
+            ril->conn_state = RIL_CONN_CONNECTED;
+            ril->backoff_ms = 0;
+            ril->stats.connects++;
+            ril_replay_state(ril);
+            break;
+        }
+
+        ril->backoff_ms = ril->backoff_ms ? ril->backoff_ms * 2 :
+                                            CONNECT_BACKOFF_MIN_MS;
+        if (ril->backoff_ms > CONNECT_BACKOFF_MAX_MS)
+            ril->backoff_ms = CONNECT_BACKOFF_MAX_MS;
+        ril->retry_ms = ril_time_ms() + ril->backoff_ms;
+        ril->conn_state = RIL_CONN_BACKOFF;
+        ril->stats.connect_failures++;
+        ALOGW("%s: rild not reachable, retrying in %u ms", __func__,
+              ril->backoff_ms);
+    }
+
+    return true;
+}
+
+static void *ril_thread_loop(void *context)
+{
+    struct ril_handle *ril = (struct ril_handle *)context;
+    ril_complete_callback complete;
+    void *complete_data;
+    struct ril_cmd cmd;
+    bool connected;
+    bool hit;
+    int rc;
+
+    pthread_mutex_lock(&ril->lock);
+    for (;;) {
+        while (ril->queue_count == 0 && !ril_has_deferred(ril) && !ril->exit &&
+               (ril->conn_state == RIL_CONN_CONNECTED || !ril_has_state(ril)))
+            pthread_cond_wait(&ril->cond, &ril->lock);
+        if (ril->queue_count == 0 && !ril_has_deferred(ril) && ril->exit)
+            break;
+
+        /*
+         * Commands keep coalescing in the queue while rild is away. A lost
+         * connection is brought back even when idle, to replay the state.
+         */
+        if (!ril_wait_connected(ril))
+            break;
+
+        if (ril->queue_count > 0) {
+            cmd = ril->queue[ril->queue_head];
+            ril->queue_head = (ril->queue_head + 1) % RIL_QUEUE_SIZE;
+            ril->queue_count--;
+        } else if (!ril_pop_deferred(ril, &cmd)) {
+            continue;
+        }
+        hit = ril_cache_hit(ril, &cmd);
+        ril->busy = !hit;
+        complete = ril->complete;
+        complete_data = ril->complete_data;
+        pthread_mutex_unlock(&ril->lock);
+
+        connected = true;
+        if (hit) {
+            rc = 0;
+        } else {
+            rc = ril_send_cmd(ril, &cmd);
+            if (rc != 0)
+                connected = isConnected_RILD(ril->client);
+        }
+        if (complete != NULL) {
+            complete(complete_data, cmd.type, cmd.arg, rc);
+        }
+
+        pthread_mutex_lock(&ril->lock);
+        if (hit) {
+            ril->stats.cache_hits++;
+        } else {
+            ril_cache_update(ril, &cmd, rc);
+            ril->busy = false;
+            ril->stats.sent++;
+            if (cmd.type != RIL_CMD_CALL_CLOCK_SYNC) {
+                ril->stats.cache_misses++;
+            }
+            if (rc != 0) {
+                ril->stats.failed++;
+            }
+        }
+        if (!connected) {
+            ALOGW("%s: lost the connection to rild", __func__);
+            ril->conn_state = RIL_CONN_DISCONNECTED;
+            ril->retry_ms = 0;
+        }
+    }
+    /* anything left could not be sent before close */
+    ril->stats.dropped += ril->queue_count;
+    ril->queue_count = 0;
+    memset(ril->deferred, 0, sizeof(ril->deferred));
+    pthread_mutex_unlock(&ril->lock);
+
+    return NULL;
+}
+
+/*
+ * Queues a command without ever waiting for the modem. A pending command
+ * of the same type is overwritten in place unless a clock sync was queued
+ * after it, so a burst of volume or path changes sends the last value
+ * only. Settings are independent of each other, only clock sync orders
+ * them. Clock sync is never merged, every start and stop reaches the
+ * modem.
+ */
+static int ril_post_cmd(struct ril_handle *ril, enum ril_cmd_type type,
+                        int arg, int arg2)
+{
+    struct ril_cmd *cmd;
+    unsigned int i, n;
+
+    if (ril == NULL || !ril->thread_started) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&ril->lock);
+    ril->stats.posted++;
+    ril->desired[type].type = type;
+    ril->desired[type].arg = arg;
+    ril->desired[type].arg2 = arg2;
+    ril->desired_valid[type] = true;
+
+    /*
+     * With nothing queued or in flight the modem state is known, a value
+     * it already has is dropped right away.
+     */
+    if (ril->queue_count == 0 && !ril->busy && !ril_has_deferred(ril)) {
+        struct ril_cmd new_cmd = { type, arg, arg2 };
+
+        if (ril_cache_hit(ril, &new_cmd)) {
+            ril->stats.cache_hits++;
+            pthread_mutex_unlock(&ril->lock);
+            return 0;
+        }
+    }
+
+    if (type != RIL_CMD_CALL_CLOCK_SYNC) {
+        /* the value goes out from desired once the queue is drained */
+        if (ril->deferred[type]) {
+            ril->stats.coalesced++;
+            pthread_mutex_unlock(&ril->lock);
+            return 0;
+        }
+
+        for (n = ril->queue_count; n > 0; n--) {
+            i = (ril->queue_head + n - 1) % RIL_QUEUE_SIZE;
+            cmd = &ril->queue[i];
+            if (cmd->type == RIL_CMD_CALL_CLOCK_SYNC) {
+                break;
+            }
+            if (cmd->type == type) {
+                cmd->arg = arg;
+                cmd->arg2 = arg2;
+                ril->stats.coalesced++;
+                pthread_mutex_unlock(&ril->lock);
+                return 0;
+            }
+        }
+    }
+
+    /*
+     * Takes clock syncs between settings while the modem is slow or away.
+     * A setting which does not fit is deferred, as is one pushed out by a
+     * clock sync; they still reach the modem, after the queued commands.
+     * Only a clock sync pushed out by another one is lost.
+     */
+    if (ril->queue_count == RIL_QUEUE_SIZE) {
+        ALOGW("%s: RIL command queue full", __func__);
+        ril->stats.dropped++;
+
+        if (type != RIL_CMD_CALL_CLOCK_SYNC) {
+            ril->deferred[type] = true;
+            pthread_cond_broadcast(&ril->cond);
+            pthread_mutex_unlock(&ril->lock);
+            return 0;
+        }
+
+        cmd = &ril->queue[ril->queue_head];
+        if (cmd->type != RIL_CMD_CALL_CLOCK_SYNC)
+            ril->deferred[cmd->type] = true;
+        ril->queue_head = (ril->queue_head + 1) % RIL_QUEUE_SIZE;
+        ril->queue_count--;
+    }
+
+    i = (ril->queue_head + ril->queue_count) % RIL_QUEUE_SIZE;
+    ril->queue[i].type = type;
+    ril->queue[i].arg = arg;
+    ril->queue[i].arg2 = arg2;
+    ril->queue_count++;
+    pthread_cond_broadcast(&ril->cond);
+    pthread_mutex_unlock(&ril->lock);
+
+    return 0;
+}
+
+void ril_register_complete_callback(struct ril_handle *ril,
+                                    ril_complete_callback function,
+                                    void *data)
+{
+    pthread_mutex_lock(&ril->lock);
+    ril->complete = function;
+    ril->complete_data = data;
+    pthread_mutex_unlock(&ril->lock);
+}
+
+const char *ril_conn_state_name(enum ril_conn_state state)
+{
+    switch (state) {
+    case RIL_CONN_DISCONNECTED:
+        return "disconnected";
+    case RIL_CONN_CONNECTED:
+        return "connected";
+    case RIL_CONN_BACKOFF:
+        return "backing off";
+    default:
+        return "unknown";
+    }
+}
+
+void ril_get_stats(struct ril_handle *ril, struct ril_stats *stats)
+{
+    int type;
+
+    pthread_mutex_lock(&ril->lock);
+    *stats = ril->stats;
+    stats->pending = ril->queue_count + ril->busy;
+    for (type = 0; type < RIL_CMD_CNT; type++)
+        stats->pending += ril->deferred[type];
+    stats->conn_state = ril->conn_state;
+    stats->backoff_ms = ril->backoff_ms;
+    stats->events_dropped = atomic_load_explicit(&ril->events_dropped,
+                                                 memory_order_relaxed);
+    pthread_mutex_unlock(&ril->lock);
+}
+
 int ril_open(struct ril_handle *ril)
 {
     char property[PROPERTY_VALUE_MAX];
+    pthread_condattr_t attr;
 
     if (ril == NULL) {
         return -1;
     }
 
+    /* the connect backoff waits for a ril_time_ms() deadline */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+    pthread_mutex_init(&ril->lock, NULL);
+    pthread_cond_init(&ril->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
     ril->client = OpenClient_RILD();
     if (ril->client == NULL) {
         ALOGE("OpenClient_RILD() failed");
         return -1;
     }
 
-    /* register the wideband AMR callback */
+    ril_event_queue_init(ril);
+    sem_init(&ril->event_sem, 0, 0);
+    atomic_init(&ril->event_exit, false);
+    if (pthread_create(&ril->event_thread, NULL, ril_event_thread_loop,
+                       ril) != 0) {
+        ALOGE("%s: failed to start the RIL event thread", __func__);
+        return -1;
+    }
+    ril->event_thread_started = true;
+    event_ril = ril;
+
+    /* register the unsolicited event handlers */
     RegisterUnsolicitedHandler(ril->client,
                                RIL_UNSOL_SNDMGR_WB_AMR_REPORT,
                                (RilOnUnsolicited)ril_set_wb_amr_callback);
+    RegisterUnsolicitedHandler(ril->client,
+                               RIL_UNSOL_SNDMGR_CLOCK_CTRL,
+                               (RilOnUnsolicited)ril_clock_ctrl_callback);
+    RegisterErrorCallback(ril->client, ril_error_callback, ril);
 
     property_get(VOLUME_STEPS_PROPERTY, property, VOLUME_STEPS_DEFAULT);
     ril->volume_steps_max = atoi(property);
@@ -103,6 +771,17 @@ int ril_open(struct ril_handle *ril)
     if (ril->volume_steps_max == 0) {
         ril->volume_steps_max = atoi(VOLUME_STEPS_DEFAULT);
     }
+    if (ril->volume_steps_max > UCHAR_MAX) {
+        ril->volume_steps_max = UCHAR_MAX;
+    }
+
+    ril_init_volume_curves(ril);
+
+    if (pthread_create(&ril->thread, NULL, ril_thread_loop, ril) != 0) {
+        ALOGE("%s: failed to start the RIL command thread", __func__);
+        return -1;
+    }
+    ril->thread_started = true;
 
     return 0;
 }
@@ -115,6 +794,26 @@ int ril_close(struct ril_handle *ril)
         return -1;
     }
 
+    /* late secril-client callbacks find no handle and are ignored */
+    event_ril = NULL;
+    if (ril->event_thread_started) {
+        atomic_store(&ril->event_exit, true);
+        sem_post(&ril->event_sem);
+        pthread_join(ril->event_thread, NULL);
+        ril->event_thread_started = false;
+        sem_destroy(&ril->event_sem);
+    }
+
+    /* the queue is drained before the thread exits */
+    if (ril->thread_started) {
+        pthread_mutex_lock(&ril->lock);
+        ril->exit = true;
+        pthread_cond_broadcast(&ril->cond);
+        pthread_mutex_unlock(&ril->lock);
+        pthread_join(ril->thread, NULL);
+        ril->thread_started = false;
+    }
+
     rc = Disconnect_RILD(ril->client);
     if (rc != RIL_CLIENT_ERR_SUCCESS) {
         ALOGE("Disconnect_RILD failed");
@@ -134,75 +833,42 @@ int ril_set_call_volume(struct ril_handle *ril,
                         enum _SoundType sound_type,
                         float volume)
 {
-    int rc;
+    int step;
 
-    rc = ril_connect_if_required(ril);
-    if (rc != 0) {
-        return 0;
+    if (sound_type >= SOUND_TYPE_CNT) {
+        sound_type = SOUND_TYPE_VOICE;
+    }
+    if (volume < 0.0f) {
+        volume = 0.0f;
+    } else if (volume > 1.0f) {
+        volume = 1.0f;
     }
 
-    rc = SetCallVolume(ril->client,
-                       sound_type,
-                       (int)(volume * ril->volume_steps_max));
+    step = ril->volume_lut[sound_type]
+                          [(int)(volume * (VOLUME_LUT_SIZE - 1) + 0.5f)];
 
-    return rc;
+    return ril_post_cmd(ril, RIL_CMD_CALL_VOLUME, sound_type, step);
 }
 
 int ril_set_call_audio_path(struct ril_handle *ril, enum _AudioPath path)
 {
-    int rc;
-
-    rc = ril_connect_if_required(ril);
-    if (rc != 0) {
-        return 0;
-    }
-
-    rc = SetCallAudioPath(ril->client, path);
-
-    return rc;
+    return ril_post_cmd(ril, RIL_CMD_CALL_AUDIO_PATH, path, 0);
 }
 
 int ril_set_call_clock_sync(struct ril_handle *ril,
                             enum _SoundClockCondition condition)
 {
-    int rc;
-
-    rc = ril_connect_if_required(ril);
-    if (rc != 0) {
-        return 0;
-    }
-
-    rc = SetCallClockSync(ril->client, condition);
-
-    return rc;
+    return ril_post_cmd(ril, RIL_CMD_CALL_CLOCK_SYNC, condition, 0);
 }
 
 int ril_set_mute(struct ril_handle *ril, enum _MuteCondition condition)
 {
-    int rc;
-
-    rc = ril_connect_if_required(ril);
-    if (rc != 0) {
-        return 0;
-    }
-
-    rc = SetMute(ril->client, condition);
-
-    return rc;
+    return ril_post_cmd(ril, RIL_CMD_MUTE, condition, 0);
 }
 
 int ril_set_two_mic_control(struct ril_handle *ril,
                             enum __TwoMicSolDevice device,
                             enum __TwoMicSolReport report)
 {
-    int rc;
-
-    rc = ril_connect_if_required(ril);
-    if (rc != 0) {
-        return 0;
-    }
-
-    rc = SetTwoMicControl(ril->client, device, report);
-
-    return rc;
+    return ril_post_cmd(ril, RIL_CMD_TWO_MIC_CONTROL, device, report);
 }
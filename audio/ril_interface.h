@@ -17,13 +17,131 @@
 #ifndef RIL_INTERFACE_H
 #define RIL_INTERFACE_H
 
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
 #include <telephony/ril.h>
 #include "secril-client.h"
 
+#define SOUND_TYPE_CNT  (SOUND_TYPE_BTVOICE + 1)
+#define VOLUME_LUT_SIZE 101     /* one entry per percent of the volume */
+#define RIL_QUEUE_SIZE  16
+#define RIL_EVENT_QUEUE_SIZE 32
+#define RIL_SUBSCRIBERS_MAX  8
+
+enum ril_cmd_type {
+    RIL_CMD_CALL_VOLUME,
+    RIL_CMD_CALL_AUDIO_PATH,
+    RIL_CMD_CALL_CLOCK_SYNC,
+    RIL_CMD_MUTE,
+    RIL_CMD_TWO_MIC_CONTROL,
+    RIL_CMD_CNT
+};
+
+struct ril_cmd {
+    enum ril_cmd_type type;
+    int arg;
+    int arg2;
+};
+
+/* unsolicited events, delivered on the RIL event thread */
+enum ril_event {
+    RIL_EVENT_WB_AMR,       /* value: 1 when the call uses wide band AMR */
+    RIL_EVENT_CLOCK_CTRL,   /* value: modem clock state */
+    RIL_EVENT_ERROR,        /* value: secril-client error, rild went away */
+    RIL_EVENT_CNT
+};
+
+typedef void (*ril_event_callback)(void *data, enum ril_event event,
+                                   int value);
+
+struct ril_subscriber {
+    enum ril_event event;
+    ril_event_callback callback;
+    void *data;
+};
+
+struct ril_event_slot {
+    atomic_uint seq;
+    enum ril_event event;
+    int value;
+};
+
+enum ril_conn_state {
+    RIL_CONN_DISCONNECTED,
+    RIL_CONN_CONNECTED,
+    RIL_CONN_BACKOFF,       /* waiting before the next connect attempt */
+};
+
+/* called from the RIL command thread once a command reached the modem */
+typedef void (*ril_complete_callback)(void *data, enum ril_cmd_type type,
+                                      int arg, int rc);
+
+struct ril_stats {
+    unsigned int posted;
+    unsigned int coalesced;
+    unsigned int sent;
+    unsigned int failed;
+    unsigned int cache_hits;        /* commands matching the modem state */
+    unsigned int cache_misses;
+    unsigned int pending;           /* queued, deferred or being sent */
+    unsigned int dropped;           /* queued commands lost, see deferred */
+    unsigned int replayed;          /* settings sent again after a connect */
+    unsigned int connects;
+    unsigned int connect_failures;
+    enum ril_conn_state conn_state;
+    unsigned int backoff_ms;
+    unsigned int events;
+    unsigned int events_dropped;
+};
+
 struct ril_handle
 {
     void *client;
     int volume_steps_max;
+    /* modem volume step for each sound type and percent of the volume */
+    unsigned char volume_lut[SOUND_TYPE_CNT][VOLUME_LUT_SIZE];
+
+    /* command queue, the modem is only called from the queue thread */
+    pthread_t thread;
+    bool thread_started;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct ril_cmd queue[RIL_QUEUE_SIZE];
+    unsigned int queue_head;
+    unsigned int queue_count;
+    bool exit;
+    bool busy;                      /* a command is being sent */
+    /* last value the modem acknowledged for each command type */
+    struct ril_cmd last[RIL_CMD_CNT];
+    bool last_valid[RIL_CMD_CNT];
+    /* last value posted for each command type, replayed on connect */
+    struct ril_cmd desired[RIL_CMD_CNT];
+    bool desired_valid[RIL_CMD_CNT];
+    /* settings which did not fit the queue, sent from desired once empty */
+    bool deferred[RIL_CMD_CNT];
+    /* connection to rild, only ever attempted from the queue thread */
+    enum ril_conn_state conn_state;
+    unsigned int backoff_ms;
+    uint64_t retry_ms;
+    ril_complete_callback complete;
+    void *complete_data;
+    struct ril_stats stats;
+
+    /* unsolicited events, queued without locks from secril-client threads */
+    struct ril_event_slot events[RIL_EVENT_QUEUE_SIZE];
+    atomic_uint event_enqueue_pos;
+    unsigned int event_dequeue_pos;
+    atomic_uint events_dropped;
+    sem_t event_sem;
+    atomic_bool event_exit;
+    pthread_t event_thread;
+    bool event_thread_started;
+    struct ril_subscriber subscribers[RIL_SUBSCRIBERS_MAX];
+    unsigned int subscriber_count;
 };
 
 
@@ -48,6 +166,15 @@ int ril_set_two_mic_control(struct ril_handle *ril,
                             enum __TwoMicSolDevice device,
                             enum __TwoMicSolReport report);
 
-void ril_register_set_wb_amr_callback(void *function, void *data);
+int ril_subscribe(struct ril_handle *ril, enum ril_event event,
+                  ril_event_callback callback, void *data);
+
+void ril_register_complete_callback(struct ril_handle *ril,
+                                    ril_complete_callback function,
+                                    void *data);
+
+const char *ril_conn_state_name(enum ril_conn_state state);
+
+void ril_get_stats(struct ril_handle *ril, struct ril_stats *stats);
 
 #endif
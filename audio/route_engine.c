@@ -0,0 +1,1603 @@
+/*
+ * Copyright (C) 2015 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_primary"
+/*#define LOG_NDEBUG 0*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <utils/Log.h>
+
+#include <expat.h>
+#include <tinyalsa/asoundlib.h>
+
+#include "route_engine.h"
+
+#define BUF_SIZE 1024
+
+#define ROUTE_DB_MAGIC   0x42445452 /* "RTDB" */
+#define ROUTE_DB_VERSION 2
+
+#define MAX_GAIN_DEVICES 8
+
+#define RAMP_STEPS       8  /* per direction */
+#define MAX_RAMP_CTLS    8
+#define MAX_RAMP_VALUES  2
+
+/* A mixer control referenced by mixer_paths.xml */
+struct route_ctl {
+    uint32_t mixer_index;   /* control index on the mixer */
+    uint32_t type;          /* enum mixer_ctl_type */
+    uint32_t num_values;
+    uint32_t offset;        /* first slot in the value vectors */
+};
+
+/* One <ctl> of a path, included paths are expanded in place */
+struct route_setting {
+    uint32_t ctl;
+    int32_t id;             /* value index, -1 for all values */
+    int32_t value;
+};
+
+struct route_path {
+    uint32_t name;          /* offset in the name table */
+    uint32_t first_setting;
+    uint32_t num_settings;
+};
+
+/*
+ * Header of the compiled route database. The control, setting, path and
+ * name tables follow in this order, exactly as the engine uses them, so a
+ * valid file is used in place from its mapping.
+ */
+struct route_db_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t mixer_hash;    /* control names, types, sizes and enum strings */
+    uint32_t xml_size;
+    uint64_t xml_mtime;
+    uint32_t gain_size;
+    uint32_t reserved;
+    uint64_t gain_mtime;
+    uint32_t num_ctls;
+    uint32_t num_slots;
+    uint32_t num_init_settings;
+    uint32_t num_settings;
+    uint32_t num_paths;
+    uint32_t names_len;
+};
+
+struct route_engine {
+    struct mixer *mixer;
+
+    void *db_map;           /* tables below point in here when not NULL */
+    size_t db_size;
+
+    struct route_ctl *ctls;
+    struct mixer_ctl **mixer_ctls;
+    unsigned int num_ctls;
+    unsigned int ctls_size;
+
+    unsigned int num_slots;
+    unsigned int slots_size;
+    int32_t *init_values;   /* hardware at startup plus top level <ctl>s */
+    int32_t *hw_values;     /* what the hardware currently holds */
+    int32_t *target;        /* scratch vector for transitions */
+    int32_t *build_values;  /* scratch vector of route_engine_build() */
+    uint8_t *touched;       /* slots set by route_engine_build() paths */
+
+    void *io_buf;           /* scratch for mixer_ctl_[gs]et_array() */
+    size_t io_buf_size;
+
+    struct route_setting *init_settings;    /* top level <ctl>s */
+    unsigned int num_init_settings;
+    unsigned int init_settings_size;
+
+    struct route_setting *settings;
+    unsigned int num_settings;
+    unsigned int settings_size;
+
+    struct route_path *paths;
+    unsigned int num_paths;
+    unsigned int paths_size;
+
+    char *names;
+    unsigned int names_len;
+    unsigned int names_size;
+
+    /* digital volumes ramped down and up around path switches */
+    unsigned int *ramp_ctls;
+    int32_t *ramp_min;
+    unsigned int num_ramp_ctls;
+    uint8_t *is_ramp_ctl;   /* indexed by control */
+    unsigned int ramp_time_us;
+
+    struct route_stats stats;
+};
+
+struct mixer_ctl_name {
+    const char *name;
+    unsigned int index;
+};
+
+struct parser_state {
+    struct route_engine *re;
+    struct mixer_ctl_name *sorted;  /* mixer controls sorted by name */
+    unsigned int num_sorted;
+    int *ctl_map;                   /* mixer index -> route_ctl, or -1 */
+    int path;                       /* path being defined, -1 at top level */
+    int level;
+    bool skip;                      /* inside a path which failed to parse */
+
+    /* default_gain.conf */
+    const char *pos;
+    char token[256];
+    struct route_setting *gains;    /* settings of the current modifier */
+    unsigned int num_gains;
+    unsigned int gains_size;
+};
+
+enum gain_token {
+    TOKEN_END,
+    TOKEN_OPEN,
+    TOKEN_CLOSE,
+    TOKEN_STRING,
+    TOKEN_WORD,
+};
+
+static int grow(void **array, unsigned int *size, unsigned int needed,
+                size_t elem_size)
+{
+    unsigned int new_size;
+    void *p;
+
+    if (needed <= *size)
+        return 0;
+
+    new_size = *size ? *size * 2 : 32;
+    while (new_size < needed)
+        new_size *= 2;
+
+    p = realloc(*array, new_size * elem_size);
+    if (p == NULL)
+        return -ENOMEM;
+
+    *array = p;
+    *size = new_size;
+
+    return 0;
+}
+
+static int io_buf_reserve(struct route_engine *re, size_t size)
+{
+    void *p;
+
+    if (size <= re->io_buf_size)
+        return 0;
+
+    p = realloc(re->io_buf, size);
+    if (p == NULL)
+        return -ENOMEM;
+
+    re->io_buf = p;
+    re->io_buf_size = size;
+
+    return 0;
+}
+
+/* The control arrays are indexed alike and grow together */
+static int reserve_ctls(struct route_engine *re, unsigned int needed)
+{
+    unsigned int size = re->ctls_size;
+    void *p;
+
+    if (grow((void **)&re->ctls, &size, needed, sizeof(struct route_ctl)) < 0)
+        return -ENOMEM;
+
+    p = realloc(re->mixer_ctls, size * sizeof(struct mixer_ctl *));
+    if (p == NULL)
+        return -ENOMEM;
+
+    re->mixer_ctls = p;
+    re->ctls_size = size;
+
+    return 0;
+}
+
+/* The value vectors are indexed alike and grow together */
+static int reserve_slots(struct route_engine *re, unsigned int needed)
+{
+    unsigned int size = re->slots_size;
+    void *p;
+
+    if (grow((void **)&re->init_values, &size, needed, sizeof(int32_t)) < 0)
+        return -ENOMEM;
+
+    p = realloc(re->hw_values, size * sizeof(int32_t));
+    if (p == NULL)
+        return -ENOMEM;
+    re->hw_values = p;
+
+    p = realloc(re->target, size * sizeof(int32_t));
+    if (p == NULL)
+        return -ENOMEM;
+    re->target = p;
+
+    p = realloc(re->build_values, size * sizeof(int32_t));
+    if (p == NULL)
+        return -ENOMEM;
+    re->build_values = p;
+
+    p = realloc(re->touched, size);
+    if (p == NULL)
+        return -ENOMEM;
+    re->touched = p;
+
+    re->slots_size = size;
+
+    return 0;
+}
+
+/* Reads the current hardware value of a control, returns the ioctls used */
+static unsigned int read_ctl(struct route_engine *re, unsigned int i,
+                             int32_t *values)
+{
+    struct mixer_ctl *ctl = re->mixer_ctls[i];
+    unsigned int n = re->ctls[i].num_values;
+    unsigned int j;
+
+    switch (re->ctls[i].type) {
+    case MIXER_CTL_TYPE_BOOL:
+    case MIXER_CTL_TYPE_INT: {
+        long *buf = re->io_buf;
+
+        mixer_ctl_get_array(ctl, buf, n);
+        for (j = 0; j < n; j++)
+            values[j] = buf[j];
+        return 1;
+    }
+    case MIXER_CTL_TYPE_BYTE: {
+        uint8_t *buf = re->io_buf;
+
+        mixer_ctl_get_array(ctl, buf, n);
+        for (j = 0; j < n; j++)
+            values[j] = buf[j];
+        return 1;
+    }
+    default:
+        for (j = 0; j < n; j++)
+            values[j] = mixer_ctl_get_value(ctl, j);
+        return n;
+    }
+}
+
+/* Writes a complete control, returns the ioctls used */
+static unsigned int write_ctl(struct route_engine *re, unsigned int i,
+                              const int32_t *values)
+{
+    struct mixer_ctl *ctl = re->mixer_ctls[i];
+    unsigned int offset = re->ctls[i].offset;
+    unsigned int n = re->ctls[i].num_values;
+    unsigned int ioctls = 0;
+    unsigned int j;
+    int rc = 0;
+
+    switch (re->ctls[i].type) {
+    case MIXER_CTL_TYPE_BOOL:
+    case MIXER_CTL_TYPE_INT: {
+        long *buf = re->io_buf;
+
+        for (j = 0; j < n; j++)
+            buf[j] = values[j];
+        rc = mixer_ctl_set_array(ctl, buf, n);
+        ioctls = 1;
+        break;
+    }
+    case MIXER_CTL_TYPE_BYTE: {
+        uint8_t *buf = re->io_buf;
+
+        for (j = 0; j < n; j++)
+            buf[j] = values[j];
+        rc = mixer_ctl_set_array(ctl, buf, n);
+        ioctls = 1;
+        break;
+    }
+    default:
+        /* enums can only be written one value at a time (read + write) */
+        for (j = 0; j < n; j++) {
+            if (values[j] == re->hw_values[offset + j])
+                continue;
+            rc = mixer_ctl_set_value(ctl, j, values[j]);
+            ioctls += 2;
+            if (rc != 0)
+                break;
+        }
+        break;
+    }
+
+    if (rc != 0)
+        ALOGE("%s: failed to set %s: %d", __func__, mixer_ctl_get_name(ctl), rc);
+
+    return ioctls;
+}
+
+static int find_path(struct route_engine *re, const char *name)
+{
+    unsigned int i;
+
+    for (i = 0; i < re->num_paths; i++) {
+        if (strcmp(re->names + re->paths[i].name, name) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+static int compare_ctl_names(const void *a, const void *b)
+{
+    return strcmp(((const struct mixer_ctl_name *)a)->name,
+                  ((const struct mixer_ctl_name *)b)->name);
+}
+
+/* Returns the route_ctl for a control name, registering it on first use */
+static int get_ctl(struct parser_state *state, const char *name)
+{
+    struct route_engine *re = state->re;
+    struct mixer_ctl_name key = { name, 0 };
+    struct mixer_ctl_name *found;
+    struct mixer_ctl *ctl;
+    struct route_ctl *rc;
+    unsigned int type, n;
+    int i;
+
+    found = bsearch(&key, state->sorted, state->num_sorted,
+                    sizeof(struct mixer_ctl_name), compare_ctl_names);
+    if (found == NULL) {
+        ALOGE("%s: control '%s' does not exist", __func__, name);
+        return -1;
+    }
+
+    if (state->ctl_map[found->index] >= 0)
+        return state->ctl_map[found->index];
+
+    ctl = mixer_get_ctl(re->mixer, found->index);
+    type = mixer_ctl_get_type(ctl);
+    n = mixer_ctl_get_num_values(ctl);
+
+    if (type != MIXER_CTL_TYPE_BOOL && type != MIXER_CTL_TYPE_INT &&
+            type != MIXER_CTL_TYPE_ENUM && type != MIXER_CTL_TYPE_BYTE) {
+        ALOGE("%s: control '%s' has unsupported type %u", __func__, name, type);
+        return -1;
+    }
+
+    if (reserve_ctls(re, re->num_ctls + 1) < 0 ||
+            reserve_slots(re, re->num_slots + n) < 0 ||
+            io_buf_reserve(re, n * sizeof(long)) < 0)
+        return -1;
+
+    i = re->num_ctls++;
+    rc = &re->ctls[i];
+    rc->mixer_index = found->index;
+    rc->type = type;
+    rc->num_values = n;
+    rc->offset = re->num_slots;
+    re->mixer_ctls[i] = ctl;
+    re->num_slots += n;
+
+    state->ctl_map[found->index] = i;
+
+    return i;
+}
+
+static int parse_value(struct route_engine *re, unsigned int i,
+                       const char *value, int32_t *out)
+{
+    struct mixer_ctl *ctl = re->mixer_ctls[i];
+    unsigned int j, num_enums;
+
+    if (re->ctls[i].type != MIXER_CTL_TYPE_ENUM) {
+        *out = strtol(value, NULL, 0);
+        return 0;
+    }
+
+    num_enums = mixer_ctl_get_num_enums(ctl);
+    for (j = 0; j < num_enums; j++) {
+        if (strcmp(mixer_ctl_get_enum_string(ctl, j), value) == 0) {
+            *out = j;
+            return 0;
+        }
+    }
+
+    ALOGE("%s: '%s' is not a valid value for '%s'", __func__, value,
+          mixer_ctl_get_name(ctl));
+
+    return -1;
+}
+
+static void apply_setting(struct route_engine *re, int32_t *values,
+                          uint8_t *touched, const struct route_setting *s)
+{
+    const struct route_ctl *ctl = &re->ctls[s->ctl];
+    unsigned int first = 0, count = ctl->num_values;
+    unsigned int j;
+
+    if (s->id >= 0) {
+        if ((unsigned int)s->id >= ctl->num_values)
+            return;
+        first = s->id;
+        count = 1;
+    }
+
+    for (j = first; j < first + count; j++) {
+        values[ctl->offset + j] = s->value;
+        if (touched)
+            touched[ctl->offset + j] = 1;
+    }
+}
+
+static int add_setting(struct route_engine *re, const struct route_setting *s)
+{
+    if (grow((void **)&re->settings, &re->settings_size, re->num_settings + 1,
+             sizeof(struct route_setting)) < 0)
+        return -1;
+
+    re->settings[re->num_settings++] = *s;
+    re->paths[re->num_paths - 1].num_settings++;
+
+    return 0;
+}
+
+static int add_init_setting(struct route_engine *re,
+                            const struct route_setting *s)
+{
+    if (grow((void **)&re->init_settings, &re->init_settings_size,
+             re->num_init_settings + 1, sizeof(struct route_setting)) < 0)
+        return -1;
+
+    re->init_settings[re->num_init_settings++] = *s;
+
+    return 0;
+}
+
+static int add_path(struct route_engine *re, const char *name)
+{
+    size_t len = strlen(name) + 1;
+    struct route_path *path;
+
+    if (find_path(re, name) >= 0) {
+        ALOGE("%s: path '%s' defined twice", __func__, name);
+        return -1;
+    }
+
+    if (grow((void **)&re->paths, &re->paths_size, re->num_paths + 1,
+             sizeof(struct route_path)) < 0 ||
+            grow((void **)&re->names, &re->names_size, re->names_len + len, 1) < 0)
+        return -1;
+
+    path = &re->paths[re->num_paths++];
+    path->name = re->names_len;
+    path->first_setting = re->num_settings;
+    path->num_settings = 0;
+
+    memcpy(re->names + re->names_len, name, len);
+    re->names_len += len;
+
+    return re->num_paths - 1;
+}
+
+static const char *get_attr(const XML_Char **attr, const char *name)
+{
+    unsigned int i;
+
+    for (i = 0; attr[i]; i += 2) {
+        if (strcmp(attr[i], name) == 0)
+            return attr[i + 1];
+    }
+
+    return NULL;
+}
+
+static void start_tag(void *data, const XML_Char *tag_name,
+                      const XML_Char **attr)
+{
+    struct parser_state *state = data;
+    struct route_engine *re = state->re;
+    const char *name = get_attr(attr, "name");
+    const char *value = get_attr(attr, "value");
+    const char *id = get_attr(attr, "id");
+
+    state->level++;
+
+    if (state->skip)
+        return;
+
+    if (strcmp(tag_name, "path") == 0) {
+        if (state->path < 0) {
+            if (name == NULL) {
+                ALOGE("%s: unnamed path", __func__);
+                state->skip = true;
+                return;
+            }
+            state->path = add_path(re, name);
+            state->skip = state->path < 0;
+        } else {
+            /* a path inside a path includes a previously defined one */
+            unsigned int i, first, count;
+            int sub;
+
+            if (name == NULL || (sub = find_path(re, name)) < 0) {
+                ALOGE("%s: unknown path '%s' included", __func__,
+                      name ? name : "");
+                return;
+            }
+            first = re->paths[sub].first_setting;
+            count = re->paths[sub].num_settings;
+            for (i = 0; i < count; i++) {
+                struct route_setting s = re->settings[first + i];
+                add_setting(re, &s);
+            }
+        }
+    } else if (strcmp(tag_name, "ctl") == 0) {
+        struct route_setting s;
+        int ctl;
+
+        if (name == NULL || value == NULL) {
+            ALOGE("%s: incomplete ctl", __func__);
+            return;
+        }
+
+        ctl = get_ctl(state, name);
+        if (ctl < 0)
+            return;
+
+        s.ctl = ctl;
+        s.id = id ? atoi(id) : -1;
+        if (parse_value(re, ctl, value, &s.value) < 0)
+            return;
+
+        if (state->path < 0)
+            add_init_setting(re, &s);
+        else
+            add_setting(re, &s);
+    }
+}
+
+static void end_tag(void *data, const XML_Char *tag_name)
+{
+    struct parser_state *state = data;
+
+    /* paths are defined at level 2, inside <mixer> */
+    if (strcmp(tag_name, "path") == 0 && state->level == 2) {
+        state->path = -1;
+        state->skip = false;
+    }
+
+    state->level--;
+}
+
+static int parse_xml(struct parser_state *state, const char *xml_path)
+{
+    XML_Parser parser;
+    FILE *file;
+    int bytes_read;
+    void *buf;
+    int ret = -1;
+
+    file = fopen(xml_path, "r");
+    if (file == NULL) {
+        ALOGE("%s: failed to open %s", __func__, xml_path);
+        return -1;
+    }
+
+    parser = XML_ParserCreate(NULL);
+    if (parser == NULL) {
+        ALOGE("%s: failed to create XML parser", __func__);
+        goto err_alloc;
+    }
+
+    XML_SetUserData(parser, state);
+    XML_SetElementHandler(parser, start_tag, end_tag);
+
+    for (;;) {
+        buf = XML_GetBuffer(parser, BUF_SIZE);
+        if (buf == NULL)
+            goto err_parse;
+
+        bytes_read = fread(buf, 1, BUF_SIZE, file);
+        if (bytes_read < 0)
+            goto err_parse;
+
+        if (XML_ParseBuffer(parser, bytes_read, bytes_read == 0) ==
+                XML_STATUS_ERROR) {
+            ALOGE("%s: error in mixer xml (%s)", __func__, xml_path);
+            goto err_parse;
+        }
+
+        if (bytes_read == 0)
+            break;
+    }
+
+    ret = 0;
+
+err_parse:
+    XML_ParserFree(parser);
+err_alloc:
+    fclose(file);
+
+    return ret;
+}
+
+/*
+ * default_gain.conf is a list of blocks:
+ *
+ *   Modifier "<mode>" {
+ *       SupportedDevice { "<device>" ... }
+ *       OutputDevice { "<device>" }
+ *       Enable { { "<ctl>", <value> ... }, ... }
+ *       Param { ... }
+ *       Disable { ... }
+ *   }
+ *
+ * Each modifier becomes a path named "<mode>/<device>" or
+ * "<mode>/<device>/<output device>" holding its Enable and Param settings.
+ * Disable blocks are not needed, leaving a modifier restores the initial
+ * state of its controls like for any other path.
+ */
+static enum gain_token next_token(struct parser_state *state)
+{
+    const char *p = state->pos;
+    enum gain_token token;
+    size_t len = 0;
+
+    for (;;) {
+        while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' || *p == ',')
+            p++;
+        if (*p != '#')
+            break;
+        while (*p && *p != '\n')
+            p++;
+    }
+
+    switch (*p) {
+    case '\0':
+        token = TOKEN_END;
+        break;
+    case '{':
+        token = TOKEN_OPEN;
+        p++;
+        break;
+    case '}':
+        token = TOKEN_CLOSE;
+        p++;
+        break;
+    case '"':
+        token = TOKEN_STRING;
+        for (p++; *p && *p != '"'; p++) {
+            if (len < sizeof(state->token) - 1)
+                state->token[len++] = *p;
+        }
+        if (*p)
+            p++;
+        break;
+    default:
+        token = TOKEN_WORD;
+        for (; *p && !strchr(" \t\r\n,{}\"#", *p); p++) {
+            if (len < sizeof(state->token) - 1)
+                state->token[len++] = *p;
+        }
+        break;
+    }
+
+    state->token[len] = '\0';
+    state->pos = p;
+
+    return token;
+}
+
+/* Skips the rest of a block whose '{' was just read */
+static int skip_block(struct parser_state *state)
+{
+    int depth = 1;
+
+    while (depth > 0) {
+        switch (next_token(state)) {
+        case TOKEN_END:
+            return -1;
+        case TOKEN_OPEN:
+            depth++;
+            break;
+        case TOKEN_CLOSE:
+            depth--;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static int add_gain(struct parser_state *state, const struct route_setting *s)
+{
+    if (grow((void **)&state->gains, &state->gains_size, state->num_gains + 1,
+             sizeof(struct route_setting)) < 0)
+        return -1;
+
+    state->gains[state->num_gains++] = *s;
+
+    return 0;
+}
+
+/* Parses the { "<ctl>", <value> ... } entries of an Enable or Param block */
+static int parse_gain_settings(struct parser_state *state)
+{
+    enum gain_token token;
+
+    for (;;) {
+        struct route_setting s;
+        unsigned int first = state->num_gains;
+        int ctl;
+
+        token = next_token(state);
+        if (token == TOKEN_CLOSE)
+            return 0;
+        if (token != TOKEN_OPEN || next_token(state) != TOKEN_STRING)
+            return -1;
+
+        /* unknown controls are logged and skipped */
+        ctl = get_ctl(state, state->token);
+        s.ctl = ctl;
+        s.id = 0;
+
+        while ((token = next_token(state)) == TOKEN_WORD ||
+               token == TOKEN_STRING) {
+            if (ctl >= 0 && parse_value(state->re, ctl, state->token,
+                                        &s.value) == 0)
+                add_gain(state, &s);
+            s.id++;
+        }
+        if (token != TOKEN_CLOSE)
+            return -1;
+
+        /* a single value is written to all values of the control */
+        if (s.id == 1 && state->num_gains == first + 1)
+            state->gains[first].id = -1;
+    }
+}
+
+static void add_modifier_path(struct parser_state *state, const char *name)
+{
+    struct route_engine *re = state->re;
+    unsigned int i;
+
+    if (find_path(re, name) >= 0) {
+        ALOGW("%s: modifier '%s' defined twice, ignored", __func__, name);
+        return;
+    }
+
+    if (add_path(re, name) < 0)
+        return;
+
+    for (i = 0; i < state->num_gains; i++)
+        add_setting(re, &state->gains[i]);
+}
+
+static int parse_modifier(struct parser_state *state, const char *mode)
+{
+    char devices[MAX_GAIN_DEVICES][64];
+    unsigned int num_devices = 0;
+    char output[64] = "";
+    char section[32];
+    char name[256];
+    enum gain_token token;
+    unsigned int i;
+
+    state->num_gains = 0;
+
+    while ((token = next_token(state)) != TOKEN_CLOSE) {
+        if (token != TOKEN_WORD)
+            return -1;
+        snprintf(section, sizeof(section), "%s", state->token);
+        if (next_token(state) != TOKEN_OPEN)
+            return -1;
+
+        if (strcmp(section, "SupportedDevice") == 0) {
+            while ((token = next_token(state)) == TOKEN_STRING) {
+                if (num_devices < MAX_GAIN_DEVICES)
+                    snprintf(devices[num_devices++], sizeof(devices[0]), "%s",
+                             state->token);
+            }
+            if (token != TOKEN_CLOSE)
+                return -1;
+        } else if (strcmp(section, "OutputDevice") == 0) {
+            while ((token = next_token(state)) == TOKEN_STRING)
+                snprintf(output, sizeof(output), "%s", state->token);
+            if (token != TOKEN_CLOSE)
+                return -1;
+        } else if (strcmp(section, "Enable") == 0 ||
+                   strcmp(section, "Param") == 0) {
+            if (parse_gain_settings(state) < 0)
+                return -1;
+        } else if (skip_block(state) < 0) {
+            return -1;
+        }
+    }
+
+    if (num_devices == 0)
+        add_modifier_path(state, mode);
+
+    for (i = 0; i < num_devices; i++) {
+        if (output[0])
+            snprintf(name, sizeof(name), "%s/%s/%s", mode, devices[i], output);
+        else
+            snprintf(name, sizeof(name), "%s/%s", mode, devices[i]);
+        add_modifier_path(state, name);
+    }
+
+    return 0;
+}
+
+static int parse_gains(struct parser_state *state, const char *gain_path)
+{
+    enum gain_token token;
+    char mode[64];
+    char *text;
+    FILE *file;
+    long size;
+    int ret = -1;
+
+    file = fopen(gain_path, "r");
+    if (file == NULL) {
+        ALOGE("%s: failed to open %s", __func__, gain_path);
+        return -1;
+    }
+
+    if (fseek(file, 0, SEEK_END) < 0 || (size = ftell(file)) < 0 ||
+            fseek(file, 0, SEEK_SET) < 0) {
+        fclose(file);
+        return -1;
+    }
+
+    text = malloc(size + 1);
+    if (text == NULL || fread(text, 1, size, file) != (size_t)size) {
+        free(text);
+        fclose(file);
+        return -1;
+    }
+    text[size] = '\0';
+    fclose(file);
+
+    state->pos = text;
+
+    while ((token = next_token(state)) != TOKEN_END) {
+        bool modifier;
+
+        if (token != TOKEN_WORD)
+            goto err_syntax;
+
+        modifier = strcmp(state->token, "Modifier") == 0;
+        if (!modifier && strcmp(state->token, "ByteControl") != 0)
+            goto err_syntax;
+
+        if (next_token(state) != TOKEN_STRING)
+            goto err_syntax;
+        snprintf(mode, sizeof(mode), "%s", state->token);
+
+        if (next_token(state) != TOKEN_OPEN)
+            goto err_syntax;
+
+        /* byte control offsets are only used for runtime DSP writes */
+        if (modifier) {
+            if (parse_modifier(state, mode) < 0)
+                goto err_syntax;
+        } else if (skip_block(state) < 0) {
+            goto err_syntax;
+        }
+    }
+
+    ret = 0;
+    goto exit;
+
+err_syntax:
+    ALOGE("%s: syntax error in %s at offset %ld", __func__, gain_path,
+          (long)(state->pos - text));
+exit:
+    free(state->gains);
+    state->gains = NULL;
+    state->num_gains = state->gains_size = 0;
+    free(text);
+
+    return ret;
+}
+
+static int parse_config(struct route_engine *re, const char *xml_path,
+                        const char *gain_path)
+{
+    struct parser_state state;
+    unsigned int i;
+    int ret = -1;
+
+    memset(&state, 0, sizeof(state));
+    state.re = re;
+    state.path = -1;
+
+    state.num_sorted = mixer_get_num_ctls(re->mixer);
+    state.sorted = calloc(state.num_sorted, sizeof(struct mixer_ctl_name));
+    state.ctl_map = malloc(state.num_sorted * sizeof(int));
+    if (state.sorted == NULL || state.ctl_map == NULL)
+        goto exit;
+
+    for (i = 0; i < state.num_sorted; i++) {
+        state.sorted[i].name = mixer_ctl_get_name(mixer_get_ctl(re->mixer, i));
+        state.sorted[i].index = i;
+        state.ctl_map[i] = -1;
+    }
+    qsort(state.sorted, state.num_sorted, sizeof(struct mixer_ctl_name),
+          compare_ctl_names);
+
+    ret = parse_xml(&state, xml_path);
+
+    /* the routes work without gain modifiers */
+    if (ret == 0 && gain_path && parse_gains(&state, gain_path) < 0)
+        ALOGE("%s: gain modifiers from %s are incomplete", __func__, gain_path);
+
+exit:
+    free(state.ctl_map);
+    free(state.sorted);
+
+    return ret;
+}
+
+/* FNV-1a */
+static uint32_t hash_bytes(uint32_t hash, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    while (len--) {
+        hash ^= *p++;
+        hash *= 16777619;
+    }
+
+    return hash;
+}
+
+/*
+ * Identifies the control list of the mixer. The names and enum strings are
+ * already known to tinyalsa after mixer_open(), no ioctl is needed.
+ */
+static uint32_t get_mixer_hash(struct mixer *mixer)
+{
+    unsigned int num_ctls = mixer_get_num_ctls(mixer);
+    uint32_t hash = 2166136261u;
+    unsigned int i, j;
+
+    for (i = 0; i < num_ctls; i++) {
+        struct mixer_ctl *ctl = mixer_get_ctl(mixer, i);
+        const char *name = mixer_ctl_get_name(ctl);
+        uint32_t info[2];
+
+        info[0] = mixer_ctl_get_type(ctl);
+        info[1] = mixer_ctl_get_num_values(ctl);
+        hash = hash_bytes(hash, name, strlen(name) + 1);
+        hash = hash_bytes(hash, info, sizeof(info));
+
+        if (info[0] != MIXER_CTL_TYPE_ENUM)
+            continue;
+
+        for (j = 0; j < mixer_ctl_get_num_enums(ctl); j++) {
+            name = mixer_ctl_get_enum_string(ctl, j);
+            hash = hash_bytes(hash, name, strlen(name) + 1);
+        }
+    }
+
+    return hash;
+}
+
+static int check_settings(const struct route_engine *re,
+                          const struct route_setting *settings,
+                          unsigned int count)
+{
+    unsigned int i;
+
+    for (i = 0; i < count; i++) {
+        if (settings[i].ctl >= re->num_ctls)
+            return -1;
+    }
+
+    return 0;
+}
+
+/* Maps the compiled database if it matches the mixer and the XML */
+static int load_db(struct route_engine *re, const char *db_path,
+                   const struct route_db_header *key)
+{
+    const struct route_db_header *hdr;
+    unsigned int num_mixer_ctls = mixer_get_num_ctls(re->mixer);
+    size_t max_values = 0;
+    struct stat st;
+    uint8_t *p;
+    size_t size;
+    unsigned int i;
+    int fd;
+
+    fd = open(db_path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*hdr)) {
+        close(fd);
+        return -1;
+    }
+
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return -1;
+
+    re->db_map = p;
+    re->db_size = st.st_size;
+
+    hdr = (const struct route_db_header *)p;
+    if (hdr->magic != ROUTE_DB_MAGIC || hdr->version != ROUTE_DB_VERSION ||
+            hdr->mixer_hash != key->mixer_hash ||
+            hdr->xml_size != key->xml_size || hdr->xml_mtime != key->xml_mtime ||
+            hdr->gain_size != key->gain_size ||
+            hdr->gain_mtime != key->gain_mtime) {
+        ALOGV("%s: %s is stale", __func__, db_path);
+        return -1;
+    }
+
+    size = sizeof(*hdr) +
+           (size_t)hdr->num_ctls * sizeof(struct route_ctl) +
+           ((size_t)hdr->num_init_settings + hdr->num_settings) *
+                   sizeof(struct route_setting) +
+           (size_t)hdr->num_paths * sizeof(struct route_path) +
+           hdr->names_len;
+    if (size != re->db_size || hdr->names_len == 0 ||
+            p[re->db_size - 1] != '\0')
+        return -1;
+
+    p += sizeof(*hdr);
+    re->ctls = (struct route_ctl *)p;
+    re->num_ctls = hdr->num_ctls;
+    p += hdr->num_ctls * sizeof(struct route_ctl);
+    re->init_settings = (struct route_setting *)p;
+    re->num_init_settings = hdr->num_init_settings;
+    p += hdr->num_init_settings * sizeof(struct route_setting);
+    re->settings = (struct route_setting *)p;
+    re->num_settings = hdr->num_settings;
+    p += hdr->num_settings * sizeof(struct route_setting);
+    re->paths = (struct route_path *)p;
+    re->num_paths = hdr->num_paths;
+    p += hdr->num_paths * sizeof(struct route_path);
+    re->names = (char *)p;
+    re->names_len = hdr->names_len;
+    re->num_slots = hdr->num_slots;
+
+    if (check_settings(re, re->init_settings, re->num_init_settings) < 0 ||
+            check_settings(re, re->settings, re->num_settings) < 0)
+        return -1;
+
+    for (i = 0; i < re->num_paths; i++) {
+        const struct route_path *path = &re->paths[i];
+
+        if (path->name >= re->names_len ||
+                path->first_setting > re->num_settings ||
+                path->num_settings > re->num_settings - path->first_setting)
+            return -1;
+    }
+
+    re->mixer_ctls = malloc(re->num_ctls * sizeof(struct mixer_ctl *));
+    if (re->mixer_ctls == NULL)
+        return -1;
+
+    for (i = 0; i < re->num_ctls; i++) {
+        const struct route_ctl *rc = &re->ctls[i];
+        struct mixer_ctl *ctl;
+
+        if (rc->mixer_index >= num_mixer_ctls ||
+                rc->offset > re->num_slots ||
+                rc->num_values > re->num_slots - rc->offset)
+            return -1;
+
+        ctl = mixer_get_ctl(re->mixer, rc->mixer_index);
+        if (mixer_ctl_get_type(ctl) != rc->type ||
+                mixer_ctl_get_num_values(ctl) != rc->num_values)
+            return -1;
+
+        re->mixer_ctls[i] = ctl;
+        if (rc->num_values > max_values)
+            max_values = rc->num_values;
+    }
+
+    if (reserve_slots(re, re->num_slots) < 0 ||
+            io_buf_reserve(re, max_values * sizeof(long)) < 0)
+        return -1;
+
+    return 0;
+}
+
+/* Drops whatever a failed load_db() left behind */
+static void unload_db(struct route_engine *re)
+{
+    if (re->db_map)
+        munmap(re->db_map, re->db_size);
+    re->db_map = NULL;
+    re->db_size = 0;
+
+    free(re->mixer_ctls);
+    re->mixer_ctls = NULL;
+
+    re->ctls = NULL;
+    re->init_settings = NULL;
+    re->settings = NULL;
+    re->paths = NULL;
+    re->names = NULL;
+    re->num_ctls = 0;
+    re->num_slots = 0;
+    re->num_init_settings = 0;
+    re->num_settings = 0;
+    re->num_paths = 0;
+    re->names_len = 0;
+}
+
+static int write_all(int fd, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    ssize_t ret;
+
+    while (len > 0) {
+        ret = write(fd, p, len);
+        if (ret < 0)
+            return -1;
+        p += ret;
+        len -= ret;
+    }
+
+    return 0;
+}
+
+/* Writes the tables parsed from the XML, replacing the file atomically */
+static void save_db(struct route_engine *re, const char *db_path,
+                    const struct route_db_header *key)
+{
+    struct route_db_header hdr = *key;
+    char tmp_path[PATH_MAX];
+    int fd;
+
+    hdr.magic = ROUTE_DB_MAGIC;
+    hdr.version = ROUTE_DB_VERSION;
+    hdr.num_ctls = re->num_ctls;
+    hdr.num_slots = re->num_slots;
+    hdr.num_init_settings = re->num_init_settings;
+    hdr.num_settings = re->num_settings;
+    hdr.num_paths = re->num_paths;
+    hdr.names_len = re->names_len;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", db_path);
+
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0660);
+    if (fd < 0) {
+        ALOGW("%s: cannot create %s: %s", __func__, tmp_path, strerror(errno));
+        return;
+    }
+
+    if (write_all(fd, &hdr, sizeof(hdr)) < 0 ||
+            write_all(fd, re->ctls, re->num_ctls * sizeof(struct route_ctl)) < 0 ||
+            write_all(fd, re->init_settings,
+                      re->num_init_settings * sizeof(struct route_setting)) < 0 ||
+            write_all(fd, re->settings,
+                      re->num_settings * sizeof(struct route_setting)) < 0 ||
+            write_all(fd, re->paths,
+                      re->num_paths * sizeof(struct route_path)) < 0 ||
+            write_all(fd, re->names, re->names_len) < 0 ||
+            fsync(fd) < 0) {
+        ALOGW("%s: cannot write %s: %s", __func__, tmp_path, strerror(errno));
+        close(fd);
+        unlink(tmp_path);
+        return;
+    }
+    close(fd);
+
+    if (rename(tmp_path, db_path) < 0) {
+        ALOGW("%s: cannot rename %s: %s", __func__, tmp_path, strerror(errno));
+        unlink(tmp_path);
+    }
+}
+
+/* Reads the hardware and derives the initial state from it */
+static void read_initial_state(struct route_engine *re)
+{
+    unsigned int i;
+
+    for (i = 0; i < re->num_ctls; i++)
+        read_ctl(re, i, &re->hw_values[re->ctls[i].offset]);
+
+    memcpy(re->init_values, re->hw_values, re->num_slots * sizeof(int32_t));
+
+    for (i = 0; i < re->num_init_settings; i++)
+        apply_setting(re, re->init_values, NULL, &re->init_settings[i]);
+}
+
+/* Writes one step of a ramp control, keeping hw_values in sync */
+static unsigned int write_ramp_step(struct route_engine *re, unsigned int i,
+                                    const int32_t *from, const int32_t *to,
+                                    unsigned int step)
+{
+    unsigned int offset = re->ctls[i].offset;
+    unsigned int n = re->ctls[i].num_values;
+    int32_t values[MAX_RAMP_VALUES];
+    unsigned int ioctls;
+    unsigned int j;
+
+    for (j = 0; j < n; j++)
+        values[j] = from[j] + (to[j] - from[j]) * (int)step / RAMP_STEPS;
+
+    if (memcmp(values, &re->hw_values[offset], n * sizeof(int32_t)) == 0)
+        return 0;
+
+    ioctls = write_ctl(re, i, values);
+    memcpy(&re->hw_values[offset], values, n * sizeof(int32_t));
+
+    return ioctls;
+}
+
+/*
+ * Moves every ramp control from its hardware value to its minimum (down)
+ * or to the target (up) in RAMP_STEPS steps spread over half the ramp time.
+ */
+static unsigned int ramp(struct route_engine *re, bool down)
+{
+    int32_t from[MAX_RAMP_VALUES], to[MAX_RAMP_VALUES];
+    unsigned int step_us = re->ramp_time_us / (2 * RAMP_STEPS);
+    int32_t start[MAX_RAMP_CTLS][MAX_RAMP_VALUES];
+    unsigned int ioctls = 0;
+    unsigned int i, j, step;
+
+    for (i = 0; i < re->num_ramp_ctls; i++)
+        memcpy(start[i], &re->hw_values[re->ctls[re->ramp_ctls[i]].offset],
+               re->ctls[re->ramp_ctls[i]].num_values * sizeof(int32_t));
+
+    for (step = 1; step <= RAMP_STEPS; step++) {
+        for (i = 0; i < re->num_ramp_ctls; i++) {
+            unsigned int ctl = re->ramp_ctls[i];
+            unsigned int offset = re->ctls[ctl].offset;
+
+            for (j = 0; j < re->ctls[ctl].num_values; j++) {
+                from[j] = start[i][j];
+                to[j] = down ? re->ramp_min[i] : re->target[offset + j];
+            }
+            ioctls += write_ramp_step(re, ctl, from, to, step);
+        }
+
+        if (step < RAMP_STEPS)
+            usleep(step_us);
+    }
+
+    return ioctls;
+}
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Loads the routes from the compiled database at db_path, if it was built
+ * from the same mixer_paths.xml and gain file for the same mixer control
+ * list, otherwise parses them and rebuilds the database. gain_path and
+ * db_path may be NULL.
+ */
+struct route_engine *route_engine_init(unsigned int card, const char *xml_path,
+                                       const char *gain_path,
+                                       const char *db_path)
+{
+    struct route_db_header key;
+    struct route_engine *re;
+    struct stat st;
+
+    re = calloc(1, sizeof(struct route_engine));
+    if (re == NULL)
+        return NULL;
+
+    re->mixer = mixer_open(card);
+    if (re->mixer == NULL) {
+        ALOGE("%s: unable to open the mixer, aborting", __func__);
+        goto err_mixer;
+    }
+
+    if (xml_path == NULL)
+        xml_path = MIXER_XML_PATH;
+
+    memset(&key, 0, sizeof(key));
+    if (gain_path && stat(gain_path, &st) == 0) {
+        key.gain_size = st.st_size;
+        key.gain_mtime = st.st_mtime;
+    } else if (gain_path) {
+        ALOGW("%s: no gain modifiers (%s)", __func__, gain_path);
+        gain_path = NULL;
+    }
+
+    if (db_path && stat(xml_path, &st) == 0) {
+        key.mixer_hash = get_mixer_hash(re->mixer);
+        key.xml_size = st.st_size;
+        key.xml_mtime = st.st_mtime;
+    } else {
+        db_path = NULL;
+    }
+
+    if (db_path && load_db(re, db_path, &key) == 0) {
+        ALOGV("%s: using %s", __func__, db_path);
+    } else {
+        unload_db(re);
+
+        if (parse_config(re, xml_path, gain_path) < 0)
+            goto err_parse;
+
+        if (db_path)
+            save_db(re, db_path, &key);
+    }
+
+    ALOGV("%s: %u controls, %u values, %u paths, %u settings", __func__,
+          re->num_ctls, re->num_slots, re->num_paths, re->num_settings);
+
+    read_initial_state(re);
+
+    /* bring the hardware to the initial state */
+    route_engine_apply(re, NULL, 0, false);
+    memset(&re->stats, 0, sizeof(re->stats));
+
+    return re;
+
+err_parse:
+    route_engine_free(re);
+    return NULL;
+err_mixer:
+    free(re);
+    return NULL;
+}
+
+void route_engine_free(struct route_engine *re)
+{
+    if (re == NULL)
+        return;
+
+    if (re->mixer)
+        mixer_close(re->mixer);
+
+    if (re->db_map) {
+        munmap(re->db_map, re->db_size);
+    } else {
+        free(re->ctls);
+        free(re->init_settings);
+        free(re->settings);
+        free(re->paths);
+        free(re->names);
+    }
+
+    free(re->mixer_ctls);
+    free(re->init_values);
+    free(re->hw_values);
+    free(re->target);
+    free(re->build_values);
+    free(re->touched);
+    free(re->io_buf);
+    free(re->ramp_ctls);
+    free(re->ramp_min);
+    free(re->is_ramp_ctl);
+    free(re);
+}
+
+/*
+ * Sets the digital volumes to ramp around path switches and the time the
+ * ramps down and up may take together. Only controls used by the paths
+ * can be ramped.
+ */
+int route_engine_set_ramp(struct route_engine *re, const char * const *names,
+                          unsigned int num_names, unsigned int time_us)
+{
+    unsigned int i, j;
+
+    free(re->ramp_ctls);
+    free(re->ramp_min);
+    free(re->is_ramp_ctl);
+    re->num_ramp_ctls = 0;
+    re->ramp_time_us = time_us;
+
+    re->ramp_ctls = calloc(num_names, sizeof(unsigned int));
+    re->ramp_min = calloc(num_names, sizeof(int32_t));
+    re->is_ramp_ctl = calloc(re->num_ctls, 1);
+    if (re->ramp_ctls == NULL || re->ramp_min == NULL || re->is_ramp_ctl == NULL)
+        return -ENOMEM;
+
+    for (i = 0; i < num_names; i++) {
+        struct mixer_ctl *ctl = mixer_get_ctl_by_name(re->mixer, names[i]);
+
+        for (j = 0; j < re->num_ctls; j++) {
+            if (ctl && re->mixer_ctls[j] == ctl)
+                break;
+        }
+
+        if (j == re->num_ctls || re->ctls[j].type != MIXER_CTL_TYPE_INT ||
+                re->ctls[j].num_values > MAX_RAMP_VALUES ||
+                re->num_ramp_ctls == MAX_RAMP_CTLS) {
+            ALOGW("%s: cannot ramp '%s'", __func__, names[i]);
+            continue;
+        }
+
+        re->ramp_ctls[re->num_ramp_ctls] = j;
+        re->ramp_min[re->num_ramp_ctls] = mixer_ctl_get_range_min(ctl);
+        re->num_ramp_ctls++;
+        re->is_ramp_ctl[j] = 1;
+    }
+
+    return 0;
+}
+
+bool route_engine_has_path(struct route_engine *re, const char *name)
+{
+    return find_path(re, name) >= 0;
+}
+
+/*
+ * Computes the control values set by the given paths applied in order on
+ * top of the initial state. NULL path names are skipped. Builds use their
+ * own scratch vectors, so a build may run while another thread applies a
+ * route, but builds must not run concurrently with each other.
+ */
+struct route_vector *route_engine_build(struct route_engine *re,
+                                        const char * const *paths,
+                                        unsigned int num_paths)
+{
+    struct route_vector *rv;
+    unsigned int i, j, count = 0;
+
+    memcpy(re->build_values, re->init_values, re->num_slots * sizeof(int32_t));
+    memset(re->touched, 0, re->num_slots);
+
+    for (i = 0; i < num_paths; i++) {
+        const struct route_path *path;
+        int p;
+
+        if (paths[i] == NULL)
+            continue;
+
+        p = find_path(re, paths[i]);
+        if (p < 0) {
+            ALOGE("%s: unknown path '%s'", __func__, paths[i]);
+            continue;
+        }
+
+        path = &re->paths[p];
+        for (j = 0; j < path->num_settings; j++)
+            apply_setting(re, re->build_values, re->touched,
+                          &re->settings[path->first_setting + j]);
+    }
+
+    /*
+     * Values equal to the initial state are kept, so that they still win
+     * when the vector is applied on top of another one.
+     */
+    for (i = 0; i < re->num_slots; i++)
+        count += re->touched[i];
+
+    rv = malloc(sizeof(struct route_vector) + count * sizeof(struct route_value));
+    if (rv == NULL)
+        return NULL;
+
+    rv->count = 0;
+    for (i = 0; i < re->num_slots; i++) {
+        if (re->touched[i]) {
+            rv->values[rv->count].slot = i;
+            rv->values[rv->count].value = re->build_values[i];
+            rv->count++;
+        }
+    }
+
+    return rv;
+}
+
+/*
+ * Brings the hardware to the initial state with the given vectors applied
+ * in order, NULL vectors are skipped. Only the controls whose value changes
+ * are written. With ramp set, a transition which switches controls other
+ * than the ramp controls is done with the ramp controls down to avoid pops.
+ * Returns the number of mixer ioctls issued.
+ */
+int route_engine_apply(struct route_engine *re,
+                       const struct route_vector * const *rvs,
+                       unsigned int num_rvs, bool ramp_gains)
+{
+    uint64_t start = now_us();
+    unsigned int ioctls = 0;
+    bool ramped = false;
+    unsigned int i, j;
+    uint64_t elapsed;
+
+    memcpy(re->target, re->init_values, re->num_slots * sizeof(int32_t));
+    for (j = 0; j < num_rvs; j++) {
+        const struct route_vector *rv = rvs[j];
+
+        if (rv == NULL)
+            continue;
+        for (i = 0; i < rv->count; i++)
+            re->target[rv->values[i].slot] = rv->values[i].value;
+    }
+
+    if (ramp_gains && re->num_ramp_ctls > 0) {
+        for (i = 0; i < re->num_ctls && !ramped; i++) {
+            unsigned int offset = re->ctls[i].offset;
+            size_t size = re->ctls[i].num_values * sizeof(int32_t);
+
+            ramped = !re->is_ramp_ctl[i] &&
+                     memcmp(&re->target[offset], &re->hw_values[offset], size);
+        }
+    }
+
+    if (ramped)
+        ioctls += ramp(re, true);
+
+    for (i = 0; i < re->num_ctls; i++) {
+        unsigned int offset = re->ctls[i].offset;
+        size_t size = re->ctls[i].num_values * sizeof(int32_t);
+
+        if (ramped && re->is_ramp_ctl[i])
+            continue;
+
+        if (memcmp(&re->target[offset], &re->hw_values[offset], size) == 0)
+            continue;
+
+        ioctls += write_ctl(re, i, &re->target[offset]);
+        memcpy(&re->hw_values[offset], &re->target[offset], size);
+    }
+
+    if (ramped)
+        ioctls += ramp(re, false);
+
+    elapsed = now_us() - start;
+
+    re->stats.transitions++;
+    if (ramped)
+        re->stats.ramps++;
+    re->stats.last_ioctls = ioctls;
+    re->stats.total_ioctls += ioctls;
+    if (ioctls > re->stats.max_ioctls)
+        re->stats.max_ioctls = ioctls;
+    re->stats.last_time_us = elapsed;
+    if (elapsed > re->stats.max_time_us)
+        re->stats.max_time_us = elapsed;
+
+    return ioctls;
+}
+
+void route_engine_get_stats(struct route_engine *re, struct route_stats *stats)
+{
+    *stats = re->stats;
+}
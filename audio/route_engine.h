@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2015 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ROUTE_ENGINE_H
+#define ROUTE_ENGINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* overridden by the host build of the HAL */
+#ifndef MIXER_XML_PATH
+#define MIXER_XML_PATH "/system/etc/mixer_paths.xml"
+#endif
+#ifndef GAIN_CONF_PATH
+#define GAIN_CONF_PATH "/system/etc/default_gain.conf"
+#endif
+#ifndef ROUTE_DB_PATH
+#define ROUTE_DB_PATH  "/data/misc/audio/mixer_paths.bin"
+#endif
+
+/*
+ * The route engine parses mixer_paths.xml once, keeps the value of every
+ * referenced mixer control in a flat vector and writes only the controls
+ * which differ from what is currently in the hardware.
+ *
+ * The modifiers of default_gain.conf are loaded as additional paths named
+ * "<mode>/<device>" or "<mode>/<device>/<output device>".
+ */
+struct route_engine;
+
+/*
+ * Control values set by a list of paths, stored sparse as slot and value.
+ * Vectors are applied on top of the initial mixer state.
+ */
+struct route_value {
+    uint32_t slot;
+    int32_t value;
+};
+
+struct route_vector {
+    unsigned int count;
+    struct route_value values[];
+};
+
+struct route_stats {
+    unsigned int transitions;   /* route_engine_apply() calls */
+    unsigned int ramps;         /* transitions done with gain ramps */
+    unsigned int last_ioctls;   /* mixer ioctls of the last transition */
+    unsigned int max_ioctls;    /* most expensive transition */
+    uint64_t total_ioctls;
+    uint64_t last_time_us;      /* duration of the last transition */
+    uint64_t max_time_us;
+};
+
+/* Function prototypes */
+struct route_engine *route_engine_init(unsigned int card, const char *xml_path,
+                                       const char *gain_path,
+                                       const char *db_path);
+
+void route_engine_free(struct route_engine *re);
+
+int route_engine_set_ramp(struct route_engine *re, const char * const *names,
+                          unsigned int num_names, unsigned int time_us);
+
+bool route_engine_has_path(struct route_engine *re, const char *name);
+
+struct route_vector *route_engine_build(struct route_engine *re,
+                                        const char * const *paths,
+                                        unsigned int num_paths);
+
+int route_engine_apply(struct route_engine *re,
+                       const struct route_vector * const *rvs,
+                       unsigned int num_rvs, bool ramp_gains);
+
+void route_engine_get_stats(struct route_engine *re, struct route_stats *stats);
+
+#endif
@@ -269,4 +269,55 @@ const struct route_config * const route_configs[IN_SOURCE_TAB_SIZE]
     },
 };
 
+/* Gain modifiers of default_gain.conf applied on top of the routes */
+
+enum {
+    GAIN_MODE_NORMAL,
+    GAIN_MODE_RINGTONE,
+    GAIN_MODE_INCALL_NB,
+    GAIN_MODE_INCALL_WB,
+    GAIN_MODE_COMMUNICATION,
+    GAIN_MODE_CNT
+};
+
+const char * const output_gain_modifiers[GAIN_MODE_CNT] = {
+    "Normal",                       /* GAIN_MODE_NORMAL */
+    "Ringtone",                     /* GAIN_MODE_RINGTONE */
+    "NB Incall",                    /* GAIN_MODE_INCALL_NB */
+    "WB Incall",                    /* GAIN_MODE_INCALL_WB */
+    "Incommunication"               /* GAIN_MODE_COMMUNICATION */
+};
+
+const char * const input_gain_modifiers[IN_SOURCE_TAB_SIZE] = {
+    "Voice",                        /* IN_SOURCE_MIC */
+    "Camcorder",                    /* IN_SOURCE_CAMCORDER */
+    "Recognition",                  /* IN_SOURCE_VOICE_RECOGNITION */
+    "Communication",                /* IN_SOURCE_VOICE_COMMUNICATION */
+    "IncallInNBNSOn",               /* IN_SOURCE_VOICE_CALL */
+    "IncallInWBNSOn"                /* IN_SOURCE_VOICE_CALL_WB */
+};
+
+/* gain devices of an output device, combined devices use two */
+const char * const gain_output_devices[OUT_DEVICE_TAB_SIZE][2] = {
+    { "Speaker", NULL },            /* OUT_DEVICE_SPEAKER */
+    { "Earpiece", NULL },           /* OUT_DEVICE_EARPIECE */
+    { "Headset Out", NULL },        /* OUT_DEVICE_HEADSET */
+    { "Headphone", NULL },          /* OUT_DEVICE_HEADPHONES */
+    { "SCO", NULL },                /* OUT_DEVICE_BT_SCO */
+    { "SCO Headset Out", NULL },    /* OUT_DEVICE_BT_SCO_HEADSET_OUT */
+    { "SCO Carkit", NULL },         /* OUT_DEVICE_BT_SCO_CARKIT */
+    { "Speaker", "Headset Out" },   /* OUT_DEVICE_SPEAKER_AND_HEADSET */
+    { "Speaker", "Earpiece" }       /* OUT_DEVICE_SPEAKER_AND_EARPIECE */
+};
+
+/* applied on top of SCO routes when the headset uses wide band speech */
+const char * const bt_wbs_path = "bt-sco-wbs";
+
+/* Digital output volumes ramped around path switches to avoid pops */
+const char * const ramp_controls[] = {
+    "HPOUT1 Digital Volume",        /* headset */
+    "HPOUT2 Digital Volume",        /* speaker */
+    "HPOUT3 Digital Volume"         /* earpiece */
+};
+
 #endif
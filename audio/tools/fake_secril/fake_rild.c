@@ -0,0 +1,317 @@
+/*
+ * Copyright (C) 2015 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Modem stand-in answering the fake secril-client library:
+ *
+ *   fake_rild [-s <socket>] [-l [<request>=]<ms>] [-f <percent>]
+ *             [-e <request>] [-w <ms>] [-x <count>] [-v]
+ *
+ *   -s  socket path, $FAKE_RILD_SOCKET or FAKE_RILD_SOCKET_DEFAULT otherwise
+ *   -l  time taken by every request, or by one request type when prefixed
+ *       with its name (volume, path, clock, mute, twomic), repeatable
+ *   -f  share of the requests failing with RIL_CLIENT_ERR_IO
+ *   -e  request type always failing, repeatable
+ *   -w  toggle the wide band AMR report every <ms>, SIGUSR1 toggles it
+ *       at once
+ *   -x  drop the connection after <count> requests, to exercise the
+ *       reconnect of the HAL
+ *   -v  print every request with its arrival time
+ *
+ * Serves one client at a time and prints request counts on SIGINT.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "secril-client.h"
+#include "fake_rild.h"
+
+static const char * const request_names[FAKE_RILD_REQUEST_CNT] = {
+    [FAKE_RILD_SET_CALL_VOLUME] = "volume",
+    [FAKE_RILD_SET_CALL_AUDIO_PATH] = "path",
+    [FAKE_RILD_SET_CALL_CLOCK_SYNC] = "clock",
+    [FAKE_RILD_SET_MUTE] = "mute",
+    [FAKE_RILD_SET_TWO_MIC_CONTROL] = "twomic",
+};
+
+struct options {
+    const char *socket_path;
+    unsigned int latency_ms[FAKE_RILD_REQUEST_CNT];
+    unsigned int fail_percent;
+    bool fail[FAKE_RILD_REQUEST_CNT];
+    unsigned int wb_amr_ms;
+    unsigned int drop_after;
+    bool verbose;
+};
+
+static unsigned int requests[FAKE_RILD_REQUEST_CNT];
+static unsigned int failures[FAKE_RILD_REQUEST_CNT];
+static volatile sig_atomic_t wb_amr_toggle;
+static volatile sig_atomic_t quit;
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int find_request(const char *name, size_t len)
+{
+    int i;
+
+    for (i = 0; i < FAKE_RILD_REQUEST_CNT; i++) {
+        if (strlen(request_names[i]) == len &&
+                strncmp(request_names[i], name, len) == 0)
+            return i;
+    }
+
+    fprintf(stderr, "unknown request '%.*s'\n", (int)len, name);
+    exit(2);
+}
+
+static void parse_latency(struct options *opts, const char *arg)
+{
+    const char *eq = strchr(arg, '=');
+    int i;
+
+    if (eq == NULL) {
+        for (i = 0; i < FAKE_RILD_REQUEST_CNT; i++)
+            opts->latency_ms[i] = atoi(arg);
+        return;
+    }
+
+    opts->latency_ms[find_request(arg, eq - arg)] = atoi(eq + 1);
+}
+
+static void on_signal(int sig)
+{
+    if (sig == SIGUSR1)
+        wb_amr_toggle = 1;
+    else
+        quit = 1;
+}
+
+static bool send_msg(int fd, const struct fake_rild_msg *msg)
+{
+    return write(fd, msg, sizeof(*msg)) == sizeof(*msg);
+}
+
+static bool send_wb_amr(int fd, int enable)
+{
+    struct fake_rild_msg msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = FAKE_RILD_MSG_UNSOL;
+    msg.id = RIL_UNSOL_SNDMGR_WB_AMR_REPORT;
+    msg.args[0] = enable;
+
+    printf("unsol wb amr %d\n", enable);
+
+    return send_msg(fd, &msg);
+}
+
+static bool handle_request(const struct options *opts, int fd,
+                           struct fake_rild_msg *msg, uint64_t start)
+{
+    unsigned int id = msg->id;
+
+    if (id >= FAKE_RILD_REQUEST_CNT) {
+        msg->rc = RIL_CLIENT_ERR_INVAL;
+    } else {
+        requests[id]++;
+        if (opts->verbose)
+            printf("%8llu ms %s %d %d\n",
+                   (unsigned long long)(now_ms() - start), request_names[id],
+                   msg->args[0], msg->args[1]);
+
+        if (opts->latency_ms[id] > 0)
+            usleep(opts->latency_ms[id] * 1000);
+
+        if (opts->fail[id] ||
+                (opts->fail_percent > 0 &&
+                 (unsigned int)(rand() % 100) < opts->fail_percent)) {
+            failures[id]++;
+            msg->rc = RIL_CLIENT_ERR_IO;
+        } else {
+            msg->rc = RIL_CLIENT_ERR_SUCCESS;
+        }
+    }
+
+    msg->type = FAKE_RILD_MSG_RESPONSE;
+
+    return send_msg(fd, msg);
+}
+
+static void serve(const struct options *opts, int fd)
+{
+    struct fake_rild_msg msg;
+    struct pollfd pfd;
+    uint64_t start = now_ms();
+    uint64_t next_toggle = start + opts->wb_amr_ms;
+    unsigned int served = 0;
+    int wb_amr = 0;
+    int timeout;
+    int ret;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    while (!quit) {
+        if (wb_amr_toggle ||
+                (opts->wb_amr_ms > 0 && now_ms() >= next_toggle)) {
+            wb_amr_toggle = 0;
+            wb_amr = !wb_amr;
+            next_toggle = now_ms() + opts->wb_amr_ms;
+            if (!send_wb_amr(fd, wb_amr))
+                break;
+        }
+
+        timeout = -1;
+        if (opts->wb_amr_ms > 0) {
+            uint64_t now = now_ms();
+            timeout = next_toggle > now ? (int)(next_toggle - now) : 0;
+        }
+
+        ret = poll(&pfd, 1, timeout);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0)
+            break;
+        if (ret == 0)
+            continue;
+
+        if (read(fd, &msg, sizeof(msg)) != sizeof(msg))
+            break;
+        if (msg.type != FAKE_RILD_MSG_REQUEST)
+            continue;
+        if (!handle_request(opts, fd, &msg, start))
+            break;
+
+        if (opts->drop_after > 0 && ++served >= opts->drop_after) {
+            printf("dropping the connection after %u requests\n", served);
+            break;
+        }
+    }
+}
+
+static void print_counts(void)
+{
+    int i;
+
+    printf("\n%-8s %10s %10s\n", "request", "count", "failed");
+    for (i = 0; i < FAKE_RILD_REQUEST_CNT; i++)
+        printf("%-8s %10u %10u\n", request_names[i], requests[i], failures[i]);
+}
+
+int main(int argc, char **argv)
+{
+    struct options opts;
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    int listen_fd, fd;
+    int opt;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.socket_path = getenv(FAKE_RILD_SOCKET_ENV);
+    if (opts.socket_path == NULL)
+        opts.socket_path = FAKE_RILD_SOCKET_DEFAULT;
+
+    while ((opt = getopt(argc, argv, "s:l:f:e:w:x:v")) != -1) {
+        switch (opt) {
+        case 's':
+            opts.socket_path = optarg;
+            break;
+        case 'l':
+            parse_latency(&opts, optarg);
+            break;
+        case 'f':
+            opts.fail_percent = atoi(optarg);
+            break;
+        case 'e':
+            opts.fail[find_request(optarg, strlen(optarg))] = true;
+            break;
+        case 'w':
+            opts.wb_amr_ms = atoi(optarg);
+            break;
+        case 'x':
+            opts.drop_after = atoi(optarg);
+            break;
+        case 'v':
+            opts.verbose = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-s socket] [-l [request=]ms] "
+                    "[-f percent] [-e request] [-w ms] [-x count] [-v]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, opts.socket_path, sizeof(addr.sun_path) - 1);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(opts.socket_path);
+    if (listen_fd < 0 ||
+            bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+            listen(listen_fd, 1) < 0) {
+        fprintf(stderr, "cannot listen on %s: %s\n", opts.socket_path,
+                strerror(errno));
+        return 1;
+    }
+
+    printf("listening on %s\n", opts.socket_path);
+
+    while (!quit) {
+        fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+            continue;
+        printf("client connected\n");
+        serve(&opts, fd);
+        close(fd);
+        printf("client gone\n");
+    }
+
+    close(listen_fd);
+    unlink(opts.socket_path);
+    print_counts();
+
+    return 0;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2015 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FAKE_RILD_H
+#define FAKE_RILD_H
+
+#include <stdint.h>
+
+/*
+ * Wire format between the fake secril-client library and fake_rild. Both
+ * ends run on the same machine, messages are fixed size and in host byte
+ * order.
+ */
+
+#define FAKE_RILD_SOCKET_ENV     "FAKE_RILD_SOCKET"
+#define FAKE_RILD_SOCKET_DEFAULT "/data/local/tmp/fake-rild"
+
+enum fake_rild_request {
+    FAKE_RILD_SET_CALL_VOLUME,
+    FAKE_RILD_SET_CALL_AUDIO_PATH,
+    FAKE_RILD_SET_CALL_CLOCK_SYNC,
+    FAKE_RILD_SET_MUTE,
+    FAKE_RILD_SET_TWO_MIC_CONTROL,
+    FAKE_RILD_REQUEST_CNT
+};
+
+enum fake_rild_msg_type {
+    FAKE_RILD_MSG_REQUEST,      /* client to server */
+    FAKE_RILD_MSG_RESPONSE,     /* server to client, answers a request */
+    FAKE_RILD_MSG_UNSOL,        /* server to client, unsolicited report */
+};
+
+struct fake_rild_msg {
+    uint32_t type;              /* enum fake_rild_msg_type */
+    uint32_t id;                /* request or RIL_UNSOL_* id */
+    uint32_t token;             /* request sequence, echoed in the response */
+    int32_t args[2];            /* request arguments or unsolicited data */
+    int32_t rc;                 /* response only, RIL_CLIENT_ERR_* */
+};
+
+#endif
@@ -0,0 +1,432 @@
+/*
+ * Copyright (C) 2015 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Stand-in for libsecril-client, covering the calls the audio HAL makes.
+ * Requests go to fake_rild over a Unix socket instead of to the modem, so
+ * ril_interface.c runs against a modem whose latency and failures can be
+ * chosen. The socket is $FAKE_RILD_SOCKET, FAKE_RILD_SOCKET_DEFAULT when
+ * not set.
+ *
+ * fake_secril_unsolicited() runs an unsolicited handler as if fake_rild
+ * had sent the report, for tools which load the HAL and want a report at
+ * a given point of their run.
+ */
+
+#define LOG_TAG "secril_client_fake"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+
+#include "secril-client.h"
+#include "fake_rild.h"
+
+#define MAX_UNSOL_HANDLERS 8
+#define RESPONSE_TIMEOUT_S 5
+
+struct fake_client {
+    pthread_mutex_t request_lock;   /* one request in flight at a time */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int fd;
+    bool connected;
+    pthread_t reader;
+    bool reader_started;
+
+    uint32_t token;
+    bool response_ready;
+    int response_rc;
+
+    struct {
+        uint32_t id;
+        RilOnUnsolicited handler;
+    } unsol[MAX_UNSOL_HANDLERS];
+    unsigned int num_unsol;
+    RilOnError error_cb;
+    void *error_data;
+};
+
+static pthread_mutex_t clients_lock = PTHREAD_MUTEX_INITIALIZER;
+static HRilClient last_client;      /* the latest one opened */
+
+static struct fake_client *get_client(HRilClient client)
+{
+    if (client == NULL)
+        return NULL;
+
+    return (struct fake_client *)client->prv;
+}
+
+static bool read_full(int fd, void *buf, size_t size)
+{
+    uint8_t *p = buf;
+    ssize_t n;
+
+    while (size > 0) {
+        n = read(fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+static void run_unsol_handler(HRilClient client, uint32_t id,
+                              const int32_t *args)
+{
+    struct fake_client *fc = get_client(client);
+    RilOnUnsolicited handler = NULL;
+    unsigned int i;
+
+    pthread_mutex_lock(&fc->lock);
+    for (i = 0; i < fc->num_unsol; i++) {
+        if (fc->unsol[i].id == id)
+            handler = fc->unsol[i].handler;
+    }
+    pthread_mutex_unlock(&fc->lock);
+
+    if (handler != NULL)
+        handler(client, args, sizeof(args[0]));
+}
+
+/* Hands out responses and runs the unsolicited handlers, like rild's reader */
+static void *reader_loop(void *context)
+{
+    HRilClient client = (HRilClient)context;
+    struct fake_client *fc = get_client(client);
+    struct fake_rild_msg msg;
+    RilOnError error_cb;
+
+    while (read_full(fc->fd, &msg, sizeof(msg))) {
+        if (msg.type == FAKE_RILD_MSG_RESPONSE) {
+            pthread_mutex_lock(&fc->lock);
+            if (msg.token == fc->token) {
+                fc->response_rc = msg.rc;
+                fc->response_ready = true;
+                pthread_cond_broadcast(&fc->cond);
+            }
+            pthread_mutex_unlock(&fc->lock);
+        } else if (msg.type == FAKE_RILD_MSG_UNSOL) {
+            run_unsol_handler(client, msg.id, msg.args);
+        }
+    }
+
+    pthread_mutex_lock(&fc->lock);
+    error_cb = fc->connected ? fc->error_cb : NULL;
+    fc->connected = false;
+    pthread_cond_broadcast(&fc->cond);
+    pthread_mutex_unlock(&fc->lock);
+
+    /* the server went away, not a Disconnect_RILD() */
+    if (error_cb != NULL)
+        error_cb(fc->error_data, RIL_CLIENT_ERR_IO);
+
+    return NULL;
+}
+
+static int send_request(HRilClient client, enum fake_rild_request id,
+                        int arg0, int arg1)
+{
+    struct fake_client *fc = get_client(client);
+    struct fake_rild_msg msg;
+    struct timespec ts;
+    int rc = RIL_CLIENT_ERR_SUCCESS;
+
+    if (fc == NULL)
+        return RIL_CLIENT_ERR_INVAL;
+
+    pthread_mutex_lock(&fc->request_lock);
+    pthread_mutex_lock(&fc->lock);
+    if (!fc->connected) {
+        rc = RIL_CLIENT_ERR_CONNECT;
+        goto exit;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = FAKE_RILD_MSG_REQUEST;
+    msg.id = id;
+    msg.token = ++fc->token;
+    msg.args[0] = arg0;
+    msg.args[1] = arg1;
+    fc->response_ready = false;
+
+    if (write(fc->fd, &msg, sizeof(msg)) != sizeof(msg)) {
+        rc = RIL_CLIENT_ERR_IO;
+        goto exit;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += RESPONSE_TIMEOUT_S;
+    while (!fc->response_ready && fc->connected) {
+        if (pthread_cond_timedwait(&fc->cond, &fc->lock, &ts) == ETIMEDOUT)
+            break;
+    }
+
+    if (fc->response_ready)
+        rc = fc->response_rc;
+    else
+        rc = fc->connected ? RIL_CLIENT_ERR_AGAIN : RIL_CLIENT_ERR_IO;
+
+exit:
+    pthread_mutex_unlock(&fc->lock);
+    pthread_mutex_unlock(&fc->request_lock);
+
+    return rc;
+}
+
+HRilClient OpenClient_RILD(void)
+{
+    struct fake_client *fc;
+    HRilClient client;
+
+    client = calloc(1, sizeof(*client));
+    fc = calloc(1, sizeof(*fc));
+    if (client == NULL || fc == NULL) {
+        free(client);
+        free(fc);
+        return NULL;
+    }
+
+    pthread_mutex_init(&fc->request_lock, NULL);
+    pthread_mutex_init(&fc->lock, NULL);
+    pthread_cond_init(&fc->cond, NULL);
+    fc->fd = -1;
+    client->prv = fc;
+
+    pthread_mutex_lock(&clients_lock);
+    last_client = client;
+    pthread_mutex_unlock(&clients_lock);
+
+    return client;
+}
+
+int Connect_RILD(HRilClient client)
+{
+    struct fake_client *fc = get_client(client);
+    struct sockaddr_un addr;
+    const char *path;
+    int fd;
+
+    if (fc == NULL)
+        return RIL_CLIENT_ERR_INVAL;
+
+    if (isConnected_RILD(client))
+        return RIL_CLIENT_ERR_SUCCESS;
+
+    /* reap the reader of a connection the server dropped */
+    if (fc->reader_started) {
+        pthread_join(fc->reader, NULL);
+        fc->reader_started = false;
+        close(fc->fd);
+        fc->fd = -1;
+    }
+
+    path = getenv(FAKE_RILD_SOCKET_ENV);
+    if (path == NULL)
+        path = FAKE_RILD_SOCKET_DEFAULT;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return RIL_CLIENT_ERR_RESOURCE;
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        ALOGE("%s: cannot reach %s: %s", __func__, path, strerror(errno));
+        close(fd);
+        return RIL_CLIENT_ERR_CONNECT;
+    }
+
+    pthread_mutex_lock(&fc->lock);
+    fc->fd = fd;
+    fc->connected = true;
+    pthread_mutex_unlock(&fc->lock);
+
+    if (pthread_create(&fc->reader, NULL, reader_loop, client) != 0) {
+        pthread_mutex_lock(&fc->lock);
+        fc->connected = false;
+        fc->fd = -1;
+        pthread_mutex_unlock(&fc->lock);
+        close(fd);
+        return RIL_CLIENT_ERR_RESOURCE;
+    }
+    fc->reader_started = true;
+
+    return RIL_CLIENT_ERR_SUCCESS;
+}
+
+int isConnected_RILD(HRilClient client)
+{
+    struct fake_client *fc = get_client(client);
+    int connected;
+
+    if (fc == NULL)
+        return 0;
+
+    pthread_mutex_lock(&fc->lock);
+    connected = fc->connected;
+    pthread_mutex_unlock(&fc->lock);
+
+    return connected;
+}
+
+int Disconnect_RILD(HRilClient client)
+{
+    struct fake_client *fc = get_client(client);
+
+    if (fc == NULL)
+        return RIL_CLIENT_ERR_INVAL;
+
+    pthread_mutex_lock(&fc->lock);
+    fc->connected = false;
+    if (fc->fd >= 0)
+        shutdown(fc->fd, SHUT_RDWR);
+    pthread_mutex_unlock(&fc->lock);
+
+    if (fc->reader_started) {
+        pthread_join(fc->reader, NULL);
+        fc->reader_started = false;
+    }
+    if (fc->fd >= 0) {
+        close(fc->fd);
+        fc->fd = -1;
+    }
+
+    return RIL_CLIENT_ERR_SUCCESS;
+}
+
+int CloseClient_RILD(HRilClient client)
+{
+    struct fake_client *fc = get_client(client);
+
+    if (fc == NULL)
+        return RIL_CLIENT_ERR_INVAL;
+
+    pthread_mutex_lock(&clients_lock);
+    if (last_client == client)
+        last_client = NULL;
+    pthread_mutex_unlock(&clients_lock);
+
+    Disconnect_RILD(client);
+    pthread_cond_destroy(&fc->cond);
+    pthread_mutex_destroy(&fc->lock);
+    pthread_mutex_destroy(&fc->request_lock);
+    free(fc);
+    free(client);
+
+    return RIL_CLIENT_ERR_SUCCESS;
+}
+
+int RegisterUnsolicitedHandler(HRilClient client, uint32_t id,
+                               RilOnUnsolicited handler)
+{
+    struct fake_client *fc = get_client(client);
+    int rc = RIL_CLIENT_ERR_SUCCESS;
+    unsigned int i;
+
+    if (fc == NULL)
+        return RIL_CLIENT_ERR_INVAL;
+
+    pthread_mutex_lock(&fc->lock);
+    for (i = 0; i < fc->num_unsol; i++) {
+        if (fc->unsol[i].id == id)
+            break;
+    }
+    if (i < MAX_UNSOL_HANDLERS) {
+        fc->unsol[i].id = id;
+        fc->unsol[i].handler = handler;
+        if (i == fc->num_unsol)
+            fc->num_unsol++;
+    } else {
+        rc = RIL_CLIENT_ERR_RESOURCE;
+    }
+    pthread_mutex_unlock(&fc->lock);
+
+    return rc;
+}
+
+int RegisterErrorCallback(HRilClient client, RilOnError cb, void *data)
+{
+    struct fake_client *fc = get_client(client);
+
+    if (fc == NULL)
+        return RIL_CLIENT_ERR_INVAL;
+
+    pthread_mutex_lock(&fc->lock);
+    fc->error_cb = cb;
+    fc->error_data = data;
+    pthread_mutex_unlock(&fc->lock);
+
+    return RIL_CLIENT_ERR_SUCCESS;
+}
+
+int SetCallVolume(HRilClient client, enum _SoundType type, int vol_level)
+{
+    return send_request(client, FAKE_RILD_SET_CALL_VOLUME, type, vol_level);
+}
+
+int SetCallAudioPath(HRilClient client, enum _AudioPath path)
+{
+    return send_request(client, FAKE_RILD_SET_CALL_AUDIO_PATH, path, 0);
+}
+
+int SetCallClockSync(HRilClient client, enum _SoundClockCondition condition)
+{
+    return send_request(client, FAKE_RILD_SET_CALL_CLOCK_SYNC, condition, 0);
+}
+
+int SetMute(HRilClient client, enum _MuteCondition condition)
+{
+    return send_request(client, FAKE_RILD_SET_MUTE, condition, 0);
+}
+
+int SetTwoMicControl(HRilClient client, enum __TwoMicSolDevice device,
+                     enum __TwoMicSolReport report)
+{
+    return send_request(client, FAKE_RILD_SET_TWO_MIC_CONTROL, device, report);
+}
+
+/* Runs the handler of the latest client for an unsolicited report */
+int fake_secril_unsolicited(uint32_t id, int32_t arg)
+{
+    int32_t args[2] = { arg, 0 };
+    int rc = RIL_CLIENT_ERR_INIT;
+
+    /* keeps the client from being closed meanwhile */
+    pthread_mutex_lock(&clients_lock);
+    if (last_client != NULL) {
+        run_unsol_handler(last_client, id, args);
+        rc = RIL_CLIENT_ERR_SUCCESS;
+    }
+    pthread_mutex_unlock(&clients_lock);
+
+    return rc;
+}
@@ -0,0 +1,729 @@
+/*
+ * Copyright (C) 2015 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Replays a recorded AudioFlinger call sequence against the audio HAL:
+ *
+ *   hal_replay [-m <audio.primary.so>] <trace>
+ *
+ * Every trace line is "<time_ms> <thread> <op> [args]". The lines of one
+ * thread run in order on their own pthread, each not before time_ms after
+ * the start, so playback, capture and the binder calls of the framework
+ * race against each other as they do on the phone. The ops are
+ *
+ *   open_output <stream> <devices> <flags> [rate]
+ *   open_input <stream> <devices> <source> [rate]
+ *   write <stream> <ms>            buffer sized writes worth ms of audio
+ *   read <stream> <ms>
+ *   standby <stream>
+ *   set_parameters <stream>|adev <kvpairs>
+ *   set_mode <mode>
+ *   voice_volume <volume>
+ *   mic_mute <0|1>
+ *   wb_amr <0|1>                   wide band AMR report of the modem
+ *   close <stream>
+ *   sleep <ms>
+ *
+ * Numbers are parsed as C literals and '#' starts a comment. At the end
+ * the latency of every op is printed, next to the part of it not spent
+ * blocked on the simulated DMA of the host tinyalsa stub: for a write
+ * that is time spent on HAL locks and processing, elsewhere it is all
+ * of it. Then come the throughput of every stream against its nominal
+ * rate, the stub counters and the HAL dump. A busy PCM open or a call on
+ * a PCM racing another one, as seen by the stub, counts as an error.
+ *
+ * Without -m the host build of the HAL, audio.primary.host.so, is used.
+ * Traces with calls in them want a host fake_rild to talk to, wb_amr
+ * needs the fake secril-client in the HAL:
+ *
+ *   export FAKE_RILD_SOCKET=/tmp/fake-rild
+ *   fake_rild -l path=20 &
+ *   hal_replay tools/traces/voice_call.trace
+ */
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <hardware/audio.h>
+#include <hardware/hardware.h>
+
+#include "secril-client.h"
+#include "host/tinyalsa_stub.h"
+
+#define DEFAULT_MODULE   "audio.primary.host.so"
+#define DEFAULT_RATE     48000
+#define MAX_NAME         32
+#define MAX_ARGS         256
+#define MAX_THREADS      16
+#define MAX_STREAMS      16
+
+enum replay_op_type {
+    OP_OPEN_OUTPUT,
+    OP_OPEN_INPUT,
+    OP_WRITE,
+    OP_READ,
+    OP_STANDBY,
+    OP_SET_PARAMETERS,
+    OP_SET_MODE,
+    OP_VOICE_VOLUME,
+    OP_MIC_MUTE,
+    OP_WB_AMR,
+    OP_CLOSE,
+    OP_SLEEP,
+    OP_CNT
+};
+
+static const char * const op_names[OP_CNT] = {
+    "open_output",
+    "open_input",
+    "write",
+    "read",
+    "standby",
+    "set_parameters",
+    "set_mode",
+    "voice_volume",
+    "mic_mute",
+    "wb_amr",
+    "close",
+    "sleep",
+};
+
+struct replay_op {
+    enum replay_op_type type;
+    unsigned int line;
+    uint64_t time_ms;
+    char stream[MAX_NAME];
+    char args[MAX_ARGS];
+    struct replay_op *next;
+};
+
+struct replay_thread {
+    char name[MAX_NAME];
+    pthread_t thread;
+    struct replay_op *ops;
+    struct replay_op *last;
+};
+
+struct replay_stream {
+    char name[MAX_NAME];
+    bool input;
+    union {
+        struct audio_stream_out *out;
+        struct audio_stream_in *in;
+    };
+    unsigned int rate;
+    size_t frame_size;
+    uint64_t bytes;
+    uint64_t busy_ns;               /* spent in write() or read() */
+    uint64_t nominal_ns;            /* audio moved, at the nominal rate */
+};
+
+struct samples {
+    uint64_t *us;
+    uint64_t *busy_us;
+    unsigned int count;
+    unsigned int size;
+};
+
+static struct audio_hw_device *dev;
+static uint64_t start_ns;
+
+static struct replay_thread threads[MAX_THREADS];
+static unsigned int thread_count;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct replay_stream streams[MAX_STREAMS];
+static struct samples samples[OP_CNT];
+static unsigned int errors;
+
+static void (*stub_get_stats)(struct tinyalsa_stub_stats *stats);
+static uint64_t (*stub_thread_wait_ns)(void);
+static int (*fake_secril_unsolicited)(uint32_t id, int32_t arg);
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t thread_wait_ns(void)
+{
+    return stub_thread_wait_ns ? stub_thread_wait_ns() : 0;
+}
+
+static void add_sample(enum replay_op_type type, uint64_t ns, uint64_t busy_ns)
+{
+    struct samples *s = &samples[type];
+
+    pthread_mutex_lock(&lock);
+    if (s->count == s->size) {
+        s->size = s->size ? s->size * 2 : 64;
+        s->us = realloc(s->us, s->size * sizeof(uint64_t));
+        s->busy_us = realloc(s->busy_us, s->size * sizeof(uint64_t));
+        if (s->us == NULL || s->busy_us == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    s->us[s->count] = ns / 1000;
+    s->busy_us[s->count] = busy_ns / 1000;
+    s->count++;
+    pthread_mutex_unlock(&lock);
+}
+
+static void op_error(const struct replay_op *op, const char *what, int err)
+{
+    fprintf(stderr, "line %u: %s %s: %s\n", op->line, op_names[op->type],
+            op->stream, what ? what : strerror(-err));
+    pthread_mutex_lock(&lock);
+    errors++;
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Streams are looked up by name under the lock, but used without it: the
+ * trace is expected to open a stream before, and close it after, any
+ * other thread touches it.
+ */
+static struct replay_stream *get_stream(const char *name)
+{
+    struct replay_stream *stream = NULL;
+    int i;
+
+    pthread_mutex_lock(&lock);
+    for (i = 0; i < MAX_STREAMS; i++) {
+        if (streams[i].out != NULL && strcmp(streams[i].name, name) == 0) {
+            stream = &streams[i];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+
+    return stream;
+}
+
+static struct replay_stream *add_stream(const char *name)
+{
+    struct replay_stream *stream = NULL;
+    int i;
+
+    pthread_mutex_lock(&lock);
+    for (i = 0; i < MAX_STREAMS; i++) {
+        if (streams[i].out == NULL && streams[i].name[0] == '\0') {
+            stream = &streams[i];
+            strncpy(stream->name, name, MAX_NAME - 1);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+
+    return stream;
+}
+
+static int open_stream(const struct replay_op *op, struct replay_stream *stream)
+{
+    struct audio_config config;
+    unsigned long devices, arg, rate;
+    int handle = stream - streams + 1;
+    char *p, *end;
+    int ret;
+
+    /* input devices have the top bit set, too much for %li on 32 bit */
+    devices = strtoul(op->args, &p, 0);
+    arg = strtoul(p, &end, 0);
+    if (p == op->args || end == p)
+        return -EINVAL;
+    rate = strtoul(end, NULL, 0);
+
+    memset(&config, 0, sizeof(config));
+    config.sample_rate = rate ? rate : DEFAULT_RATE;
+    config.format = AUDIO_FORMAT_PCM_16_BIT;
+
+    if (op->type == OP_OPEN_OUTPUT) {
+        config.channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+        ret = dev->open_output_stream(dev, handle, devices, arg, &config,
+                                      &stream->out, NULL);
+        if (ret == 0) {
+            stream->rate = stream->out->common.get_sample_rate(
+                    &stream->out->common);
+            stream->frame_size = audio_stream_out_frame_size(stream->out);
+        }
+    } else {
+        config.channel_mask = AUDIO_CHANNEL_IN_MONO;
+        ret = dev->open_input_stream(dev, handle, devices, &config,
+                                     &stream->in, AUDIO_INPUT_FLAG_NONE,
+                                     NULL, arg);
+        /* like AudioFlinger, retry once with the config the HAL suggests */
+        if (ret == -EINVAL)
+            ret = dev->open_input_stream(dev, handle, devices, &config,
+                                         &stream->in, AUDIO_INPUT_FLAG_NONE,
+                                         NULL, arg);
+        if (ret == 0) {
+            stream->input = true;
+            stream->rate = stream->in->common.get_sample_rate(
+                    &stream->in->common);
+            stream->frame_size = audio_stream_in_frame_size(stream->in);
+        }
+    }
+
+    return ret;
+}
+
+/* Moves ms worth of audio through the stream, a HAL buffer at a time */
+static void transfer(const struct replay_op *op, struct replay_stream *stream,
+                     unsigned int ms)
+{
+    struct audio_stream *common = stream->input ? &stream->in->common :
+                                                  &stream->out->common;
+    size_t size = common->get_buffer_size(common);
+    uint64_t left = (uint64_t)stream->rate * ms / 1000 * stream->frame_size;
+    uint64_t start, wait;
+    ssize_t ret;
+    void *buf;
+
+    if (size == 0 || stream->frame_size == 0) {
+        op_error(op, "bad buffer size", 0);
+        return;
+    }
+
+    buf = calloc(1, size);
+    if (buf == NULL) {
+        op_error(op, NULL, -ENOMEM);
+        return;
+    }
+
+    while (left > 0) {
+        if (size > left)
+            size = left;
+
+        wait = thread_wait_ns();
+        start = now_ns();
+        if (stream->input)
+            ret = stream->in->read(stream->in, buf, size);
+        else
+            ret = stream->out->write(stream->out, buf, size);
+        start = now_ns() - start;
+        wait = thread_wait_ns() - wait;
+
+        if (ret <= 0) {
+            op_error(op, NULL, ret < 0 ? (int)ret : -EIO);
+            break;
+        }
+
+        add_sample(op->type, start, start > wait ? start - wait : 0);
+        stream->bytes += ret;
+        stream->busy_ns += start;
+        stream->nominal_ns += (uint64_t)ret / stream->frame_size *
+                              1000000000 / stream->rate;
+        left -= ret < (ssize_t)left ? (uint64_t)ret : left;
+    }
+
+    free(buf);
+}
+
+static void run_op(const struct replay_op *op)
+{
+    struct replay_stream *stream = NULL;
+    struct audio_stream *common = NULL;
+    uint64_t start, wait;
+    int ret = 0;
+
+    if (op->type == OP_SLEEP) {
+        usleep(strtoul(op->args, NULL, 0) * 1000);
+        return;
+    }
+
+    if (op->type == OP_OPEN_OUTPUT || op->type == OP_OPEN_INPUT) {
+        stream = get_stream(op->stream) ? NULL : add_stream(op->stream);
+        if (stream == NULL) {
+            op_error(op, "stream already open or too many streams", 0);
+            return;
+        }
+    } else if (op->stream[0] != '\0' && strcmp(op->stream, "adev") != 0) {
+        stream = get_stream(op->stream);
+        if (stream == NULL) {
+            op_error(op, "no such stream", 0);
+            return;
+        }
+        common = stream->input ? &stream->in->common : &stream->out->common;
+    }
+
+    if (op->type == OP_WRITE || op->type == OP_READ) {
+        if (stream->input != (op->type == OP_READ))
+            op_error(op, "wrong stream direction", 0);
+        else
+            transfer(op, stream, strtoul(op->args, NULL, 0));
+        return;
+    }
+
+    wait = thread_wait_ns();
+    start = now_ns();
+
+    switch (op->type) {
+    case OP_OPEN_OUTPUT:
+    case OP_OPEN_INPUT:
+        ret = open_stream(op, stream);
+        if (ret != 0) {
+            /* release the slot again */
+            pthread_mutex_lock(&lock);
+            memset(stream, 0, sizeof(*stream));
+            pthread_mutex_unlock(&lock);
+        }
+        break;
+    case OP_STANDBY:
+        ret = common->standby(common);
+        break;
+    case OP_SET_PARAMETERS:
+        if (common == NULL)
+            ret = dev->set_parameters(dev, op->args);
+        else
+            ret = common->set_parameters(common, op->args);
+        break;
+    case OP_SET_MODE:
+        ret = dev->set_mode(dev, strtol(op->args, NULL, 0));
+        break;
+    case OP_VOICE_VOLUME:
+        ret = dev->set_voice_volume(dev, strtof(op->args, NULL));
+        break;
+    case OP_MIC_MUTE:
+        ret = dev->set_mic_mute(dev, strtol(op->args, NULL, 0) != 0);
+        break;
+    case OP_WB_AMR:
+        ret = -ENOSYS;
+        if (fake_secril_unsolicited != NULL &&
+                fake_secril_unsolicited(RIL_UNSOL_SNDMGR_WB_AMR_REPORT,
+                                        strtol(op->args, NULL, 0)) ==
+                        RIL_CLIENT_ERR_SUCCESS)
+            ret = 0;
+        break;
+    case OP_CLOSE:
+        if (stream->input)
+            dev->close_input_stream(dev, stream->in);
+        else
+            dev->close_output_stream(dev, stream->out);
+        pthread_mutex_lock(&lock);
+        stream->out = NULL;
+        pthread_mutex_unlock(&lock);
+        break;
+    default:
+        break;
+    }
+
+    start = now_ns() - start;
+    wait = thread_wait_ns() - wait;
+
+    /* set_parameters returns whatever the last key lookup did */
+    if (ret != 0 && op->type != OP_SET_PARAMETERS)
+        op_error(op, NULL, ret);
+    add_sample(op->type, start, start > wait ? start - wait : 0);
+}
+
+static void *replay_thread_loop(void *context)
+{
+    struct replay_thread *thread = context;
+    struct replay_op *op;
+    uint64_t now, due;
+
+    for (op = thread->ops; op != NULL; op = op->next) {
+        now = now_ns();
+        due = start_ns + op->time_ms * 1000000;
+        if (due > now)
+            usleep((due - now) / 1000);
+        run_op(op);
+    }
+
+    return NULL;
+}
+
+static struct replay_thread *get_thread(const char *name)
+{
+    unsigned int i;
+
+    for (i = 0; i < thread_count; i++) {
+        if (strcmp(threads[i].name, name) == 0)
+            return &threads[i];
+    }
+
+    if (thread_count == MAX_THREADS)
+        return NULL;
+
+    strncpy(threads[thread_count].name, name, MAX_NAME - 1);
+
+    return &threads[thread_count++];
+}
+
+static int load_trace(const char *path)
+{
+    struct replay_thread *thread;
+    struct replay_op *op;
+    char line[512];
+    char thread_name[MAX_NAME];
+    char op_name[MAX_NAME];
+    unsigned long long time_ms;
+    unsigned int line_no = 0;
+    char *p;
+    int n, i;
+    FILE *f;
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        line_no++;
+        p = strchr(line, '#');
+        if (p != NULL)
+            *p = '\0';
+        p = line + strlen(line);
+        while (p > line && (p[-1] == '\n' || p[-1] == ' ' || p[-1] == '\t'))
+            *--p = '\0';
+
+        if (sscanf(line, "%llu %31s %31s %n", &time_ms, thread_name, op_name,
+                   &n) < 3) {
+            if (strspn(line, " \t") != strlen(line))
+                goto bad_line;
+            continue;
+        }
+
+        for (i = 0; i < OP_CNT; i++) {
+            if (strcmp(op_name, op_names[i]) == 0)
+                break;
+        }
+        if (i == OP_CNT)
+            goto bad_line;
+
+        op = calloc(1, sizeof(struct replay_op));
+        if (op == NULL) {
+            fclose(f);
+            return -1;
+        }
+        op->type = i;
+        op->line = line_no;
+        op->time_ms = time_ms;
+
+        /* all but the device wide ops name a stream first */
+        p = line + n;
+        if (i != OP_SET_MODE && i != OP_VOICE_VOLUME && i != OP_MIC_MUTE &&
+                i != OP_WB_AMR && i != OP_SLEEP) {
+            if (sscanf(p, "%31s %n", op->stream, &n) < 1) {
+                free(op);
+                goto bad_line;
+            }
+            p += n;
+        }
+        strncpy(op->args, p, MAX_ARGS - 1);
+
+        thread = get_thread(thread_name);
+        if (thread == NULL) {
+            fprintf(stderr, "%s:%u: too many threads\n", path, line_no);
+            free(op);
+            fclose(f);
+            return -1;
+        }
+        if (thread->last != NULL)
+            thread->last->next = op;
+        else
+            thread->ops = op;
+        thread->last = op;
+    }
+
+    fclose(f);
+
+    return 0;
+
+bad_line:
+    fprintf(stderr, "%s:%u: cannot parse '%s'\n", path, line_no, line);
+    fclose(f);
+    return -1;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* the HAL opened a PCM it had open already or raced itself on one */
+static void check_stub_stats(void)
+{
+    struct tinyalsa_stub_stats stats;
+
+    if (stub_get_stats == NULL)
+        return;
+
+    stub_get_stats(&stats);
+    if (stats.busy_opens > 0 || stats.concurrent_calls > 0) {
+        fprintf(stderr, "tinyalsa: %u busy opens, %u concurrent calls\n",
+                stats.busy_opens, stats.concurrent_calls);
+        errors += stats.busy_opens + stats.concurrent_calls;
+    }
+}
+
+static void print_report(uint64_t elapsed_ns)
+{
+    struct tinyalsa_stub_stats stats;
+    struct replay_stream *stream;
+    struct samples *s;
+    int i;
+
+    printf("replayed in %llu ms, %u errors\n\n",
+           (unsigned long long)(elapsed_ns / 1000000), errors);
+
+    printf("%-15s %7s %9s %9s %9s %9s %11s %9s\n", "op (us)", "count",
+           "min", "median", "p95", "max", "busy med", "busy p95");
+    for (i = 0; i < OP_CNT; i++) {
+        s = &samples[i];
+        if (s->count == 0)
+            continue;
+        qsort(s->us, s->count, sizeof(uint64_t), compare_u64);
+        qsort(s->busy_us, s->count, sizeof(uint64_t), compare_u64);
+        printf("%-15s %7u %9llu %9llu %9llu %9llu %11llu %9llu\n",
+               op_names[i], s->count,
+               (unsigned long long)s->us[0],
+               (unsigned long long)s->us[s->count / 2],
+               (unsigned long long)s->us[s->count * 95 / 100],
+               (unsigned long long)s->us[s->count - 1],
+               (unsigned long long)s->busy_us[s->count / 2],
+               (unsigned long long)s->busy_us[s->count * 95 / 100]);
+    }
+
+    printf("\n%-15s %6s %7s %11s %12s %9s\n", "stream", "dir", "rate",
+           "bytes", "audio (ms)", "realtime");
+    for (i = 0; i < MAX_STREAMS; i++) {
+        stream = &streams[i];
+        if (stream->name[0] == '\0' || stream->busy_ns == 0)
+            continue;
+        /* below 1.00 the HAL fell behind the DMA */
+        printf("%-15s %6s %7u %11llu %12llu %9.2f\n", stream->name,
+               stream->input ? "in" : "out", stream->rate,
+               (unsigned long long)stream->bytes,
+               (unsigned long long)(stream->nominal_ns / 1000000),
+               (double)stream->nominal_ns / stream->busy_ns);
+    }
+
+    if (stub_get_stats != NULL) {
+        stub_get_stats(&stats);
+        printf("\ntinyalsa: %u pcm opens, %u writes (%llu frames), "
+               "%u reads (%llu frames)\n", stats.pcm_opens, stats.pcm_writes,
+               (unsigned long long)stats.frames_written, stats.pcm_reads,
+               (unsigned long long)stats.frames_read);
+        printf("tinyalsa: %u underruns, %u overruns, %u mixer writes, "
+               "%u mixer reads\n", stats.underruns, stats.overruns,
+               stats.mixer_writes, stats.mixer_reads);
+        printf("tinyalsa: %u busy opens, %u concurrent calls\n",
+               stats.busy_opens, stats.concurrent_calls);
+    }
+
+    printf("\n");
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    const struct hw_module_t *module;
+    const char *path = DEFAULT_MODULE;
+    uint64_t elapsed;
+    void *handle;
+    unsigned int i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:")) != -1) {
+        switch (opt) {
+        case 'm':
+            path = optarg;
+            break;
+        default:
+            goto usage;
+        }
+    }
+
+    if (optind != argc - 1)
+        goto usage;
+
+    if (load_trace(argv[optind]) != 0)
+        return 1;
+
+    handle = dlopen(path, RTLD_NOW);
+    if (handle == NULL) {
+        fprintf(stderr, "%s\n", dlerror());
+        return 1;
+    }
+
+    module = dlsym(handle, HAL_MODULE_INFO_SYM_AS_STR);
+    if (module == NULL) {
+        fprintf(stderr, "%s is not a HAL module\n", path);
+        return 1;
+    }
+
+    /* only there when running against the host tinyalsa stub */
+    stub_get_stats = dlsym(handle, "tinyalsa_stub_get_stats");
+    stub_thread_wait_ns = dlsym(handle, "tinyalsa_stub_thread_wait_ns");
+    /* only there when running against the fake secril-client */
+    fake_secril_unsolicited = dlsym(handle, "fake_secril_unsolicited");
+
+    if (audio_hw_device_open(module, &dev) != 0) {
+        fprintf(stderr, "cannot open the audio device\n");
+        return 1;
+    }
+
+    start_ns = now_ns();
+    for (i = 0; i < thread_count; i++) {
+        if (pthread_create(&threads[i].thread, NULL, replay_thread_loop,
+                           &threads[i]) != 0) {
+            fprintf(stderr, "cannot start thread %s\n", threads[i].name);
+            return 1;
+        }
+    }
+
+    for (i = 0; i < thread_count; i++)
+        pthread_join(threads[i].thread, NULL);
+    elapsed = now_ns() - start_ns;
+
+    check_stub_stats();
+    print_report(elapsed);
+    dev->dump(dev, STDOUT_FILENO);
+
+    /* whatever the trace left open */
+    for (i = 0; i < MAX_STREAMS; i++) {
+        if (streams[i].out == NULL)
+            continue;
+        if (streams[i].input)
+            dev->close_input_stream(dev, streams[i].in);
+        else
+            dev->close_output_stream(dev, streams[i].out);
+    }
+    audio_hw_device_close(dev);
+
+    return errors ? 1 : 0;
+
+usage:
+    fprintf(stderr, "usage: %s [-m audio.primary.so] trace\n", argv[0]);
+    return 2;
+}
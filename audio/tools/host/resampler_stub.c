@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2015 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * audio_utils resampler for the host build of the audio HAL, whose host
+ * libaudioutils lacks it. Frames are picked nearest neighbour: the data
+ * is not listened to, only the frame counts and buffer provider calls
+ * have to match.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <audio_utils/resampler.h>
+
+#define BLOCK_FRAMES 256
+
+struct stub_resampler {
+    struct resampler_itfe itfe;     /* must stay first */
+    struct resampler_buffer_provider *provider;
+    uint32_t in_rate;
+    uint32_t out_rate;
+    uint32_t channels;
+    struct resampler_buffer buf;
+    size_t pos;                     /* input frame, may run past buf */
+    uint32_t phase;
+};
+
+/* Makes pos point into a buffer from the provider, false when it has none */
+static bool get_input(struct stub_resampler *rs)
+{
+    while (rs->buf.raw == NULL || rs->pos >= rs->buf.frame_count) {
+        if (rs->buf.raw != NULL) {
+            rs->pos -= rs->buf.frame_count;
+            rs->provider->release_buffer(rs->provider, &rs->buf);
+            rs->buf.raw = NULL;
+        }
+
+        rs->buf.frame_count = BLOCK_FRAMES;
+        rs->provider->get_next_buffer(rs->provider, &rs->buf);
+        if (rs->buf.raw == NULL || rs->buf.frame_count == 0) {
+            rs->buf.raw = NULL;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void stub_reset(struct resampler_itfe *resampler)
+{
+    struct stub_resampler *rs = (struct stub_resampler *)resampler;
+
+    if (rs->buf.raw != NULL)
+        rs->provider->release_buffer(rs->provider, &rs->buf);
+    rs->buf.raw = NULL;
+    rs->pos = 0;
+    rs->phase = 0;
+}
+
+static int stub_resample_from_provider(struct resampler_itfe *resampler,
+                                       int16_t *out, size_t *out_frame_count)
+{
+    struct stub_resampler *rs = (struct stub_resampler *)resampler;
+    size_t i;
+
+    for (i = 0; i < *out_frame_count; i++) {
+        if (!get_input(rs))
+            break;
+
+        memcpy(out + i * rs->channels, rs->buf.i16 + rs->pos * rs->channels,
+               rs->channels * sizeof(int16_t));
+
+        rs->phase += rs->in_rate;
+        while (rs->phase >= rs->out_rate) {
+            rs->phase -= rs->out_rate;
+            rs->pos++;
+        }
+    }
+
+    /* hand back a used up buffer now, the provider may want to reuse it */
+    if (rs->buf.raw != NULL && rs->pos >= rs->buf.frame_count) {
+        rs->pos -= rs->buf.frame_count;
+        rs->provider->release_buffer(rs->provider, &rs->buf);
+        rs->buf.raw = NULL;
+    }
+
+    *out_frame_count = i;
+
+    return 0;
+}
+
+static int stub_resample_from_input(struct resampler_itfe *resampler,
+                                    int16_t *in, size_t *in_frame_count,
+                                    int16_t *out, size_t *out_frame_count)
+{
+    *in_frame_count = 0;
+    *out_frame_count = 0;
+
+    return -ENOSYS;
+}
+
+static int32_t stub_delay_ns(struct resampler_itfe *resampler)
+{
+    return 0;
+}
+
+int create_resampler(uint32_t inSampleRate, uint32_t outSampleRate,
+                     uint32_t channelCount, uint32_t quality,
+                     struct resampler_buffer_provider *provider,
+                     struct resampler_itfe **resampler)
+{
+    struct stub_resampler *rs;
+
+    if (resampler == NULL)
+        return -EINVAL;
+
+    *resampler = NULL;
+
+    if (provider == NULL || inSampleRate == 0 || outSampleRate == 0 ||
+            channelCount == 0)
+        return -EINVAL;
+
+    rs = calloc(1, sizeof(struct stub_resampler));
+    if (rs == NULL)
+        return -ENOMEM;
+
+    rs->itfe.reset = stub_reset;
+    rs->itfe.resample_from_provider = stub_resample_from_provider;
+    rs->itfe.resample_from_input = stub_resample_from_input;
+    rs->itfe.delay_ns = stub_delay_ns;
+    rs->provider = provider;
+    rs->in_rate = inSampleRate;
+    rs->out_rate = outSampleRate;
+    rs->channels = channelCount;
+
+    *resampler = &rs->itfe;
+
+    return 0;
+}
+
+void release_resampler(struct resampler_itfe *resampler)
+{
+    free(resampler);
+}
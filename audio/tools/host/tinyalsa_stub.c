@@ -0,0 +1,706 @@
+/*
+ * Copyright (C) 2015 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * tinyalsa for the host build of the audio HAL.
+ *
+ * PCMs have no sound card behind them. A running playback PCM consumes
+ * frames at its rate from the moment it starts, a capture PCM produces
+ * them, so writes and reads block for as long as on the phone. A writer
+ * falling behind the clock gets an underrun and the PCM restarts, as
+ * tinyalsa does on EPIPE.
+ *
+ * Like ALSA, a device can be open once per direction, another open gets
+ * a PCM which is not ready and reports the device busy. Calls made on a
+ * PCM while another thread is in one on the same PCM are counted, tinyalsa
+ * handles are not safe for that.
+ *
+ * The mixer exposes the controls mixer_paths.xml and default_gain.conf
+ * refer to: controls set to numbers are integers, the others enums whose
+ * strings are the values found in the files.
+ */
+
+#define LOG_TAG "tinyalsa_stub"
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <cutils/log.h>
+#include <expat.h>
+#include <tinyalsa/asoundlib.h>
+
+#include "route_engine.h"
+#include "tinyalsa_stub.h"
+
+#define MAX_ENUMS 64
+#define MAX_VALUES 128
+
+struct pcm {
+    unsigned int card;
+    unsigned int device;
+    unsigned int flags;
+    struct pcm_config config;
+    unsigned int buffer_frames;
+    unsigned int frame_size;
+    bool running;
+    uint64_t start_ns;
+    uint64_t frames;            /* written or read since the start */
+    bool busy;                  /* the device was open already */
+    atomic_uint users;          /* threads in a call on this PCM */
+    struct pcm *next;           /* in open_pcms */
+};
+
+struct mixer_ctl {
+    char *name;
+    enum mixer_ctl_type type;
+    unsigned int num_values;
+    int values[MAX_VALUES];
+    char *enums[MAX_ENUMS];
+    unsigned int num_enums;
+};
+
+struct mixer {
+    struct mixer_ctl *ctls;
+    unsigned int num_ctls;
+    unsigned int size;
+};
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct tinyalsa_stub_stats stats;
+static struct pcm *open_pcms;   /* ready PCMs, under stats_lock */
+static __thread uint64_t thread_wait_ns;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t deadline)
+{
+    uint64_t start = now_ns();
+    struct timespec ts;
+
+    if (deadline <= start)
+        return;
+
+    ts.tv_sec = deadline / 1000000000;
+    ts.tv_nsec = deadline % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+
+    thread_wait_ns += now_ns() - start;
+}
+
+/* frames the DMA went through since the start */
+static uint64_t dma_frames(struct pcm *pcm, uint64_t now)
+{
+    return (now - pcm->start_ns) * pcm->config.rate / 1000000000;
+}
+
+static uint64_t dma_time_ns(struct pcm *pcm, uint64_t frames)
+{
+    return pcm->start_ns + frames * 1000000000 / pcm->config.rate;
+}
+
+void tinyalsa_stub_get_stats(struct tinyalsa_stub_stats *out)
+{
+    pthread_mutex_lock(&stats_lock);
+    *out = stats;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+uint64_t tinyalsa_stub_thread_wait_ns(void)
+{
+    return thread_wait_ns;
+}
+
+static void pcm_enter(struct pcm *pcm)
+{
+    if (atomic_fetch_add(&pcm->users, 1) == 0)
+        return;
+
+    pthread_mutex_lock(&stats_lock);
+    stats.concurrent_calls++;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static void pcm_leave(struct pcm *pcm)
+{
+    atomic_fetch_sub(&pcm->users, 1);
+}
+
+static void start_dma(struct pcm *pcm)
+{
+    pcm->running = true;
+    pcm->start_ns = now_ns();
+    pcm->frames = 0;
+}
+
+static void stop_dma(struct pcm *pcm)
+{
+    pcm->running = false;
+    pcm->frames = 0;
+}
+
+/* PCM functions */
+
+struct pcm *pcm_open(unsigned int card, unsigned int device,
+                     unsigned int flags, struct pcm_config *config)
+{
+    struct pcm *pcm, *other;
+
+    if (config == NULL || config->rate == 0 || config->channels == 0)
+        return NULL;
+
+    pcm = calloc(1, sizeof(struct pcm));
+    if (pcm == NULL)
+        return NULL;
+
+    pcm->card = card;
+    pcm->device = device;
+    pcm->flags = flags;
+    pcm->config = *config;
+    pcm->buffer_frames = config->period_size * config->period_count;
+    pcm->frame_size = config->channels * pcm_format_to_bits(config->format) / 8;
+    if (pcm->config.start_threshold == 0)
+        pcm->config.start_threshold = pcm->buffer_frames / 2;
+    atomic_init(&pcm->users, 0);
+
+    pthread_mutex_lock(&stats_lock);
+    stats.pcm_opens++;
+    for (other = open_pcms; other != NULL; other = other->next) {
+        if (other->card == card && other->device == device &&
+                (other->flags & PCM_IN) == (flags & PCM_IN))
+            pcm->busy = true;
+    }
+    if (pcm->busy) {
+        stats.busy_opens++;
+    } else {
+        pcm->next = open_pcms;
+        open_pcms = pcm;
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    return pcm;
+}
+
+int pcm_close(struct pcm *pcm)
+{
+    struct pcm **p;
+
+    if (pcm == NULL)
+        return 0;
+
+    pcm_enter(pcm);
+
+    pthread_mutex_lock(&stats_lock);
+    for (p = &open_pcms; *p != NULL; p = &(*p)->next) {
+        if (*p == pcm) {
+            *p = pcm->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    free(pcm);
+
+    return 0;
+}
+
+int pcm_is_ready(struct pcm *pcm)
+{
+    return pcm != NULL && !pcm->busy;
+}
+
+const char *pcm_get_error(struct pcm *pcm)
+{
+    return pcm != NULL && pcm->busy ?
+            "cannot open device: Device or resource busy" : "no error";
+}
+
+unsigned int pcm_format_to_bits(enum pcm_format format)
+{
+    switch (format) {
+    case PCM_FORMAT_S32_LE:
+    case PCM_FORMAT_S24_LE:
+        return 32;
+    case PCM_FORMAT_S8:
+        return 8;
+    default:
+        return 16;
+    }
+}
+
+unsigned int pcm_frames_to_bytes(struct pcm *pcm, unsigned int frames)
+{
+    return frames * pcm->frame_size;
+}
+
+unsigned int pcm_bytes_to_frames(struct pcm *pcm, unsigned int bytes)
+{
+    return bytes / pcm->frame_size;
+}
+
+unsigned int pcm_get_buffer_size(struct pcm *pcm)
+{
+    return pcm->buffer_frames;
+}
+
+int pcm_start(struct pcm *pcm)
+{
+    pcm_enter(pcm);
+    start_dma(pcm);
+    pcm_leave(pcm);
+
+    return 0;
+}
+
+int pcm_stop(struct pcm *pcm)
+{
+    pcm_enter(pcm);
+    stop_dma(pcm);
+    pcm_leave(pcm);
+
+    return 0;
+}
+
+int pcm_prepare(struct pcm *pcm)
+{
+    return pcm_stop(pcm);
+}
+
+int pcm_write(struct pcm *pcm, const void *data, unsigned int count)
+{
+    unsigned int frames = count / pcm->frame_size;
+    uint64_t played;
+    bool underrun = false;
+
+    pcm_enter(pcm);
+
+    if (pcm->running) {
+        played = dma_frames(pcm, now_ns());
+        if (played > pcm->frames) {
+            /* the DMA ran dry, start over with this buffer */
+            underrun = true;
+            pcm->running = false;
+            pcm->frames = 0;
+        } else if (pcm->frames + frames > played + pcm->buffer_frames) {
+            sleep_until(dma_time_ns(pcm, pcm->frames + frames -
+                                    pcm->buffer_frames));
+        }
+    }
+
+    pcm->frames += frames;
+
+    /* the DMA starts on what is queued once the threshold is reached */
+    if (!pcm->running && pcm->frames >= pcm->config.start_threshold) {
+        pcm->running = true;
+        pcm->start_ns = now_ns();
+    }
+
+    pthread_mutex_lock(&stats_lock);
+    stats.pcm_writes++;
+    stats.frames_written += frames;
+    if (underrun)
+        stats.underruns++;
+    pthread_mutex_unlock(&stats_lock);
+
+    pcm_leave(pcm);
+
+    return 0;
+}
+
+int pcm_read(struct pcm *pcm, void *data, unsigned int count)
+{
+    unsigned int frames = count / pcm->frame_size;
+    uint64_t captured;
+    bool overrun = false;
+
+    pcm_enter(pcm);
+
+    if (!pcm->running)
+        start_dma(pcm);
+
+    captured = dma_frames(pcm, now_ns());
+    if (captured > pcm->frames + pcm->buffer_frames) {
+        /* the reader fell a buffer behind, the oldest frames are gone */
+        overrun = true;
+        pcm->frames = captured;
+    }
+    if (pcm->frames + frames > captured)
+        sleep_until(dma_time_ns(pcm, pcm->frames + frames));
+
+    pcm->frames += frames;
+    memset(data, 0, count);
+
+    pthread_mutex_lock(&stats_lock);
+    stats.pcm_reads++;
+    stats.frames_read += frames;
+    if (overrun)
+        stats.overruns++;
+    pthread_mutex_unlock(&stats_lock);
+
+    pcm_leave(pcm);
+
+    return 0;
+}
+
+int pcm_get_htimestamp(struct pcm *pcm, unsigned int *avail,
+                       struct timespec *tstamp)
+{
+    uint64_t now = now_ns();
+    uint64_t played;
+
+    if (!pcm->running)
+        return -1;
+
+    played = dma_frames(pcm, now);
+    if (played > pcm->frames)
+        played = pcm->frames;
+
+    *avail = pcm->buffer_frames - (unsigned int)(pcm->frames - played);
+    tstamp->tv_sec = now / 1000000000;
+    tstamp->tv_nsec = now % 1000000000;
+
+    return 0;
+}
+
+/* Mixer functions */
+
+static struct mixer_ctl *find_ctl(struct mixer *mixer, const char *name)
+{
+    unsigned int i;
+
+    for (i = 0; i < mixer->num_ctls; i++) {
+        if (strcmp(mixer->ctls[i].name, name) == 0)
+            return &mixer->ctls[i];
+    }
+
+    return NULL;
+}
+
+static bool is_number(const char *value)
+{
+    if (*value == '-')
+        value++;
+
+    return isdigit((unsigned char)*value);
+}
+
+static void add_enum(struct mixer_ctl *ctl, const char *value)
+{
+    unsigned int i;
+
+    for (i = 0; i < ctl->num_enums; i++) {
+        if (strcmp(ctl->enums[i], value) == 0)
+            return;
+    }
+
+    if (ctl->num_enums < MAX_ENUMS)
+        ctl->enums[ctl->num_enums++] = strdup(value);
+}
+
+static void add_setting(struct mixer *mixer, const char *name,
+                        const char *value, const char *id)
+{
+    struct mixer_ctl *ctl;
+    unsigned int n;
+
+    ctl = find_ctl(mixer, name);
+    if (ctl == NULL) {
+        if (mixer->num_ctls == mixer->size) {
+            mixer->size = mixer->size ? mixer->size * 2 : 256;
+            mixer->ctls = realloc(mixer->ctls,
+                                  mixer->size * sizeof(struct mixer_ctl));
+            if (mixer->ctls == NULL)
+                abort();
+        }
+        ctl = &mixer->ctls[mixer->num_ctls++];
+        memset(ctl, 0, sizeof(*ctl));
+        ctl->name = strdup(name);
+        ctl->num_values = 1;
+        if (is_number(value)) {
+            ctl->type = MIXER_CTL_TYPE_INT;
+        } else {
+            ctl->type = MIXER_CTL_TYPE_ENUM;
+            /* a control starts on a value no path sets */
+            add_enum(ctl, "Off");
+        }
+    }
+
+    if (ctl->type == MIXER_CTL_TYPE_ENUM) {
+        add_enum(ctl, value);
+    } else if (id != NULL) {
+        n = atoi(id) + 1;
+        if (n > ctl->num_values && n <= MAX_VALUES)
+            ctl->num_values = n;
+    }
+}
+
+static void start_tag(void *data, const XML_Char *tag_name,
+                      const XML_Char **attr)
+{
+    const char *name = NULL, *value = NULL, *id = NULL;
+    unsigned int i;
+
+    if (strcmp(tag_name, "ctl") != 0)
+        return;
+
+    for (i = 0; attr[i]; i += 2) {
+        if (strcmp(attr[i], "name") == 0)
+            name = attr[i + 1];
+        else if (strcmp(attr[i], "value") == 0)
+            value = attr[i + 1];
+        else if (strcmp(attr[i], "id") == 0)
+            id = attr[i + 1];
+    }
+    if (name == NULL || value == NULL)
+        return;
+
+    add_setting(data, name, value, id);
+}
+
+/* The gain modifiers set controls no mixer path touches */
+static void load_gain_conf(struct mixer *mixer)
+{
+    char line[256];
+    char name[128];
+    char value[128];
+    FILE *file;
+
+    file = fopen(GAIN_CONF_PATH, "r");
+    if (file == NULL)
+        return;
+
+    /* { "HPOUT3 Digital Volume" , 128 }, or a quoted enum string */
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (sscanf(line, " { \"%127[^\"]\" , \"%127[^\"]\"",
+                   name, value) == 2 ||
+                sscanf(line, " { \"%127[^\"]\" , %127[^ },]",
+                       name, value) == 2)
+            add_setting(mixer, name, value, NULL);
+    }
+
+    fclose(file);
+}
+
+struct mixer *mixer_open(unsigned int card)
+{
+    struct mixer *mixer;
+    XML_Parser parser;
+    char buf[4096];
+    FILE *file;
+    size_t len;
+    int done;
+
+    file = fopen(MIXER_XML_PATH, "r");
+    if (file == NULL) {
+        ALOGE("%s: cannot open %s", __func__, MIXER_XML_PATH);
+        return NULL;
+    }
+
+    mixer = calloc(1, sizeof(struct mixer));
+    parser = XML_ParserCreate(NULL);
+    if (mixer == NULL || parser == NULL) {
+        free(mixer);
+        fclose(file);
+        return NULL;
+    }
+
+    XML_SetUserData(parser, mixer);
+    XML_SetElementHandler(parser, start_tag, NULL);
+
+    do {
+        len = fread(buf, 1, sizeof(buf), file);
+        done = len < sizeof(buf);
+        if (XML_Parse(parser, buf, len, done) == XML_STATUS_ERROR) {
+            ALOGE("%s: error in %s", __func__, MIXER_XML_PATH);
+            break;
+        }
+    } while (!done);
+
+    XML_ParserFree(parser);
+    fclose(file);
+
+    load_gain_conf(mixer);
+
+    return mixer;
+}
+
+void mixer_close(struct mixer *mixer)
+{
+    unsigned int i, j;
+
+    if (mixer == NULL)
+        return;
+
+    for (i = 0; i < mixer->num_ctls; i++) {
+        free(mixer->ctls[i].name);
+        for (j = 0; j < mixer->ctls[i].num_enums; j++)
+            free(mixer->ctls[i].enums[j]);
+    }
+    free(mixer->ctls);
+    free(mixer);
+}
+
+const char *mixer_get_name(struct mixer *mixer)
+{
+    return "host stub";
+}
+
+unsigned int mixer_get_num_ctls(struct mixer *mixer)
+{
+    return mixer->num_ctls;
+}
+
+struct mixer_ctl *mixer_get_ctl(struct mixer *mixer, unsigned int id)
+{
+    return id < mixer->num_ctls ? &mixer->ctls[id] : NULL;
+}
+
+struct mixer_ctl *mixer_get_ctl_by_name(struct mixer *mixer, const char *name)
+{
+    return find_ctl(mixer, name);
+}
+
+const char *mixer_ctl_get_name(struct mixer_ctl *ctl)
+{
+    return ctl->name;
+}
+
+enum mixer_ctl_type mixer_ctl_get_type(struct mixer_ctl *ctl)
+{
+    return ctl->type;
+}
+
+unsigned int mixer_ctl_get_num_values(struct mixer_ctl *ctl)
+{
+    return ctl->num_values;
+}
+
+unsigned int mixer_ctl_get_num_enums(struct mixer_ctl *ctl)
+{
+    return ctl->num_enums;
+}
+
+const char *mixer_ctl_get_enum_string(struct mixer_ctl *ctl,
+                                      unsigned int enum_id)
+{
+    return enum_id < ctl->num_enums ? ctl->enums[enum_id] : NULL;
+}
+
+int mixer_ctl_get_range_min(struct mixer_ctl *ctl)
+{
+    return 0;
+}
+
+int mixer_ctl_get_range_max(struct mixer_ctl *ctl)
+{
+    return ctl->type == MIXER_CTL_TYPE_ENUM ? (int)ctl->num_enums - 1 :
+                                              INT32_MAX;
+}
+
+int mixer_ctl_get_value(struct mixer_ctl *ctl, unsigned int id)
+{
+    if (id >= ctl->num_values)
+        return -EINVAL;
+
+    pthread_mutex_lock(&stats_lock);
+    stats.mixer_reads++;
+    pthread_mutex_unlock(&stats_lock);
+
+    return ctl->values[id];
+}
+
+int mixer_ctl_set_value(struct mixer_ctl *ctl, unsigned int id, int value)
+{
+    if (id >= ctl->num_values)
+        return -EINVAL;
+
+    ctl->values[id] = value;
+
+    pthread_mutex_lock(&stats_lock);
+    stats.mixer_writes++;
+    pthread_mutex_unlock(&stats_lock);
+
+    return 0;
+}
+
+/* integer controls travel as longs, byte controls as bytes, like the ioctl */
+int mixer_ctl_get_array(struct mixer_ctl *ctl, void *array, size_t count)
+{
+    size_t i;
+
+    if (count > ctl->num_values)
+        return -EINVAL;
+
+    for (i = 0; i < count; i++) {
+        if (ctl->type == MIXER_CTL_TYPE_BYTE)
+            ((uint8_t *)array)[i] = ctl->values[i];
+        else
+            ((long *)array)[i] = ctl->values[i];
+    }
+
+    pthread_mutex_lock(&stats_lock);
+    stats.mixer_reads++;
+    pthread_mutex_unlock(&stats_lock);
+
+    return 0;
+}
+
+int mixer_ctl_set_array(struct mixer_ctl *ctl, const void *array, size_t count)
+{
+    size_t i;
+
+    if (count > ctl->num_values)
+        return -EINVAL;
+
+    for (i = 0; i < count; i++) {
+        if (ctl->type == MIXER_CTL_TYPE_BYTE)
+            ctl->values[i] = ((const uint8_t *)array)[i];
+        else
+            ctl->values[i] = ((const long *)array)[i];
+    }
+
+    pthread_mutex_lock(&stats_lock);
+    stats.mixer_writes++;
+    pthread_mutex_unlock(&stats_lock);
+
+    return 0;
+}
+
+int mixer_ctl_set_enum_by_string(struct mixer_ctl *ctl, const char *string)
+{
+    unsigned int i;
+
+    for (i = 0; i < ctl->num_enums; i++) {
+        if (strcmp(ctl->enums[i], string) == 0)
+            return mixer_ctl_set_value(ctl, 0, i);
+    }
+
+    return -EINVAL;
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2015 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TINYALSA_STUB_H
+#define TINYALSA_STUB_H
+
+#include <stdint.h>
+
+/*
+ * Counters of the host tinyalsa stub, read by hal_replay. The PCMs play
+ * and capture against the monotonic clock as a DMA engine would, blocking
+ * writers on a full buffer and readers on an empty one.
+ */
+struct tinyalsa_stub_stats {
+    unsigned int pcm_opens;
+    unsigned int pcm_writes;
+    unsigned int pcm_reads;
+    uint64_t frames_written;
+    uint64_t frames_read;
+    unsigned int underruns;
+    unsigned int overruns;
+    unsigned int busy_opens;        /* of a device open already */
+    unsigned int concurrent_calls;  /* on a PCM another thread was in */
+    unsigned int mixer_writes;      /* set_value and set_array calls */
+    unsigned int mixer_reads;
+};
+
+/* Function prototypes */
+void tinyalsa_stub_get_stats(struct tinyalsa_stub_stats *stats);
+
+/* time the calling thread spent blocked on the simulated DMA */
+uint64_t tinyalsa_stub_thread_wait_ns(void);
+
+#endif
@@ -0,0 +1,325 @@
+/*
+ * Copyright (C) 2015 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Call setup and in-call routing latency of the audio HAL, as seen by
+ * AudioFlinger:
+ *
+ *   ril_bench [-m <audio.primary.so>] [-n <calls>] [-g <ms>]
+ *
+ * Every call is brought up with set_mode(IN_CALL), moved between earpiece,
+ * speaker and wired headset on the primary output, swept through the call
+ * volume and ended with set_mode(NORMAL). Min, median, 95th percentile and
+ * max of each step are printed, followed by the HAL dump.
+ *
+ * set_parameters() only hands a route change to the routing thread, which
+ * queues the RIL audio path in turn. A route change is timed until the HAL
+ * dump shows every route request applied and no RIL command outstanding,
+ * polled every DUMP_POLL_US.
+ *
+ * Run it against fake_rild to choose the modem behaviour:
+ *
+ *   fake_rild -l path=20 -l volume=5 &
+ *   LD_LIBRARY_PATH=/system/lib/fake-ril ril_bench -n 50
+ *
+ * Without -m the primary audio module is loaded through libhardware.
+ */
+
+#include <dlfcn.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <hardware/audio.h>
+#include <hardware/hardware.h>
+
+#define DEFAULT_CALLS  20
+#define DEFAULT_GAP_MS 100
+#define VOLUME_STEPS   20
+#define DUMP_POLL_US   500
+#define DUMP_SIZE      65536
+#define ROUTE_WAIT_US  5000000
+
+enum bench_step {
+    STEP_CALL_SETUP,
+    STEP_ROUTE_CHANGE,
+    STEP_VOLUME,
+    STEP_CALL_TEARDOWN,
+    STEP_CNT
+};
+
+static const char * const step_names[STEP_CNT] = {
+    "call setup",
+    "route change",
+    "call volume",
+    "call teardown",
+};
+
+static const audio_devices_t call_devices[] = {
+    AUDIO_DEVICE_OUT_EARPIECE,
+    AUDIO_DEVICE_OUT_SPEAKER,
+    AUDIO_DEVICE_OUT_WIRED_HEADSET,
+};
+
+#define CALL_DEVICE_CNT (sizeof(call_devices) / sizeof(call_devices[0]))
+
+struct samples {
+    uint64_t *us;
+    unsigned int count;
+    unsigned int size;
+};
+
+static struct samples samples[STEP_CNT];
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void add_sample(enum bench_step step, uint64_t start)
+{
+    struct samples *s = &samples[step];
+
+    if (s->count == s->size) {
+        s->size = s->size ? s->size * 2 : 64;
+        s->us = realloc(s->us, s->size * sizeof(uint64_t));
+        if (s->us == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+
+    s->us[s->count++] = now_us() - start;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void print_samples(void)
+{
+    struct samples *s;
+    int i;
+
+    printf("%-14s %8s %10s %10s %10s %10s\n", "step (us)", "count", "min",
+           "median", "p95", "max");
+    for (i = 0; i < STEP_CNT; i++) {
+        s = &samples[i];
+        if (s->count == 0)
+            continue;
+        qsort(s->us, s->count, sizeof(uint64_t), compare_u64);
+        printf("%-14s %8u %10llu %10llu %10llu %10llu\n", step_names[i],
+               s->count,
+               (unsigned long long)s->us[0],
+               (unsigned long long)s->us[s->count / 2],
+               (unsigned long long)s->us[s->count * 95 / 100],
+               (unsigned long long)s->us[s->count - 1]);
+    }
+}
+
+/* Route requests made and applied, RIL commands not yet answered */
+struct hal_progress {
+    unsigned int route_requests;
+    unsigned int route_applied;
+    unsigned int ril_pending;
+};
+
+static bool read_progress(struct audio_hw_device *dev,
+                          struct hal_progress *progress)
+{
+    static char buf[DUMP_SIZE];
+    const char *p;
+    size_t len = 0;
+    ssize_t n;
+    int fds[2];
+
+    /* the dump is far smaller than a pipe */
+    if (pipe(fds) != 0)
+        return false;
+    dev->dump(dev, fds[1]);
+    close(fds[1]);
+    while (len < sizeof(buf) - 1 &&
+           (n = read(fds[0], buf + len, sizeof(buf) - 1 - len)) > 0)
+        len += n;
+    close(fds[0]);
+    buf[len] = '\0';
+
+    p = strstr(buf, "Route engine:");
+    if (p == NULL || sscanf(p, "Route engine:\n  requests: %u, applied: %u",
+                            &progress->route_requests,
+                            &progress->route_applied) != 2)
+        return false;
+
+    p = strstr(buf, "RIL commands:");
+    if (p == NULL || (p = strstr(p, "pending: ")) == NULL ||
+            sscanf(p, "pending: %u", &progress->ril_pending) != 1)
+        return false;
+
+    return true;
+}
+
+/* Waits until the routing thread and the RIL queue are done */
+static bool wait_route_done(struct audio_hw_device *dev, uint64_t start)
+{
+    struct hal_progress progress;
+
+    while (read_progress(dev, &progress)) {
+        if (progress.route_applied == progress.route_requests &&
+                progress.ril_pending == 0)
+            return true;
+        if (now_us() - start > ROUTE_WAIT_US)
+            break;
+        usleep(DUMP_POLL_US);
+    }
+
+    return false;
+}
+
+static const struct hw_module_t *load_module(const char *path)
+{
+    const struct hw_module_t *module = NULL;
+    void *handle;
+
+    if (path == NULL) {
+        if (hw_get_module_by_class(AUDIO_HARDWARE_MODULE_ID,
+                                   AUDIO_HARDWARE_MODULE_ID_PRIMARY,
+                                   &module) != 0)
+            return NULL;
+        return module;
+    }
+
+    handle = dlopen(path, RTLD_NOW);
+    if (handle == NULL) {
+        fprintf(stderr, "%s\n", dlerror());
+        return NULL;
+    }
+
+    return dlsym(handle, HAL_MODULE_INFO_SYM_AS_STR);
+}
+
+static void run_call(struct audio_hw_device *dev, struct audio_stream_out *out)
+{
+    char kvpairs[32];
+    uint64_t start;
+    unsigned int i;
+
+    start = now_us();
+    dev->set_mode(dev, AUDIO_MODE_IN_CALL);
+    add_sample(STEP_CALL_SETUP, start);
+
+    for (i = 0; i < CALL_DEVICE_CNT; i++) {
+        snprintf(kvpairs, sizeof(kvpairs), "%s=%d",
+                 AUDIO_PARAMETER_STREAM_ROUTING,
+                 call_devices[(i + 1) % CALL_DEVICE_CNT]);
+        start = now_us();
+        out->common.set_parameters(&out->common, kvpairs);
+        if (wait_route_done(dev, start))
+            add_sample(STEP_ROUTE_CHANGE, start);
+        else
+            fprintf(stderr, "route change to %#x did not complete\n",
+                    call_devices[(i + 1) % CALL_DEVICE_CNT]);
+    }
+
+    /* a slider drag, most steps map to the modem level already set */
+    for (i = 0; i <= VOLUME_STEPS; i++) {
+        start = now_us();
+        dev->set_voice_volume(dev, (float)i / VOLUME_STEPS);
+        add_sample(STEP_VOLUME, start);
+    }
+
+    start = now_us();
+    dev->set_mode(dev, AUDIO_MODE_NORMAL);
+    add_sample(STEP_CALL_TEARDOWN, start);
+}
+
+int main(int argc, char **argv)
+{
+    const struct hw_module_t *module;
+    struct audio_hw_device *dev;
+    struct audio_stream_out *out;
+    struct audio_config config;
+    const char *path = NULL;
+    unsigned int calls = DEFAULT_CALLS;
+    unsigned int gap_ms = DEFAULT_GAP_MS;
+    unsigned int i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:n:g:")) != -1) {
+        switch (opt) {
+        case 'm':
+            path = optarg;
+            break;
+        case 'n':
+            calls = atoi(optarg);
+            break;
+        case 'g':
+            gap_ms = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-m audio.primary.so] [-n calls] "
+                    "[-g gap_ms]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    module = load_module(path);
+    if (module == NULL) {
+        fprintf(stderr, "cannot load the primary audio module\n");
+        return 1;
+    }
+
+    if (audio_hw_device_open(module, &dev) != 0) {
+        fprintf(stderr, "cannot open the audio device\n");
+        return 1;
+    }
+
+    memset(&config, 0, sizeof(config));
+    config.sample_rate = 48000;
+    config.channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+    config.format = AUDIO_FORMAT_PCM_16_BIT;
+    if (dev->open_output_stream(dev, 0, AUDIO_DEVICE_OUT_EARPIECE,
+                                AUDIO_OUTPUT_FLAG_PRIMARY, &config, &out,
+                                NULL) != 0) {
+        fprintf(stderr, "cannot open the primary output\n");
+        audio_hw_device_close(dev);
+        return 1;
+    }
+
+    for (i = 0; i < calls; i++) {
+        run_call(dev, out);
+        usleep(gap_ms * 1000);
+    }
+
+    print_samples();
+    fflush(stdout);
+    dev->dump(dev, STDOUT_FILENO);
+
+    dev->close_output_stream(dev, out);
+    audio_hw_device_close(dev);
+
+    return 0;
+}
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2015 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks of the RIL command queue against a slow modem:
+ *
+ *   fake_rild -l clock=200 &
+ *   ril_queue_test [-n <pairs>]
+ *
+ * Each check first puts a clock sync in flight, then posts while the
+ * modem is busy with it:
+ *
+ *   coalesce  pairs of two mic control and path changes, the way the
+ *             routing thread posts them, must send one of each
+ *   no block  clock syncs between path changes overflow the queue, no
+ *             post may wait for the modem and the last path must still
+ *             reach it
+ *
+ * Exits with 1 if a check fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ril_interface.h"
+
+#define DEFAULT_PAIRS   32
+#define WAIT_MS         10000
+#define POST_MAX_US     20000   /* far below the clock sync latency */
+
+static struct ril_handle ril;
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Waits until the queue is empty and a command is in flight, or until idle */
+static bool wait_queue(bool busy)
+{
+    unsigned int type;
+    bool done = false;
+    int ms;
+
+    for (ms = 0; ms < WAIT_MS && !done; ms++) {
+        pthread_mutex_lock(&ril.lock);
+        done = ril.queue_count == 0 && ril.busy == busy;
+        for (type = 0; type < RIL_CMD_CNT; type++)
+            done = done && !ril.deferred[type];
+        pthread_mutex_unlock(&ril.lock);
+        if (!done)
+            usleep(1000);
+    }
+
+    if (!done)
+        fprintf(stderr, "timed out waiting for the RIL queue\n");
+
+    return done;
+}
+
+static unsigned int sent(void)
+{
+    struct ril_stats stats;
+
+    ril_get_stats(&ril, &stats);
+
+    return stats.sent;
+}
+
+static bool check_coalesce(unsigned int pairs)
+{
+    unsigned int before, count, i;
+
+    ril_set_call_clock_sync(&ril, SOUND_CLOCK_START);
+    if (!wait_queue(true))
+        return false;
+    before = sent();
+
+    for (i = 0; i < pairs; i++) {
+        ril_set_two_mic_control(&ril, AUDIENCE,
+                                i % 2 ? TWO_MIC_SOLUTION_ON :
+                                        TWO_MIC_SOLUTION_OFF);
+        ril_set_call_audio_path(&ril, i % 2 ? SOUND_AUDIO_PATH_SPEAKER :
+                                              SOUND_AUDIO_PATH_HEADSET);
+    }
+
+    if (!wait_queue(false))
+        return false;
+
+    /* the clock sync in flight completes in between */
+    count = sent() - before - 1;
+    printf("coalesce: %u pairs posted, %u commands sent\n", pairs, count);
+
+    return count == 2;
+}
+
+static bool check_no_block(unsigned int pairs)
+{
+    uint64_t start, us, max_us = 0;
+    enum _AudioPath path = SOUND_AUDIO_PATH_HANDSET;
+    unsigned int i;
+    bool ok;
+
+    ril_set_call_clock_sync(&ril, SOUND_CLOCK_STOP);
+    if (!wait_queue(true))
+        return false;
+
+    for (i = 0; i < pairs; i++) {
+        path = i % 2 ? SOUND_AUDIO_PATH_SPEAKER : SOUND_AUDIO_PATH_HEADPHONE;
+
+        start = now_us();
+        ril_set_call_clock_sync(&ril, i % 2 ? SOUND_CLOCK_STOP :
+                                              SOUND_CLOCK_START);
+        ril_set_call_audio_path(&ril, path);
+        us = now_us() - start;
+        if (us > max_us)
+            max_us = us;
+    }
+
+    if (!wait_queue(false))
+        return false;
+
+    pthread_mutex_lock(&ril.lock);
+    ok = ril.last_valid[RIL_CMD_CALL_AUDIO_PATH] &&
+         ril.last[RIL_CMD_CALL_AUDIO_PATH].arg == (int)path;
+    pthread_mutex_unlock(&ril.lock);
+
+    printf("no block: slowest post %llu us, last path %s\n",
+           (unsigned long long)max_us, ok ? "sent" : "lost");
+
+    return ok && max_us < POST_MAX_US;
+}
+
+int main(int argc, char **argv)
+{
+    struct ril_stats stats;
+    unsigned int pairs = DEFAULT_PAIRS;
+    int failed = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n':
+            pairs = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n pairs]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (ril_open(&ril) != 0) {
+        fprintf(stderr, "cannot open the RIL interface\n");
+        return 1;
+    }
+
+    if (!check_coalesce(pairs)) {
+        printf("coalesce: FAILED\n");
+        failed = 1;
+    }
+    if (!check_no_block(pairs)) {
+        printf("no block: FAILED\n");
+        failed = 1;
+    }
+
+    ril_get_stats(&ril, &stats);
+    printf("posted %u, coalesced %u, sent %u, dropped %u\n", stats.posted,
+           stats.coalesced, stats.sent, stats.dropped);
+
+    ril_close(&ril);
+
+    return failed;
+}
@@ -0,0 +1,555 @@
+/*
+ * Copyright (C) 2015 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host tool checking the route table of routing.h against mixer_paths.xml:
+ *
+ *   route_check [-n <count>] configs/audio/mixer_paths.xml
+ *
+ * Reports the route names missing from the XML, the paths no route uses,
+ * the number of controls each route writes on top of the initial mixer
+ * state and the number of controls written by every transition between
+ * two cells of route_configs[][], most expensive first. Exits with 1 when
+ * a route name is missing.
+ *
+ * Controls are compared by name and value as written in the XML, so a
+ * write here is one control whose value changes, which the route engine
+ * does with one ioctl for integer and boolean controls and one ioctl per
+ * value for enums.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <expat.h>
+
+#include "routing.h"
+
+#define BUF_SIZE 1024
+#define DEFAULT_TOP 20
+
+struct setting {
+    unsigned int ctl;
+    const char *value;
+};
+
+struct path {
+    char *name;
+    struct setting *settings;
+    unsigned int num_settings;
+    unsigned int *includes;
+    unsigned int num_includes;
+    bool used;
+};
+
+struct config {
+    char **ctls;                /* "name" or "name[id]" */
+    const char **init;          /* initial values, NULL when not set */
+    unsigned int num_ctls;
+    struct path *paths;
+    unsigned int num_paths;
+    int path;                   /* path being defined, -1 at top level */
+    int level;
+    int error;
+};
+
+struct transition {
+    unsigned int from;          /* IN_SOURCE * OUT_DEVICE_TAB_SIZE + OUT_DEVICE */
+    unsigned int to;
+    unsigned int writes;
+};
+
+static const char * const in_source_names[IN_SOURCE_TAB_SIZE] = {
+    "MIC",
+    "CAMCORDER",
+    "VOICE_RECOGNITION",
+    "VOICE_COMMUNICATION",
+    "VOICE_CALL",
+    "VOICE_CALL_WB"
+};
+
+static const char * const out_device_names[OUT_DEVICE_TAB_SIZE] = {
+    "SPEAKER",
+    "EARPIECE",
+    "HEADSET",
+    "HEADPHONES",
+    "BT_SCO",
+    "BT_SCO_HEADSET_OUT",
+    "BT_SCO_CARKIT",
+    "SPEAKER_AND_HEADSET",
+    "SPEAKER_AND_EARPIECE"
+};
+
+#define NUM_CELLS (IN_SOURCE_TAB_SIZE * OUT_DEVICE_TAB_SIZE)
+
+static void *grow(void *array, unsigned int count, size_t elem_size)
+{
+    void *p;
+
+    /* grow in powers of two */
+    if (count & (count - 1))
+        return array;
+
+    p = realloc(array, (count ? count * 2 : 8) * elem_size);
+    if (p == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(2);
+    }
+
+    return p;
+}
+
+static char *xstrdup(const char *s)
+{
+    char *p = strdup(s);
+
+    if (p == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(2);
+    }
+
+    return p;
+}
+
+static int find_path(const struct config *config, const char *name)
+{
+    unsigned int i;
+
+    for (i = 0; i < config->num_paths; i++) {
+        if (strcmp(config->paths[i].name, name) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+static unsigned int get_ctl(struct config *config, const char *name,
+                            const char *id)
+{
+    char key[256];
+    unsigned int i;
+
+    if (id)
+        snprintf(key, sizeof(key), "%s[%s]", name, id);
+    else
+        snprintf(key, sizeof(key), "%s", name);
+
+    for (i = 0; i < config->num_ctls; i++) {
+        if (strcmp(config->ctls[i], key) == 0)
+            return i;
+    }
+
+    config->ctls = grow(config->ctls, config->num_ctls, sizeof(char *));
+    config->init = grow(config->init, config->num_ctls, sizeof(char *));
+    config->ctls[i] = xstrdup(key);
+    config->init[i] = NULL;
+    config->num_ctls++;
+
+    return i;
+}
+
+static void add_setting(struct path *path, unsigned int ctl, const char *value)
+{
+    path->settings = grow(path->settings, path->num_settings,
+                          sizeof(struct setting));
+    path->settings[path->num_settings].ctl = ctl;
+    path->settings[path->num_settings].value = value;
+    path->num_settings++;
+}
+
+static const char *get_attr(const XML_Char **attr, const char *name)
+{
+    unsigned int i;
+
+    for (i = 0; attr[i]; i += 2) {
+        if (strcmp(attr[i], name) == 0)
+            return attr[i + 1];
+    }
+
+    return NULL;
+}
+
+static void start_tag(void *data, const XML_Char *tag_name,
+                      const XML_Char **attr)
+{
+    struct config *config = data;
+    const char *name = get_attr(attr, "name");
+    const char *value = get_attr(attr, "value");
+    unsigned int i;
+
+    config->level++;
+
+    if (strcmp(tag_name, "path") == 0) {
+        struct path *path;
+        int p;
+
+        if (name == NULL) {
+            fprintf(stderr, "path without name\n");
+            config->error = -EINVAL;
+            return;
+        }
+
+        if (config->path < 0) {
+            /* path definition */
+            if (find_path(config, name) >= 0) {
+                fprintf(stderr, "path '%s' defined twice\n", name);
+                config->error = -EINVAL;
+            }
+            config->paths = grow(config->paths, config->num_paths,
+                                 sizeof(struct path));
+            path = &config->paths[config->num_paths];
+            memset(path, 0, sizeof(*path));
+            path->name = xstrdup(name);
+            config->path = config->num_paths++;
+            return;
+        }
+
+        /* included path, expanded in place */
+        p = find_path(config, name);
+        if (p < 0) {
+            fprintf(stderr, "path '%s' includes unknown path '%s'\n",
+                    config->paths[config->path].name, name);
+            config->error = -EINVAL;
+            return;
+        }
+
+        path = &config->paths[config->path];
+        path->includes = grow(path->includes, path->num_includes,
+                              sizeof(unsigned int));
+        path->includes[path->num_includes++] = p;
+        for (i = 0; i < config->paths[p].num_settings; i++)
+            add_setting(path, config->paths[p].settings[i].ctl,
+                        config->paths[p].settings[i].value);
+    } else if (strcmp(tag_name, "ctl") == 0) {
+        unsigned int ctl;
+
+        if (name == NULL || value == NULL) {
+            fprintf(stderr, "ctl without name or value\n");
+            config->error = -EINVAL;
+            return;
+        }
+
+        ctl = get_ctl(config, name, get_attr(attr, "id"));
+        if (config->path < 0)
+            config->init[ctl] = xstrdup(value);
+        else
+            add_setting(&config->paths[config->path], ctl, xstrdup(value));
+    }
+}
+
+static void end_tag(void *data, const XML_Char *tag_name)
+{
+    struct config *config = data;
+
+    config->level--;
+
+    /* an included path ends one level deeper than its definition */
+    if (strcmp(tag_name, "path") == 0 && config->level == 1)
+        config->path = -1;
+}
+
+static int parse_xml(struct config *config, const char *xml_path)
+{
+    XML_Parser parser;
+    FILE *file;
+    int bytes_read;
+    void *buf;
+    int ret = 0;
+
+    file = fopen(xml_path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "%s: %s\n", xml_path, strerror(errno));
+        return -errno;
+    }
+
+    parser = XML_ParserCreate(NULL);
+    if (parser == NULL) {
+        fclose(file);
+        return -ENOMEM;
+    }
+
+    config->path = -1;
+    XML_SetUserData(parser, config);
+    XML_SetElementHandler(parser, start_tag, end_tag);
+
+    for (;;) {
+        buf = XML_GetBuffer(parser, BUF_SIZE);
+        if (buf == NULL) {
+            ret = -ENOMEM;
+            break;
+        }
+
+        bytes_read = fread(buf, 1, BUF_SIZE, file);
+        if (bytes_read < 0) {
+            ret = -EIO;
+            break;
+        }
+
+        if (XML_ParseBuffer(parser, bytes_read, bytes_read == 0)
+                == XML_STATUS_ERROR) {
+            fprintf(stderr, "%s:%d: %s\n", xml_path,
+                    (int)XML_GetCurrentLineNumber(parser),
+                    XML_ErrorString(XML_GetErrorCode(parser)));
+            ret = -EINVAL;
+            break;
+        }
+
+        if (bytes_read == 0)
+            break;
+    }
+
+    XML_ParserFree(parser);
+    fclose(file);
+
+    return ret ? ret : config->error;
+}
+
+static void mark_used(struct config *config, unsigned int p)
+{
+    struct path *path = &config->paths[p];
+    unsigned int i;
+
+    if (path->used)
+        return;
+
+    path->used = true;
+    for (i = 0; i < path->num_includes; i++)
+        mark_used(config, path->includes[i]);
+}
+
+static void apply_path(const struct config *config, const char **state,
+                       const char *name)
+{
+    const struct path *path;
+    unsigned int i;
+    int p;
+
+    p = find_path(config, name);
+    if (p < 0)
+        return;
+
+    path = &config->paths[p];
+    for (i = 0; i < path->num_settings; i++)
+        state[path->settings[i].ctl] = path->settings[i].value;
+}
+
+static unsigned int count_writes(const struct config *config,
+                                 const char **from, const char **to)
+{
+    unsigned int i, writes = 0;
+
+    for (i = 0; i < config->num_ctls; i++) {
+        if (to[i] != NULL && (from[i] == NULL || strcmp(from[i], to[i]) != 0))
+            writes++;
+    }
+
+    return writes;
+}
+
+static int compare_transitions(const void *a, const void *b)
+{
+    const struct transition *ta = a;
+    const struct transition *tb = b;
+
+    if (ta->writes != tb->writes)
+        return ta->writes < tb->writes ? 1 : -1;
+    if (ta->from != tb->from)
+        return ta->from < tb->from ? -1 : 1;
+    return ta->to < tb->to ? -1 : ta->to > tb->to;
+}
+
+static void print_cell(unsigned int cell)
+{
+    const struct route_config *route = route_configs[cell / OUT_DEVICE_TAB_SIZE]
+                                                    [cell % OUT_DEVICE_TAB_SIZE];
+
+    printf("%s/%s (%s + %s)", in_source_names[cell / OUT_DEVICE_TAB_SIZE],
+           out_device_names[cell % OUT_DEVICE_TAB_SIZE],
+           route->output_route, route->input_route);
+}
+
+static int check_name(struct config *config, const char *name,
+                      unsigned int source, unsigned int device)
+{
+    int p = find_path(config, name);
+
+    if (p >= 0) {
+        mark_used(config, p);
+        return 0;
+    }
+
+    printf("  %-36s %s/%s\n", name, in_source_names[source],
+           out_device_names[device]);
+    return 1;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n <count>] <mixer_paths.xml>\n", prog);
+    fprintf(stderr, "  -n  number of transitions listed, default %d\n",
+            DEFAULT_TOP);
+}
+
+int main(int argc, char **argv)
+{
+    struct config config;
+    const char **states[NUM_CELLS];
+    unsigned int route_writes[NUM_CELLS];
+    struct transition *transitions;
+    unsigned int num_transitions = 0;
+    unsigned int top = DEFAULT_TOP;
+    unsigned int missing = 0, unused = 0;
+    unsigned long long total = 0;
+    unsigned int i, j;
+    int opt, p;
+
+    while ((opt = getopt(argc, argv, "n:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            top = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    memset(&config, 0, sizeof(config));
+    if (parse_xml(&config, argv[optind]) < 0)
+        return 2;
+
+    printf("%s: %u paths, %u controls\n\n", argv[optind], config.num_paths,
+           config.num_ctls);
+
+    printf("Missing paths:\n");
+    for (i = 0; i < IN_SOURCE_TAB_SIZE; i++) {
+        for (j = 0; j < OUT_DEVICE_TAB_SIZE; j++) {
+            missing += check_name(&config, route_configs[i][j]->output_route,
+                                  i, j);
+            missing += check_name(&config, route_configs[i][j]->input_route,
+                                  i, j);
+        }
+    }
+    p = find_path(&config, bt_wbs_path);
+    if (p >= 0) {
+        mark_used(&config, p);
+    } else {
+        printf("  %-36s SCO wide band speech\n", bt_wbs_path);
+        missing++;
+    }
+    if (missing == 0)
+        printf("  none\n");
+
+    printf("\nPaths not used by any route:\n");
+    for (i = 0; i < config.num_paths; i++) {
+        if (!config.paths[i].used) {
+            printf("  %s\n", config.paths[i].name);
+            unused++;
+        }
+    }
+    if (unused == 0)
+        printf("  none\n");
+
+    /*
+     * Route state of every cell on top of the initial state, the input
+     * route is applied after the output route as select_devices() does.
+     */
+    printf("\nControls written per route from the initial state:\n");
+    printf("  %-20s", "");
+    for (j = 0; j < OUT_DEVICE_TAB_SIZE; j++)
+        printf(" %5u", j);
+    printf("\n");
+
+    for (i = 0; i < NUM_CELLS; i++) {
+        const struct route_config *route =
+                route_configs[i / OUT_DEVICE_TAB_SIZE][i % OUT_DEVICE_TAB_SIZE];
+
+        states[i] = malloc(config.num_ctls * sizeof(char *));
+        if (states[i] == NULL)
+            return 2;
+        memcpy(states[i], config.init, config.num_ctls * sizeof(char *));
+        apply_path(&config, states[i], route->output_route);
+        apply_path(&config, states[i], route->input_route);
+        route_writes[i] = count_writes(&config, config.init, states[i]);
+    }
+
+    for (i = 0; i < IN_SOURCE_TAB_SIZE; i++) {
+        printf("  %-20s", in_source_names[i]);
+        for (j = 0; j < OUT_DEVICE_TAB_SIZE; j++)
+            printf(" %5u", route_writes[i * OUT_DEVICE_TAB_SIZE + j]);
+        printf("\n");
+    }
+    printf("  columns:");
+    for (j = 0; j < OUT_DEVICE_TAB_SIZE; j++)
+        printf(" %u=%s", j, out_device_names[j]);
+    printf("\n");
+
+    /* cells sharing a route config cost nothing to switch between */
+    transitions = malloc(NUM_CELLS * NUM_CELLS * sizeof(struct transition));
+    if (transitions == NULL)
+        return 2;
+
+    for (i = 0; i < NUM_CELLS; i++) {
+        for (j = 0; j < NUM_CELLS; j++) {
+            struct transition *t;
+
+            if (route_configs[i / OUT_DEVICE_TAB_SIZE][i % OUT_DEVICE_TAB_SIZE] ==
+                    route_configs[j / OUT_DEVICE_TAB_SIZE][j % OUT_DEVICE_TAB_SIZE])
+                continue;
+
+            t = &transitions[num_transitions++];
+            t->from = i;
+            t->to = j;
+            t->writes = count_writes(&config, states[i], states[j]);
+            total += t->writes;
+        }
+    }
+
+    qsort(transitions, num_transitions, sizeof(struct transition),
+          compare_transitions);
+
+    printf("\nTransitions: %u, controls written: %llu total, %.1f average, "
+           "%u max\n", num_transitions, total,
+           num_transitions ? (double)total / num_transitions : 0.0,
+           num_transitions ? transitions[0].writes : 0);
+
+    if (top > num_transitions)
+        top = num_transitions;
+    if (top > 0)
+        printf("\nMost expensive transitions:\n");
+    for (i = 0; i < top; i++) {
+        printf("  %4u  ", transitions[i].writes);
+        print_cell(transitions[i].from);
+        printf("\n     -> ");
+        print_cell(transitions[i].to);
+        printf("\n");
+    }
+
+    free(transitions);
+    for (i = 0; i < NUM_CELLS; i++)
+        free(states[i]);
+
+    return missing ? 1 : 0;
+}
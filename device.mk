@@ -174,6 +174,7 @@ PRODUCT_COPY_FILES += \
 
 PRODUCT_COPY_FILES += \
     $(LOCAL_PATH)/configs/audio/audio_policy.conf:system/etc/audio_policy.conf \
+    $(LOCAL_PATH)/configs/audio/default_gain.conf:system/etc/default_gain.conf \
     $(LOCAL_PATH)/configs/audio/mixer_paths.xml:system/etc/mixer_paths.xml
 
 PRODUCT_PACKAGES += \
@@ -235,6 +236,9 @@ PRODUCT_PROPERTY_OVERRIDES += \
 ### POWER
 ###########################################################
 
+PRODUCT_COPY_FILES += \
+    $(LOCAL_PATH)/configs/power/power_profiles.conf:system/etc/power_profiles.conf
+
 PRODUCT_PACKAGES += \
     power.universal5433
 
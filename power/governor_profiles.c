@@ -0,0 +1,290 @@
+/*
+ * Copyright (C) 2015 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "Exynos5433PowerHAL"
+/* #define LOG_NDEBUG 0 */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <utils/Log.h>
+
+#include "governor_profiles.h"
+
+#define LINE_MAX_LEN 256
+
+static const char *cluster_names[CLUSTER_CNT] = {
+    [CLUSTER_LITTLE] = "cpu0",
+    [CLUSTER_BIG] = "cpu4",
+};
+
+static const char *param_names[PARAM_CNT] = {
+    [PARAM_MULTI_ENTER_LOAD] = "multi_enter_load",
+    [PARAM_MULTI_ENTER_TIME] = "multi_enter_time",
+    [PARAM_MULTI_EXIT_LOAD] = "multi_exit_load",
+    [PARAM_MULTI_EXIT_TIME] = "multi_exit_time",
+    [PARAM_SINGLE_ENTER_LOAD] = "single_enter_load",
+    [PARAM_SINGLE_ENTER_TIME] = "single_enter_time",
+    [PARAM_SINGLE_EXIT_LOAD] = "single_exit_load",
+    [PARAM_SINGLE_EXIT_TIME] = "single_exit_time",
+    [PARAM_PARAM_INDEX] = "param_index",
+    [PARAM_TIMER_RATE] = "timer_rate",
+    [PARAM_TIMER_SLACK] = "timer_slack",
+    [PARAM_MIN_SAMPLE_TIME] = "min_sample_time",
+    [PARAM_HISPEED_FREQ] = "hispeed_freq",
+    [PARAM_GO_HISPEED_LOAD] = "go_hispeed_load",
+    [PARAM_TARGET_LOADS] = "target_loads",
+    [PARAM_ABOVE_HISPEED_DELAY] = "above_hispeed_delay",
+};
+
+const char *governor_cluster_name(enum cluster_id cluster)
+{
+    return cluster_names[cluster];
+}
+
+const char *governor_param_name(enum governor_param param)
+{
+    return param_names[param];
+}
+
+static char *trim(char *s)
+{
+    char *end;
+
+    while (isspace((unsigned char)*s))
+        s++;
+
+    end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1]))
+        end--;
+    *end = '\0';
+
+    return s;
+}
+
+static int add_profile(struct governor_profiles *profiles, const char *name)
+{
+    struct governor_profile *profile;
+
+    if (strlen(name) == 0 || strlen(name) >= PROFILE_NAME_MAX) {
+        ALOGE("%s: bad profile name '%s'", __func__, name);
+        return -EINVAL;
+    }
+
+    if (governor_profiles_find(profiles, name) != NULL) {
+        ALOGE("%s: profile '%s' defined twice", __func__, name);
+        return -EINVAL;
+    }
+
+    profile = realloc(profiles->profiles,
+                      (profiles->count + 1) * sizeof(struct governor_profile));
+    if (profile == NULL)
+        return -ENOMEM;
+    profiles->profiles = profile;
+
+    profile = &profiles->profiles[profiles->count++];
+    memset(profile, 0, sizeof(*profile));
+    strcpy(profile->name, name);
+
+    return 0;
+}
+
+/* Copies a value to the pool, offset 0 is the empty string of unset values */
+static int add_value(struct governor_profiles *profiles, const char *value,
+                     uint16_t *offset)
+{
+    size_t len = strlen(value) + 1;
+    char *pool;
+
+    if (len > PARAM_VALUE_MAX) {
+        ALOGE("%s: value '%s' too long", __func__, value);
+        return -EINVAL;
+    }
+
+    if (profiles->pool_size + len > UINT16_MAX) {
+        ALOGE("%s: too many values", __func__);
+        return -EINVAL;
+    }
+
+    pool = realloc(profiles->pool, profiles->pool_size + len);
+    if (pool == NULL)
+        return -ENOMEM;
+    profiles->pool = pool;
+
+    memcpy(pool + profiles->pool_size, value, len);
+    *offset = profiles->pool_size;
+    profiles->pool_size += len;
+
+    return 0;
+}
+
+/* Parses a "cpuN.param = value" line of the last profile */
+static int parse_setting(struct governor_profiles *profiles, char *line)
+{
+    struct governor_profile *profile;
+    char *key, *value, *param;
+    unsigned int cluster, i;
+
+    if (profiles->count == 0) {
+        ALOGE("%s: setting outside of a profile", __func__);
+        return -EINVAL;
+    }
+    profile = &profiles->profiles[profiles->count - 1];
+
+    value = strchr(line, '=');
+    param = strchr(line, '.');
+    if (value == NULL || param == NULL || param > value) {
+        ALOGE("%s: expected cpuN.param = value", __func__);
+        return -EINVAL;
+    }
+    *value++ = '\0';
+    *param++ = '\0';
+    key = trim(line);
+    param = trim(param);
+    value = trim(value);
+
+    for (cluster = 0; cluster < CLUSTER_CNT; cluster++) {
+        if (strcmp(key, cluster_names[cluster]) == 0)
+            break;
+    }
+    if (cluster == CLUSTER_CNT) {
+        ALOGE("%s: unknown cluster '%s'", __func__, key);
+        return -EINVAL;
+    }
+
+    for (i = 0; i < PARAM_CNT; i++) {
+        if (strcmp(param, param_names[i]) == 0)
+            break;
+    }
+    if (i == PARAM_CNT) {
+        ALOGE("%s: unknown parameter '%s'", __func__, param);
+        return -EINVAL;
+    }
+
+    if (strlen(value) == 0) {
+        ALOGE("%s: no value for %s.%s", __func__, key, param);
+        return -EINVAL;
+    }
+
+    return add_value(profiles, value, &profile->values[cluster][i]);
+}
+
+int governor_profiles_load(struct governor_profiles *profiles,
+                           const char *path)
+{
+    struct governor_profiles new_profiles;
+    char buf[LINE_MAX_LEN];
+    unsigned int line_no = 0;
+    char *line, *end;
+    FILE *f;
+    int ret = 0;
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        ret = -errno;
+        ALOGE("%s: cannot open %s: %s", __func__, path, strerror(errno));
+        return ret;
+    }
+
+    memset(&new_profiles, 0, sizeof(new_profiles));
+    new_profiles.pool = calloc(1, 1);
+    if (new_profiles.pool == NULL) {
+        fclose(f);
+        return -ENOMEM;
+    }
+    new_profiles.pool_size = 1;
+
+    while (ret == 0 && fgets(buf, sizeof(buf), f) != NULL) {
+        line_no++;
+
+        if (strchr(buf, '\n') == NULL && !feof(f)) {
+            ALOGE("%s: line too long", __func__);
+            ret = -EINVAL;
+            break;
+        }
+
+        end = strchr(buf, '#');
+        if (end != NULL)
+            *end = '\0';
+
+        line = trim(buf);
+        if (line[0] == '\0')
+            continue;
+
+        if (line[0] == '[') {
+            end = strchr(line, ']');
+            if (end == NULL || end[1] != '\0') {
+                ALOGE("%s: expected [name]", __func__);
+                ret = -EINVAL;
+                break;
+            }
+            *end = '\0';
+            ret = add_profile(&new_profiles, trim(line + 1));
+        } else {
+            ret = parse_setting(&new_profiles, line);
+        }
+    }
+
+    fclose(f);
+
+    if (ret != 0) {
+        ALOGE("%s: %s:%u is invalid, keeping the %u loaded profiles",
+              __func__, path, line_no, profiles->count);
+        governor_profiles_free(&new_profiles);
+        return ret;
+    }
+
+    governor_profiles_free(profiles);
+    *profiles = new_profiles;
+
+    ALOGV("%s: %u profiles, %zu bytes of values", __func__, profiles->count,
+          profiles->pool_size);
+
+    return 0;
+}
+
+void governor_profiles_free(struct governor_profiles *profiles)
+{
+    free(profiles->profiles);
+    free(profiles->pool);
+    memset(profiles, 0, sizeof(*profiles));
+}
+
+const struct governor_profile *governor_profiles_find(
+        const struct governor_profiles *profiles, const char *name)
+{
+    unsigned int i;
+
+    for (i = 0; i < profiles->count; i++) {
+        if (strcmp(profiles->profiles[i].name, name) == 0)
+            return &profiles->profiles[i];
+    }
+
+    return NULL;
+}
+
+const char *governor_profile_value(const struct governor_profiles *profiles,
+                                   const struct governor_profile *profile,
+                                   enum cluster_id cluster,
+                                   enum governor_param param)
+{
+    uint16_t offset = profile->values[cluster][param];
+
+    return offset != 0 ? profiles->pool + offset : NULL;
+}
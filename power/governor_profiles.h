@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2015 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GOVERNOR_PROFILES_H
+#define GOVERNOR_PROFILES_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Named sets of interactive governor parameters per cluster, read from a
+ * file like:
+ *
+ *   [default]
+ *   cpu0.timer_rate = 20000
+ *   cpu4.target_loads = 80 1000000:81 1400000:87 1700000:90
+ *
+ * A file is parsed in one go into a table of value offsets per profile,
+ * cluster and parameter, the values themselves go to one string pool.
+ */
+
+#define GOVERNOR_PROFILES_PATH "/system/etc/power_profiles.conf"
+
+#define PROFILE_NAME_MAX 32
+#define PARAM_VALUE_MAX  128
+
+enum cluster_id {
+    CLUSTER_LITTLE,     /* cpu0-3 */
+    CLUSTER_BIG,        /* cpu4-7 */
+    CLUSTER_CNT
+};
+
+/*
+ * In the order they are written: param_index selects which set of the
+ * parameters after it the governor takes.
+ */
+enum governor_param {
+    PARAM_MULTI_ENTER_LOAD,
+    PARAM_MULTI_ENTER_TIME,
+    PARAM_MULTI_EXIT_LOAD,
+    PARAM_MULTI_EXIT_TIME,
+    PARAM_SINGLE_ENTER_LOAD,
+    PARAM_SINGLE_ENTER_TIME,
+    PARAM_SINGLE_EXIT_LOAD,
+    PARAM_SINGLE_EXIT_TIME,
+    PARAM_PARAM_INDEX,
+    PARAM_TIMER_RATE,
+    PARAM_TIMER_SLACK,
+    PARAM_MIN_SAMPLE_TIME,
+    PARAM_HISPEED_FREQ,
+    PARAM_GO_HISPEED_LOAD,
+    PARAM_TARGET_LOADS,
+    PARAM_ABOVE_HISPEED_DELAY,
+    PARAM_CNT
+};
+
+struct governor_profile {
+    char name[PROFILE_NAME_MAX];
+    uint16_t values[CLUSTER_CNT][PARAM_CNT];    /* pool offsets, 0 if unset */
+};
+
+struct governor_profiles {
+    struct governor_profile *profiles;
+    unsigned int count;
+    char *pool;
+    size_t pool_size;
+};
+
+/* Function prototypes */
+const char *governor_cluster_name(enum cluster_id cluster);
+const char *governor_param_name(enum governor_param param);
+
+/* Replaces the profiles with those of a file, they are kept on error */
+int governor_profiles_load(struct governor_profiles *profiles,
+                           const char *path);
+void governor_profiles_free(struct governor_profiles *profiles);
+
+const struct governor_profile *governor_profiles_find(
+        const struct governor_profiles *profiles, const char *name);
+/* NULL if the profile leaves the parameter alone */
+const char *governor_profile_value(const struct governor_profiles *profiles,
+                                   const struct governor_profile *profile,
+                                   enum cluster_id cluster,
+                                   enum governor_param param);
+
+#endif
@@ -17,6 +17,8 @@
 
 #include <dirent.h>
 #include <errno.h>
+#include <limits.h>
+#include <stdio.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -29,9 +31,15 @@
 /* #define LOG_NDEBUG 0 */
 #include <utils/Log.h>
 
+#include <cutils/properties.h>
+#define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
+#include <sys/_system_properties.h>
+
 #include <hardware/hardware.h>
 #include <hardware/power.h>
 
+#include "governor_profiles.h"
+
 #define NSEC_PER_SEC 1000000000
 #define USEC_PER_SEC 1000000
 #define NSEC_PER_USEC 100
@@ -45,6 +53,9 @@
 #define BOOST_PULSE_DURATION 400000
 #define BOOST_PULSE_DURATION_STR POWERHAL_STRINGIFY(BOOST_PULSE_DURATION)
 
+/* how often touches look for a cluster which came back online */
+#define PROFILE_CHECK_INTERVAL_S 1
+
 #define BOOST_CPU0_PATH "/sys/devices/system/cpu/cpu0/cpufreq/interactive/boost"
 #define BOOST_CPU4_PATH "/sys/devices/system/cpu/cpu4/cpufreq/interactive/boost"
 
@@ -59,14 +70,92 @@
 #define TOUCHSCREEN_PATH "/sys/class/input/input2/enabled"
 #define TOUCHKEY_PATH "/sys/class/input/input1/enabled"
 
+#define INTERACTIVE_DIR_FMT "/sys/devices/system/cpu/%s/cpufreq/interactive"
+#define INTERACTIVE_PARAM_FMT INTERACTIVE_DIR_FMT "/%s"
+
+/*
+ * The profile is picked from GOVERNOR_PROFILES_PATH by name, setting the
+ * reload property to a new value reads the file again.
+ */
+#define PROFILE_PROPERTY "persist.power_hal.profile"
+#define PROFILE_RELOAD_PROPERTY "power_hal.profile_reload"
+#define DEFAULT_PROFILE "default"
+
+/*
+ * Governor parameters of profiles which do not set them. You get the values
+ * reading the hexdump from the biniary power module or strace
+ */
+static const char *default_params[CLUSTER_CNT][PARAM_CNT] = {
+    [CLUSTER_LITTLE] = {
+        [PARAM_MULTI_ENTER_LOAD] = "800",
+        [PARAM_SINGLE_ENTER_LOAD] = "200",
+        [PARAM_PARAM_INDEX] = "0",
+        [PARAM_TIMER_RATE] = "20000",
+        [PARAM_TIMER_SLACK] = "20000",
+        [PARAM_MIN_SAMPLE_TIME] = "40000",
+        [PARAM_HISPEED_FREQ] = "900000",
+        [PARAM_GO_HISPEED_LOAD] = "85",
+        [PARAM_TARGET_LOADS] = "75",
+        [PARAM_ABOVE_HISPEED_DELAY] = "19000",
+    },
+    [CLUSTER_BIG] = {
+        [PARAM_MULTI_ENTER_LOAD] = "360",
+        [PARAM_MULTI_ENTER_TIME] = "99000",
+        [PARAM_MULTI_EXIT_LOAD] = "240",
+        [PARAM_MULTI_EXIT_TIME] = "299000",
+        [PARAM_SINGLE_ENTER_LOAD] = "95",
+        [PARAM_SINGLE_ENTER_TIME] = "199000",
+        [PARAM_SINGLE_EXIT_LOAD] = "60",
+        /* was emtpy in hex so a value already defined. */
+        [PARAM_SINGLE_EXIT_TIME] = "99000",
+        /* was emtpy in hex so a value already defined. */
+        [PARAM_PARAM_INDEX] = "0",
+        [PARAM_TIMER_RATE] = "20000",
+        [PARAM_TIMER_SLACK] = "20000",
+        [PARAM_MIN_SAMPLE_TIME] = "40000",
+        [PARAM_HISPEED_FREQ] = "1000000",
+        [PARAM_GO_HISPEED_LOAD] = "89",
+        [PARAM_TARGET_LOADS] = "80 1000000:81 1400000:87 1700000:90",
+        [PARAM_ABOVE_HISPEED_DELAY] = "59000 1200000:119000 1700000:19000",
+    },
+};
+
+/* sysfs nodes written outside of init, they are kept open */
+enum sysfs_node_id {
+    NODE_CPU0_MAX_FREQ,
+    NODE_CPU4_MAX_FREQ,
+    NODE_BOOST_CPU0,
+    NODE_BOOST_CPU4,
+    NODE_TOUCHSCREEN,
+    NODE_TOUCHKEY,
+    NODE_CNT
+};
+
+struct sysfs_node {
+    const char *path;
+    int fd;
+};
+
 struct exynos5433_power_module {
     struct power_module base;
     pthread_mutex_t lock;
     int boostpulse_fd;
     int boostpulse_warned;
-    const char *touchscreen_power_path;
-    const char *touchkey_power_path;
+    struct sysfs_node nodes[NODE_CNT];
     bool touchkey_blocked;
+    struct governor_profiles profiles;
+    unsigned int prop_serial;
+    char profile[PROPERTY_VALUE_MAX];
+    char profile_reload[PROPERTY_VALUE_MAX];
+    struct timespec profile_checked;
+    /*
+     * Governor parameters as last written, empty if unknown. They hold for
+     * the governor directory of inode governor_ino only, 0 if none.
+     */
+    char params[CLUSTER_CNT][PARAM_CNT][PARAM_VALUE_MAX];
+    ino_t governor_ino[CLUSTER_CNT];
+    /* clusters which were offline when the profile was last applied */
+    bool profile_pending[CLUSTER_CNT];
 };
 
 /* POWER_HINT_INTERACTION and POWER_HINT_VSYNC */
@@ -107,36 +196,280 @@ static int sysfs_read(char *path, char *s, int num_bytes)
     return ret;
 }
 
-static void sysfs_write(const char *path, char *s)
+static int sysfs_write(const char *path, const char *s)
 {
     char errno_str[64];
     int len;
+    int ret = 0;
     int fd;
 
     fd = open(path, O_WRONLY);
     if (fd < 0) {
         strerror_r(errno, errno_str, sizeof(errno_str));
         ALOGE("Error opening %s: %s\n", path, errno_str);
-        return;
+        return -1;
     }
 
     len = write(fd, s, strlen(s));
     if (len < 0) {
         strerror_r(errno, errno_str, sizeof(errno_str));
         ALOGE("Error writing to %s: %s\n", path, errno_str);
+
+        ret = -1;
     }
 
     close(fd);
+
+    return ret;
+}
+
+/* You need to request the powerhal lock before calling this function */
+static int sysfs_node_open(struct exynos5433_power_module *exynos5433_pwr,
+                           enum sysfs_node_id id)
+{
+    struct sysfs_node *node = &exynos5433_pwr->nodes[id];
+
+    if (node->fd < 0)
+        node->fd = open(node->path, O_WRONLY);
+
+    return node->fd;
+}
+
+static void sysfs_node_close(struct exynos5433_power_module *exynos5433_pwr,
+                             enum sysfs_node_id id)
+{
+    struct sysfs_node *node = &exynos5433_pwr->nodes[id];
+
+    if (node->fd >= 0) {
+        close(node->fd);
+        node->fd = -1;
+    }
+}
+
+static bool big_cluster_node(enum sysfs_node_id id)
+{
+    return id == NODE_CPU4_MAX_FREQ || id == NODE_BOOST_CPU4;
+}
+
+/*
+ * Forgets the governor parameters written to a cluster, its governor went
+ * away or was created anew with the kernel defaults.
+ */
+static void forget_governor_params(struct exynos5433_power_module *exynos5433_pwr,
+                                   enum cluster_id cluster)
+{
+    unsigned int param;
+
+    for (param = 0; param < PARAM_CNT; param++)
+        exynos5433_pwr->params[cluster][param][0] = '\0';
+    exynos5433_pwr->governor_ino[cluster] = 0;
+}
+
+static void drop_node(struct exynos5433_power_module *exynos5433_pwr,
+                      enum sysfs_node_id id)
+{
+    if (big_cluster_node(id)) {
+        sysfs_node_close(exynos5433_pwr, NODE_CPU4_MAX_FREQ);
+        sysfs_node_close(exynos5433_pwr, NODE_BOOST_CPU4);
+        forget_governor_params(exynos5433_pwr, CLUSTER_BIG);
+    } else {
+        sysfs_node_close(exynos5433_pwr, id);
+    }
+}
+
+/*
+ * Writes to a node like sysfs_write() does, at offset 0 of the open file.
+ * A node which went away, e.g. with its CPU, leaves a stale file behind,
+ * so on error it is reopened and written once more. A node of the big
+ * cluster drops all of them, so big_cluster_online() asks the kernel
+ * again, and one missing with the cluster offline is skipped quietly.
+ *
+ * You need to request the powerhal lock before calling this function
+ */
+static void sysfs_node_write(struct exynos5433_power_module *exynos5433_pwr,
+                             enum sysfs_node_id id, const char *s)
+{
+    struct sysfs_node *node = &exynos5433_pwr->nodes[id];
+    char errno_str[64];
+    size_t len = strlen(s);
+    int retry;
+
+    for (retry = 0; retry < 2; retry++) {
+        if (sysfs_node_open(exynos5433_pwr, id) < 0) {
+            if (errno == ENOENT && big_cluster_node(id)) {
+                drop_node(exynos5433_pwr, id);
+                return;
+            }
+            strerror_r(errno, errno_str, sizeof(errno_str));
+            ALOGE("Error opening %s: %s\n", node->path, errno_str);
+            return;
+        }
+
+        if (pwrite(node->fd, s, len, 0) >= 0)
+            return;
+
+        strerror_r(errno, errno_str, sizeof(errno_str));
+        drop_node(exynos5433_pwr, id);
+    }
+
+    ALOGE("Error writing to %s: %s\n", node->path, errno_str);
+}
+
+/*
+ * The cpufreq nodes of the big cluster only exist while it is online. An
+ * open node is taken for online without asking the kernel again, if the
+ * cluster went away since the next write to any of its nodes fails and
+ * drops them all.
+ *
+ * You need to request the powerhal lock before calling this function
+ */
+static bool big_cluster_online(struct exynos5433_power_module *exynos5433_pwr)
+{
+    return sysfs_node_open(exynos5433_pwr, NODE_CPU4_MAX_FREQ) >= 0;
 }
 
 static void init_touchscreen_power_path(struct exynos5433_power_module *exynos5433_pwr)
 {
-    exynos5433_pwr->touchscreen_power_path = TOUCHSCREEN_PATH;
+    exynos5433_pwr->nodes[NODE_TOUCHSCREEN].path = TOUCHSCREEN_PATH;
 }
 
 static void init_touchkey_power_path(struct exynos5433_power_module *exynos5433_pwr)
 {
-    exynos5433_pwr->touchkey_power_path = TOUCHKEY_PATH;
+    exynos5433_pwr->nodes[NODE_TOUCHKEY].path = TOUCHKEY_PATH;
+}
+
+/*
+ * Writes the parameters of the selected profile which differ from those
+ * written last. Another param_index makes the governor show another set of
+ * the parameters after it, so those are all written again then.
+ *
+ * What was written last is a shadow of this HAL's writes, not read back
+ * from sysfs. It is dropped when the cluster's nodes fail, and when the
+ * governor directory is missing or another one than the shadow was for:
+ * a cluster coming back online gets a new one with the kernel defaults.
+ *
+ * Returns false if the cluster is offline.
+ *
+ * You need to request the powerhal lock before calling this function
+ */
+static bool apply_cluster_profile(struct exynos5433_power_module *exynos5433_pwr,
+                                  const struct governor_profile *profile,
+                                  enum cluster_id cluster)
+{
+    const char *cluster_name = governor_cluster_name(cluster);
+    const char *value;
+    char path[PATH_MAX];
+    struct stat sb;
+    unsigned int param;
+    bool rewrite = false;
+    char *written;
+
+    /* The CPU might not be turned on, then it doesn't make sense to configure it. */
+    snprintf(path, sizeof(path), INTERACTIVE_DIR_FMT, cluster_name);
+    if (stat(path, &sb) < 0) {
+        forget_governor_params(exynos5433_pwr, cluster);
+        return false;
+    }
+
+    if (sb.st_ino != exynos5433_pwr->governor_ino[cluster]) {
+        forget_governor_params(exynos5433_pwr, cluster);
+        exynos5433_pwr->governor_ino[cluster] = sb.st_ino;
+    }
+
+    for (param = 0; param < PARAM_CNT; param++) {
+        value = NULL;
+        if (profile != NULL)
+            value = governor_profile_value(&exynos5433_pwr->profiles,
+                                           profile, cluster, param);
+        if (value == NULL)
+            value = default_params[cluster][param];
+        if (value == NULL)
+            continue;
+
+        written = exynos5433_pwr->params[cluster][param];
+        if (!rewrite && strcmp(written, value) == 0)
+            continue;
+
+        snprintf(path, sizeof(path), INTERACTIVE_PARAM_FMT, cluster_name,
+                 governor_param_name(param));
+        if (sysfs_write(path, value) < 0) {
+            written[0] = '\0';
+            continue;
+        }
+        snprintf(written, PARAM_VALUE_MAX, "%s", value);
+
+        if (param == PARAM_PARAM_INDEX)
+            rewrite = true;
+    }
+
+    return true;
+}
+
+/*
+ * Applies the selected profile to every online cluster. Once the shadows
+ * are current this writes nothing, and costs a stat() per cluster.
+ *
+ * You need to request the powerhal lock before calling this function
+ */
+static void apply_governor_profile(struct exynos5433_power_module *exynos5433_pwr)
+{
+    const struct governor_profile *profile;
+    unsigned int cluster;
+    bool online;
+
+    profile = governor_profiles_find(&exynos5433_pwr->profiles,
+                                     exynos5433_pwr->profile);
+
+    for (cluster = 0; cluster < CLUSTER_CNT; cluster++) {
+        online = apply_cluster_profile(exynos5433_pwr, profile, cluster);
+        if (online == exynos5433_pwr->profile_pending[cluster])
+            ALOGI(online ? "%s is online, applied governor profile %s\n" :
+                           "%s is offline, governor profile %s waits for it\n",
+                  governor_cluster_name(cluster), exynos5433_pwr->profile);
+        exynos5433_pwr->profile_pending[cluster] = !online;
+    }
+}
+
+/*
+ * Reads the profiles file again if the reload property changed and picks
+ * the profile of the profile property, unless no property was set since the
+ * last call. Then applies the profile, which also catches clusters which
+ * came back online since.
+ *
+ * You need to request the powerhal lock before calling this function
+ */
+static void check_governor_profile(struct exynos5433_power_module *exynos5433_pwr)
+{
+    char value[PROPERTY_VALUE_MAX];
+    unsigned int serial = __system_property_area_serial();
+    bool changed = false;
+
+    if (serial != exynos5433_pwr->prop_serial || exynos5433_pwr->profile[0] == '\0') {
+        exynos5433_pwr->prop_serial = serial;
+
+        property_get(PROFILE_RELOAD_PROPERTY, value, "");
+        if (strcmp(value, exynos5433_pwr->profile_reload) != 0) {
+            strcpy(exynos5433_pwr->profile_reload, value);
+            governor_profiles_load(&exynos5433_pwr->profiles, GOVERNOR_PROFILES_PATH);
+            changed = true;
+        }
+
+        property_get(PROFILE_PROPERTY, value, DEFAULT_PROFILE);
+        if (strcmp(value, exynos5433_pwr->profile) != 0) {
+            strcpy(exynos5433_pwr->profile, value);
+            changed = true;
+        }
+    }
+
+    if (changed) {
+        ALOGI("Applying governor profile %s\n", exynos5433_pwr->profile);
+        if (governor_profiles_find(&exynos5433_pwr->profiles,
+                                   exynos5433_pwr->profile) == NULL)
+            ALOGE("No governor profile %s, using the defaults\n",
+                  exynos5433_pwr->profile);
+    }
+
+    apply_governor_profile(exynos5433_pwr);
 }
 
 /*
@@ -150,21 +483,10 @@ static void exynos5433_power_init(struct power_module *module)
     struct stat sb;
     int rc;
 
-    /*
-     * You get the values reading the hexdump from the biniary power module or
-     * strace
-     */
-    sysfs_write("/sys/devices/system/cpu/cpu0/cpufreq/interactive/multi_enter_load", "800");
-    sysfs_write("/sys/devices/system/cpu/cpu0/cpufreq/interactive/single_enter_load", "200");
-    sysfs_write("/sys/devices/system/cpu/cpu0/cpufreq/interactive/param_index", "0");
-
-    sysfs_write("/sys/devices/system/cpu/cpu0/cpufreq/interactive/timer_rate", "20000");
-    sysfs_write("/sys/devices/system/cpu/cpu0/cpufreq/interactive/timer_slack", "20000");
-    sysfs_write("/sys/devices/system/cpu/cpu0/cpufreq/interactive/min_sample_time", "40000");
-    sysfs_write("/sys/devices/system/cpu/cpu0/cpufreq/interactive/hispeed_freq", "900000");
-    sysfs_write("/sys/devices/system/cpu/cpu0/cpufreq/interactive/go_hispeed_load", "85");
-    sysfs_write("/sys/devices/system/cpu/cpu0/cpufreq/interactive/target_loads", "75");
-    sysfs_write("/sys/devices/system/cpu/cpu0/cpufreq/interactive/above_hispeed_delay", "19000");
+    pthread_mutex_lock(&exynos5433_pwr->lock);
+    governor_profiles_load(&exynos5433_pwr->profiles, GOVERNOR_PROFILES_PATH);
+    check_governor_profile(exynos5433_pwr);
+    pthread_mutex_unlock(&exynos5433_pwr->lock);
 
     sysfs_write("/sys/devices/system/cpu/cpu0/cpufreq/interactive/boostpulse_duration",
                 BOOST_PULSE_DURATION_STR);
@@ -176,33 +498,6 @@ static void exynos5433_power_init(struct power_module *module)
         goto out;
     }
 
-    sysfs_write("/sys/devices/system/cpu/cpu4/cpufreq/interactive/multi_enter_load", "360");
-    sysfs_write("/sys/devices/system/cpu/cpu4/cpufreq/interactive/multi_enter_time", "99000");
-
-    sysfs_write("/sys/devices/system/cpu/cpu4/cpufreq/interactive/multi_exit_load", "240");
-    sysfs_write("/sys/devices/system/cpu/cpu4/cpufreq/interactive/multi_exit_time", "299000");
-
-    sysfs_write("/sys/devices/system/cpu/cpu4/cpufreq/interactive/single_enter_load", "95");
-    sysfs_write("/sys/devices/system/cpu/cpu4/cpufreq/interactive/single_enter_time", "199000");
-
-    sysfs_write("/sys/devices/system/cpu/cpu4/cpufreq/interactive/single_exit_load", "60");
-    /* was emtpy in hex so a value already defined. */
-    sysfs_write("/sys/devices/system/cpu/cpu4/cpufreq/interactive/single_exit_time", "99000");
-
-    /* was emtpy in hex so a value already defined. */
-    sysfs_write("/sys/devices/system/cpu/cpu4/cpufreq/interactive/param_index", "0");
-
-    sysfs_write("/sys/devices/system/cpu/cpu4/cpufreq/interactive/timer_rate", "20000");
-    sysfs_write("/sys/devices/system/cpu/cpu4/cpufreq/interactive/timer_slack", "20000");
-
-    sysfs_write("/sys/devices/system/cpu/cpu4/cpufreq/interactive/min_sample_time", "40000");
-    sysfs_write("/sys/devices/system/cpu/cpu4/cpufreq/interactive/hispeed_freq", "1000000");
-
-    sysfs_write("/sys/devices/system/cpu/cpu4/cpufreq/interactive/go_hispeed_load", "89");
-    sysfs_write("/sys/devices/system/cpu/cpu4/cpufreq/interactive/target_loads", "80 1000000:81 1400000:87 1700000:90");
-
-    sysfs_write("/sys/devices/system/cpu/cpu4/cpufreq/interactive/above_hispeed_delay", "59000 1200000:119000 1700000:19000");
-
     sysfs_write("/sys/devices/system/cpu/cpu4/cpufreq/interactive/boostpulse_duration",
                 BOOST_PULSE_DURATION_STR);
 
@@ -221,28 +516,29 @@ out:
 static void exynos5433_power_set_interactive(struct power_module *module, int on)
 {
     struct exynos5433_power_module *exynos5433_pwr = (struct exynos5433_power_module *) module;
-    struct stat sb;
     char buf[80];
     char touchkey_node[2];
     int touchkey_enabled;
-    int rc;
 
     ALOGV("power_set_interactive: %d\n", on);
 
+    pthread_mutex_lock(&exynos5433_pwr->lock);
+
+    check_governor_profile(exynos5433_pwr);
+
     /*
      * Lower maximum frequency when screen is off.  CPU 0 and 1 share a
      * cpufreq policy.
      */
-    sysfs_write(CPU0_MAX_FREQ_PATH,
-                (!on || low_power_mode) ? LOW_POWER_MAX_FREQ_LITTLE : NORMAL_MAX_FREQ_LITTLE);
+    sysfs_node_write(exynos5433_pwr, NODE_CPU0_MAX_FREQ,
+                     (!on || low_power_mode) ? LOW_POWER_MAX_FREQ_LITTLE : NORMAL_MAX_FREQ_LITTLE);
 
-    rc = stat(CPU0_MAX_FREQ_PATH, &sb);
-    if (rc == 0) {
-        sysfs_write(CPU4_MAX_FREQ_PATH,
-                    (!on || low_power_mode) ? LOW_POWER_MAX_FREQ_BIG : NORMAL_MAX_FREQ_BIG);
+    if (big_cluster_online(exynos5433_pwr)) {
+        sysfs_node_write(exynos5433_pwr, NODE_CPU4_MAX_FREQ,
+                         (!on || low_power_mode) ? LOW_POWER_MAX_FREQ_BIG : NORMAL_MAX_FREQ_BIG);
     }
 
-    sysfs_write(exynos5433_pwr->touchscreen_power_path, on ? "1" : "0");
+    sysfs_node_write(exynos5433_pwr, NODE_TOUCHSCREEN, on ? "1" : "0");
     if (!on) {
         if (sysfs_read(TOUCHKEY_PATH, touchkey_node, sizeof(touchkey_node)) == 0) {
             touchkey_enabled = touchkey_node[0] - '0';
@@ -255,13 +551,15 @@ static void exynos5433_power_set_interactive(struct power_module *module, int on
                 exynos5433_pwr->touchkey_blocked = true;
             } else {
                 exynos5433_pwr->touchkey_blocked = false;
-                sysfs_write(exynos5433_pwr->touchkey_power_path, "0");
+                sysfs_node_write(exynos5433_pwr, NODE_TOUCHKEY, "0");
             }
         }
     } else if (!exynos5433_pwr->touchkey_blocked) {
-        sysfs_write(exynos5433_pwr->touchkey_power_path, "1");
+        sysfs_node_write(exynos5433_pwr, NODE_TOUCHKEY, "1");
     }
 
+    pthread_mutex_unlock(&exynos5433_pwr->lock);
+
     ALOGV("power_set_interactive: %d done\n", on);
 }
 
@@ -288,6 +586,25 @@ static int check_boostpulse_on(struct timespec diff)
     return (diff.tv_sec < boost_s);
 }
 
+/*
+ * Checks the governor profile at most once per PROFILE_CHECK_INTERVAL_S,
+ * set_interactive() checks it whenever the screen turns on or off.
+ *
+ * You need to request the powerhal lock before calling this function
+ */
+static void check_governor_profile_limited(struct exynos5433_power_module *exynos5433_pwr)
+{
+    struct timespec now, diff;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    diff = timespec_diff(now, exynos5433_pwr->profile_checked);
+    if (diff.tv_sec < PROFILE_CHECK_INTERVAL_S)
+        return;
+
+    exynos5433_pwr->profile_checked = now;
+    check_governor_profile(exynos5433_pwr);
+}
+
 /* You need to request the powerhal lock before calling this function */
 static int boostpulse_open(struct exynos5433_power_module *exynos5433_pwr)
 {
@@ -338,6 +655,7 @@ static void exynos5433_power_hint(struct power_module *module,
                 }
 
             }
+            check_governor_profile_limited(exynos5433_pwr);
             pthread_mutex_unlock(&exynos5433_pwr->lock);
 
             break;
@@ -361,13 +679,9 @@ static void exynos5433_power_hint(struct power_module *module,
                     diff = timespec_diff(now, last_touch_boost);
 
                     if (check_boostpulse_on(diff)) {
-                        struct stat sb;
-                        int rc;
-
-                        sysfs_write(BOOST_CPU0_PATH, "0");
-                        rc = stat(CPU4_MAX_FREQ_PATH, &sb);
-                        if (rc == 0) {
-                            sysfs_write(BOOST_CPU4_PATH, "0");
+                        sysfs_node_write(exynos5433_pwr, NODE_BOOST_CPU0, "0");
+                        if (big_cluster_online(exynos5433_pwr)) {
+                            sysfs_node_write(exynos5433_pwr, NODE_BOOST_CPU4, "0");
                         }
                     }
                 }
@@ -376,24 +690,19 @@ static void exynos5433_power_hint(struct power_module *module,
             break;
         }
         case POWER_HINT_LOW_POWER: {
-            int rc;
-            struct stat sb;
-
             ALOGV("%s: POWER_HINT_LOW_POWER", __func__);
 
             pthread_mutex_lock(&exynos5433_pwr->lock);
 
             if (data) {
-                sysfs_write(CPU0_MAX_FREQ_PATH, LOW_POWER_MAX_FREQ_LITTLE);
-                rc = stat(CPU4_MAX_FREQ_PATH, &sb);
-                if (rc == 0) {
-                    sysfs_write(CPU4_MAX_FREQ_PATH, LOW_POWER_MAX_FREQ_BIG);
+                sysfs_node_write(exynos5433_pwr, NODE_CPU0_MAX_FREQ, LOW_POWER_MAX_FREQ_LITTLE);
+                if (big_cluster_online(exynos5433_pwr)) {
+                    sysfs_node_write(exynos5433_pwr, NODE_CPU4_MAX_FREQ, LOW_POWER_MAX_FREQ_BIG);
                 }
             } else {
-                sysfs_write(CPU0_MAX_FREQ_PATH, NORMAL_MAX_FREQ_LITTLE);
-                rc = stat(CPU4_MAX_FREQ_PATH, &sb);
-                if (rc == 0) {
-                    sysfs_write(CPU4_MAX_FREQ_PATH, NORMAL_MAX_FREQ_BIG);
+                sysfs_node_write(exynos5433_pwr, NODE_CPU0_MAX_FREQ, NORMAL_MAX_FREQ_LITTLE);
+                if (big_cluster_online(exynos5433_pwr)) {
+                    sysfs_node_write(exynos5433_pwr, NODE_CPU4_MAX_FREQ, NORMAL_MAX_FREQ_BIG);
                 }
             }
             low_power_mode = data;
@@ -430,4 +739,12 @@ struct exynos5433_power_module HAL_MODULE_INFO_SYM = {
     lock: PTHREAD_MUTEX_INITIALIZER,
     boostpulse_fd: -1,
     boostpulse_warned: 0,
+    nodes: {
+        [NODE_CPU0_MAX_FREQ] = { CPU0_MAX_FREQ_PATH, -1 },
+        [NODE_CPU4_MAX_FREQ] = { CPU4_MAX_FREQ_PATH, -1 },
+        [NODE_BOOST_CPU0] = { BOOST_CPU0_PATH, -1 },
+        [NODE_BOOST_CPU4] = { BOOST_CPU4_PATH, -1 },
+        [NODE_TOUCHSCREEN] = { TOUCHSCREEN_PATH, -1 },
+        [NODE_TOUCHKEY] = { TOUCHKEY_PATH, -1 },
+    },
 };